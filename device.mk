@@ -502,6 +502,8 @@ include hardware/google/pixel/rebalance_interrupts/rebalance_interrupts.mk
 # PowerStats HAL
 PRODUCT_PACKAGES += \
 	android.hardware.power.stats-service.pixel
+PRODUCT_PACKAGES_DEBUG += \
+	powerstats_journal
 
 #
 # Audio HALs
@@ -0,0 +1,172 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <AocSnapshotStateResidencyDataProvider.h>
+
+#include <android-base/logging.h>
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+namespace aidl {
+namespace android {
+namespace hardware {
+namespace power {
+namespace stats {
+
+namespace {
+
+constexpr char kEntryCountPrefix[] = "Counter:";
+constexpr char kTotalTimePrefix[] = "Cumulative time:";
+constexpr char kLastEntryPrefix[] = "Time last entered:";
+constexpr size_t kNodeBufSize = 256;
+
+int64_t nowMs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<int64_t>(ts.tv_sec) * 1000 + ts.tv_nsec / 1000000;
+}
+
+bool parseField(const char *buf, const char *prefix, uint64_t *out) {
+    const char *p = strstr(buf, prefix);
+    if (p == nullptr) {
+        return false;
+    }
+    char *end;
+    *out = strtoull(p + strlen(prefix), &end, 10);
+    return end != p + strlen(prefix);
+}
+
+}  // namespace
+
+AocResidencySnapshot::AocResidencySnapshot(const std::string &controlDir)
+    : kControlDir(controlDir), mGeneration(0), mRefreshTimeMs(0) {}
+
+size_t AocResidencySnapshot::addNode(const std::string &name) {
+    std::scoped_lock lk(mLock);
+    mNodes.push_back({name, ::android::base::unique_fd()});
+    mCounters.push_back({});
+    return mNodes.size() - 1;
+}
+
+bool AocResidencySnapshot::readNodeLocked(Node *node, Counters *counters) {
+    if (node->fd == -1) {
+        if (mDirFd == -1) {
+            mDirFd.reset(open(kControlDir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC));
+            if (mDirFd == -1) {
+                PLOG(ERROR) << "Failed to open " << kControlDir;
+                return false;
+            }
+        }
+        node->fd.reset(openat(mDirFd, node->name.c_str(), O_RDONLY | O_CLOEXEC));
+        if (node->fd == -1) {
+            PLOG(ERROR) << "Failed to open " << kControlDir << node->name;
+            return false;
+        }
+    }
+
+    char buf[kNodeBufSize];
+    ssize_t len = TEMP_FAILURE_RETRY(pread(node->fd, buf, sizeof(buf) - 1, 0));
+    if (len <= 0) {
+        PLOG(ERROR) << "Failed to read " << kControlDir << node->name;
+        // Reopen on the next refresh in case the node went away with an AoC restart
+        node->fd.reset();
+        return false;
+    }
+    buf[len] = '\0';
+
+    return parseField(buf, kEntryCountPrefix, &counters->count) &&
+           parseField(buf, kTotalTimePrefix, &counters->totalTicks) &&
+           parseField(buf, kLastEntryPrefix, &counters->lastEntryTicks);
+}
+
+void AocResidencySnapshot::refreshLocked() {
+    for (size_t i = 0; i < mNodes.size(); i++) {
+        mCounters[i].valid = readNodeLocked(&mNodes[i], &mCounters[i]);
+    }
+    mGeneration++;
+    mRefreshTimeMs = nowMs();
+}
+
+uint64_t AocResidencySnapshot::acquireLocked(uint64_t lastSeenGeneration) {
+    if (lastSeenGeneration == mGeneration || nowMs() - mRefreshTimeMs > kMaxAgeMs) {
+        refreshLocked();
+    }
+    return mGeneration;
+}
+
+AocSnapshotStateResidencyDataProvider::AocSnapshotStateResidencyDataProvider(
+        std::shared_ptr<AocResidencySnapshot> snapshot,
+        const std::vector<std::pair<std::string, std::string>> &ids,
+        const std::vector<std::pair<std::string, std::string>> &states, const uint64_t aocClock)
+    : mSnapshot(snapshot), kStates(states), kAocClock(aocClock), mLastGeneration(0) {
+    for (const auto &id : ids) {
+        Entity entity = {id.first, {}};
+        for (const auto &state : states) {
+            entity.nodes.push_back(mSnapshot->addNode(id.second + state.second));
+        }
+        mEntities.push_back(std::move(entity));
+    }
+}
+
+bool AocSnapshotStateResidencyDataProvider::getStateResidencies(
+        std::unordered_map<std::string, std::vector<StateResidency>> *residencies) {
+    bool ret = true;
+    std::scoped_lock lk(mSnapshot->getLock());
+    mLastGeneration = mSnapshot->acquireLocked(mLastGeneration);
+
+    for (const auto &entity : mEntities) {
+        std::vector<StateResidency> stateResidencies;
+        stateResidencies.reserve(entity.nodes.size());
+        for (int32_t stateId = 0; stateId < entity.nodes.size(); stateId++) {
+            const auto &c = mSnapshot->getLocked(entity.nodes[stateId]);
+            if (!c.valid) {
+                ret = false;
+                continue;
+            }
+            stateResidencies.push_back({
+                    .id = stateId,
+                    .totalTimeInStateMs = static_cast<int64_t>(c.totalTicks / kAocClock),
+                    .totalStateEntryCount = static_cast<int64_t>(c.count),
+                    .lastEntryTimestampMs = static_cast<int64_t>(c.lastEntryTicks / kAocClock),
+            });
+        }
+        residencies->emplace(entity.name, std::move(stateResidencies));
+    }
+    return ret;
+}
+
+std::unordered_map<std::string, std::vector<State>>
+AocSnapshotStateResidencyDataProvider::getInfo() {
+    std::unordered_map<std::string, std::vector<State>> infos;
+    for (const auto &entity : mEntities) {
+        std::vector<State> stateInfos;
+        for (int32_t stateId = 0; stateId < kStates.size(); stateId++) {
+            stateInfos.push_back({.id = stateId, .name = kStates[stateId].first});
+        }
+        infos.emplace(entity.name, std::move(stateInfos));
+    }
+    return infos;
+}
+
+}  // namespace stats
+}  // namespace power
+}  // namespace hardware
+}  // namespace android
+}  // namespace aidl
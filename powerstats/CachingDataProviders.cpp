@@ -0,0 +1,71 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <CachingDataProviders.h>
+
+namespace aidl {
+namespace android {
+namespace hardware {
+namespace power {
+namespace stats {
+
+CachingStateResidencyDataProvider::CachingStateResidencyDataProvider(
+        std::unique_ptr<PowerStats::IStateResidencyDataProvider> provider,
+        std::chrono::milliseconds window)
+    : mProvider(std::move(provider)), mCache(window) {}
+
+bool CachingStateResidencyDataProvider::getStateResidencies(
+        std::unordered_map<std::string, std::vector<StateResidency>> *residencies) {
+    using Residencies = std::unordered_map<std::string, std::vector<StateResidency>>;
+    auto result = mCache.get([this]() -> std::optional<Residencies> {
+        Residencies fresh;
+        if (!mProvider->getStateResidencies(&fresh)) {
+            return {};
+        }
+        return fresh;
+    });
+    if (!result) {
+        return false;
+    }
+    residencies->insert(result->begin(), result->end());
+    return true;
+}
+
+std::unordered_map<std::string, std::vector<State>> CachingStateResidencyDataProvider::getInfo() {
+    return mProvider->getInfo();
+}
+
+CachingEnergyConsumer::CachingEnergyConsumer(std::unique_ptr<PowerStats::IEnergyConsumer> consumer,
+                                             std::chrono::milliseconds window)
+    : mConsumer(std::move(consumer)), mCache(window) {}
+
+std::pair<EnergyConsumerType, std::string> CachingEnergyConsumer::getInfo() {
+    return mConsumer->getInfo();
+}
+
+std::optional<EnergyConsumerResult> CachingEnergyConsumer::getEnergyConsumed() {
+    return mCache.get([this]() { return mConsumer->getEnergyConsumed(); });
+}
+
+std::string CachingEnergyConsumer::getConsumerName() {
+    return mConsumer->getConsumerName();
+}
+
+}  // namespace stats
+}  // namespace power
+}  // namespace hardware
+}  // namespace android
+}  // namespace aidl
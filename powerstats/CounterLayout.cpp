@@ -0,0 +1,103 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <CounterLayout.h>
+
+#include <android-base/strings.h>
+
+namespace aidl {
+namespace android {
+namespace hardware {
+namespace power {
+namespace stats {
+
+bool matchesEntityPattern(const std::vector<std::string> &patterns, const std::string &name) {
+    for (const auto &pattern : patterns) {
+        if (!pattern.empty() && pattern.back() == '*') {
+            if (::android::base::StartsWith(name, pattern.substr(0, pattern.size() - 1))) {
+                return true;
+            }
+        } else if (name == pattern) {
+            return true;
+        }
+    }
+    return false;
+}
+
+CounterLayout CounterLayout::build(PowerStats *p, const std::vector<std::string> &entityPatterns) {
+    CounterLayout layout;
+
+    std::vector<Channel> channels;
+    p->getEnergyMeterInfo(&channels);
+    for (const auto &c : channels) {
+        if (c.id < 0) {
+            continue;
+        }
+        if (layout.channelSlots.size() <= static_cast<size_t>(c.id)) {
+            layout.channelSlots.resize(c.id + 1, -1);
+        }
+        layout.channelSlots[c.id] = layout.counters.size();
+        layout.channelIds.push_back(c.id);
+        layout.counters.push_back("rail." + c.name);
+    }
+
+    std::vector<PowerEntity> entities;
+    p->getPowerEntityInfo(&entities);
+    for (const auto &e : entities) {
+        if (e.id < 0 || !matchesEntityPattern(entityPatterns, e.name)) {
+            continue;
+        }
+        if (layout.stateSlots.size() <= static_cast<size_t>(e.id)) {
+            layout.stateSlots.resize(e.id + 1);
+        }
+        for (const auto &s : e.states) {
+            if (s.id < 0) {
+                continue;
+            }
+            if (layout.stateSlots[e.id].size() <= static_cast<size_t>(s.id)) {
+                layout.stateSlots[e.id].resize(s.id + 1, -1);
+            }
+            layout.stateSlots[e.id][s.id] = layout.counters.size();
+            layout.counters.push_back(e.name + "." + s.name);
+        }
+        layout.entityIds.push_back(e.id);
+    }
+    return layout;
+}
+
+int32_t CounterLayout::channelSlot(int32_t channelId) const {
+    if (channelId < 0 || static_cast<size_t>(channelId) >= channelSlots.size()) {
+        return -1;
+    }
+    return channelSlots[channelId];
+}
+
+int32_t CounterLayout::stateSlot(int32_t entityId, int32_t stateId) const {
+    if (entityId < 0 || static_cast<size_t>(entityId) >= stateSlots.size()) {
+        return -1;
+    }
+    const std::vector<int32_t> &slots = stateSlots[entityId];
+    if (stateId < 0 || static_cast<size_t>(stateId) >= slots.size()) {
+        return -1;
+    }
+    return slots[stateId];
+}
+
+}  // namespace stats
+}  // namespace power
+}  // namespace hardware
+}  // namespace android
+}  // namespace aidl
@@ -0,0 +1,167 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <CounterTracer.h>
+
+#include <android-base/logging.h>
+#include <cutils/trace.h>
+
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+namespace aidl {
+namespace android {
+namespace hardware {
+namespace power {
+namespace stats {
+
+namespace {
+
+constexpr char kTickCounter[] = "PowerStats.tickUs";
+// Consecutive over-budget ticks tolerated before the period is lengthened
+constexpr uint32_t kOverBudgetTicks = 4;
+
+uint64_t nowNs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000000ULL + ts.tv_nsec;
+}
+
+bool armTimer(int fd, uint32_t periodMs) {
+    struct itimerspec spec = {};
+    spec.it_interval.tv_sec = periodMs / 1000;
+    spec.it_interval.tv_nsec = (periodMs % 1000) * 1000000;
+    spec.it_value = spec.it_interval;
+    return timerfd_settime(fd, 0, &spec, nullptr) == 0;
+}
+
+}  // namespace
+
+CounterTracer::CounterTracer(std::shared_ptr<PowerStats> p, const Config &config)
+    : mPowerStats(p), kConfig(config), mPeriodMs(std::max<uint32_t>(config.periodMs, 1)),
+      mResolved(false) {}
+
+CounterTracer::~CounterTracer() {
+    stop();
+}
+
+bool CounterTracer::start() {
+    mTimerFd.reset(timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC));
+    mStopFd.reset(eventfd(0, EFD_CLOEXEC));
+    if (mTimerFd == -1 || mStopFd == -1 || !armTimer(mTimerFd, mPeriodMs)) {
+        PLOG(ERROR) << "Failed to set up counter tracer timer";
+        return false;
+    }
+    mThread = std::thread(&CounterTracer::tracerThread, this);
+    LOG(INFO) << "Counter tracer running every " << mPeriodMs << "ms";
+    return true;
+}
+
+void CounterTracer::stop() {
+    if (!mThread.joinable()) {
+        return;
+    }
+    uint64_t val = 1;
+    TEMP_FAILURE_RETRY(write(mStopFd, &val, sizeof(val)));
+    mThread.join();
+}
+
+void CounterTracer::resolve() {
+    mResolved = true;
+    mLayout = CounterLayout::build(mPowerStats.get(), kConfig.entities);
+    mMeasurements.reserve(mLayout.channelIds.size());
+    mResidencies.reserve(mLayout.entityIds.size());
+    LOG(INFO) << "Tracing " << mLayout.channelIds.size() << " rails and "
+              << mLayout.entityIds.size() << " power entities";
+}
+
+void CounterTracer::tick() {
+    if (!mResolved) {
+        resolve();
+    }
+
+    mMeasurements.clear();
+    if (!mLayout.channelIds.empty() &&
+        mPowerStats->readEnergyMeter(mLayout.channelIds, &mMeasurements).isOk()) {
+        for (const auto &m : mMeasurements) {
+            const int32_t slot = mLayout.channelSlot(m.id);
+            if (slot >= 0) {
+                atrace_int64(ATRACE_TAG_POWER, mLayout.counters[slot].c_str(), m.energyUWs);
+            }
+        }
+    }
+
+    mResidencies.clear();
+    if (!mLayout.entityIds.empty() &&
+        mPowerStats->getStateResidency(mLayout.entityIds, &mResidencies).isOk()) {
+        for (const auto &result : mResidencies) {
+            for (const auto &r : result.stateResidencyData) {
+                const int32_t slot = mLayout.stateSlot(result.id, r.id);
+                if (slot >= 0) {
+                    atrace_int64(ATRACE_TAG_POWER, mLayout.counters[slot].c_str(),
+                                 r.totalTimeInStateMs);
+                }
+            }
+        }
+    }
+}
+
+void CounterTracer::tracerThread() {
+    struct pollfd fds[] = {
+            {.fd = mTimerFd.get(), .events = POLLIN},
+            {.fd = mStopFd.get(), .events = POLLIN},
+    };
+    uint32_t overBudget = 0;
+
+    while (true) {
+        if (TEMP_FAILURE_RETRY(poll(fds, 2, -1)) < 0 || (fds[1].revents & POLLIN)) {
+            break;
+        }
+        uint64_t expirations;
+        if (TEMP_FAILURE_RETRY(read(mTimerFd, &expirations, sizeof(expirations))) !=
+            sizeof(expirations)) {
+            continue;
+        }
+        if (!atrace_is_tag_enabled(ATRACE_TAG_POWER)) {
+            continue;
+        }
+
+        const uint64_t startNs = nowNs();
+        tick();
+        const uint64_t costUs = (nowNs() - startNs) / 1000;
+        atrace_int64(ATRACE_TAG_POWER, kTickCounter, costUs);
+
+        overBudget = (costUs > kConfig.budgetUs) ? overBudget + 1 : 0;
+        if (overBudget >= kOverBudgetTicks) {
+            overBudget = 0;
+            mPeriodMs *= 2;
+            armTimer(mTimerFd, mPeriodMs);
+            LOG(WARNING) << "Counter trace tick took " << costUs << "us, period raised to "
+                         << mPeriodMs << "ms";
+        }
+    }
+}
+
+}  // namespace stats
+}  // namespace power
+}  // namespace hardware
+}  // namespace android
+}  // namespace aidl
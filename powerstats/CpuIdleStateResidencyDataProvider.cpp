@@ -0,0 +1,200 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <CpuIdleStateResidencyDataProvider.h>
+
+#include <android-base/logging.h>
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <string_view>
+
+namespace aidl {
+namespace android {
+namespace hardware {
+namespace power {
+namespace stats {
+
+namespace {
+
+constexpr size_t kInitialBufSize = 4096;
+
+bool isSpace(char c) {
+    return c == ' ' || c == '\t';
+}
+
+// Returns the index of the entry whose time_in_state token is name, or -1
+int indexOf(const std::vector<std::pair<std::string, std::string>> &entries,
+            std::string_view name) {
+    for (size_t i = 0; i < entries.size(); i++) {
+        if (entries[i].second == name) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+}  // namespace
+
+CpuIdleStateResidencyDataProvider::CpuIdleStateResidencyDataProvider(const Config &config)
+    : kConfig(config),
+      kSleepStateIndex(indexOf(config.states, config.sleepCpuState)),
+      mBuf(kInitialBufSize),
+      mCounters(config.cpus.size() * config.states.size()) {}
+
+bool CpuIdleStateResidencyDataProvider::readNodeLocked(const std::string &path,
+                                                        ::android::base::unique_fd *fd,
+                                                        size_t *len) {
+    if (*fd == -1) {
+        fd->reset(open(path.c_str(), O_RDONLY | O_CLOEXEC));
+        if (*fd == -1) {
+            PLOG(ERROR) << "Failed to open " << path;
+            return false;
+        }
+    }
+
+    *len = 0;
+    while (true) {
+        if (*len + 1 >= mBuf.size()) {
+            mBuf.resize(mBuf.size() * 2);
+        }
+        ssize_t n = TEMP_FAILURE_RETRY(pread(*fd, mBuf.data() + *len, mBuf.size() - *len - 1,
+                                             *len));
+        if (n < 0) {
+            PLOG(ERROR) << "Failed to read " << path;
+            return false;
+        }
+        if (n == 0) {
+            break;
+        }
+        *len += n;
+    }
+    mBuf[*len] = '\0';
+    return true;
+}
+
+bool CpuIdleStateResidencyDataProvider::parseTimeInStateLocked(size_t len) {
+    const size_t numStates = kConfig.states.size();
+    std::fill(mCounters.begin(), mCounters.end(), Counter{0, 0});
+
+    const char *p = mBuf.data();
+    const char *end = p + len;
+    int state = -1;
+    bool found = false;
+    while (p < end) {
+        const char *eol = static_cast<const char *>(memchr(p, '\n', end - p));
+        if (eol == nullptr) {
+            eol = end;
+        }
+        while (p < eol && isSpace(*p)) {
+            p++;
+        }
+
+        const char *tokenEnd = p;
+        while (tokenEnd < eol && !isSpace(*tokenEnd)) {
+            tokenEnd++;
+        }
+        const std::string_view token(p, tokenEnd - p);
+
+        if (!token.empty() && token.front() == '[') {
+            state = indexOf(kConfig.states, token);
+        } else if (state >= 0) {
+            const int cpu = indexOf(kConfig.cpus, token);
+            if (cpu >= 0) {
+                // The entry count is optional; strtoull() returns 0 if it is missing
+                char *next;
+                Counter &c = mCounters[cpu * numStates + state];
+                c.timeUs = strtoull(tokenEnd, &next, 10);
+                c.count = strtoull(next, nullptr, 10);
+                found = true;
+            }
+        }
+        p = eol + 1;
+    }
+    return found;
+}
+
+uint64_t CpuIdleStateResidencyDataProvider::parseSleepMsLocked(size_t len) const {
+    const char *end = mBuf.data() + len;
+    const char *p = strstr(mBuf.data(), kConfig.sleepSection.c_str());
+    if (p != nullptr) {
+        p = strstr(p, kConfig.sleepState.c_str());
+    }
+    if (p != nullptr) {
+        p = strstr(p, kConfig.sleepTimePrefix.c_str());
+    }
+    if (p == nullptr || p >= end) {
+        return 0;
+    }
+    return strtoull(p + kConfig.sleepTimePrefix.size(), nullptr, 10) / 1000000;
+}
+
+bool CpuIdleStateResidencyDataProvider::getStateResidencies(
+        std::unordered_map<std::string, std::vector<StateResidency>> *residencies) {
+    std::scoped_lock lk(mLock);
+
+    size_t len;
+    uint64_t sleepMs = 0;
+    if (kSleepStateIndex >= 0 && !kConfig.sleepPath.empty() &&
+        readNodeLocked(kConfig.sleepPath, &mSleepFd, &len)) {
+        sleepMs = parseSleepMsLocked(len);
+    }
+    if (!readNodeLocked(kConfig.timeInStatePath, &mTimeInStateFd, &len) ||
+        !parseTimeInStateLocked(len)) {
+        return false;
+    }
+
+    const size_t numStates = kConfig.states.size();
+    for (size_t cpu = 0; cpu < kConfig.cpus.size(); cpu++) {
+        std::vector<StateResidency> result(numStates);
+        for (size_t state = 0; state < numStates; state++) {
+            const Counter &c = mCounters[cpu * numStates + state];
+            result[state] = {
+                .id = static_cast<int32_t>(state),
+                .totalTimeInStateMs = static_cast<int64_t>(c.timeUs / 1000),
+                .totalStateEntryCount = static_cast<int64_t>(c.count),
+            };
+        }
+        if (kSleepStateIndex >= 0) {
+            result[kSleepStateIndex].totalTimeInStateMs += sleepMs;
+        }
+        residencies->emplace(kConfig.cpus[cpu].first, std::move(result));
+    }
+    return true;
+}
+
+std::unordered_map<std::string, std::vector<State>> CpuIdleStateResidencyDataProvider::getInfo() {
+    std::vector<State> states;
+    for (size_t i = 0; i < kConfig.states.size(); i++) {
+        states.push_back({.id = static_cast<int32_t>(i), .name = kConfig.states[i].first});
+    }
+
+    std::unordered_map<std::string, std::vector<State>> info;
+    for (const auto &[entity, token] : kConfig.cpus) {
+        info.emplace(entity, states);
+    }
+    return info;
+}
+
+}  // namespace stats
+}  // namespace power
+}  // namespace hardware
+}  // namespace android
+}  // namespace aidl
@@ -0,0 +1,66 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <LazyDataProviders.h>
+
+namespace aidl {
+namespace android {
+namespace hardware {
+namespace power {
+namespace stats {
+
+LazyStateResidencyDataProvider::LazyStateResidencyDataProvider(
+        std::unordered_map<std::string, std::vector<State>> info,
+        LazyInstance<PowerStats::IStateResidencyDataProvider>::Factory factory)
+    : kInfo(std::move(info)), mProvider(std::move(factory)) {}
+
+bool LazyStateResidencyDataProvider::getStateResidencies(
+        std::unordered_map<std::string, std::vector<StateResidency>> *residencies) {
+    PowerStats::IStateResidencyDataProvider *provider = mProvider.get();
+    return provider != nullptr && provider->getStateResidencies(residencies);
+}
+
+std::unordered_map<std::string, std::vector<State>> LazyStateResidencyDataProvider::getInfo() {
+    return kInfo;
+}
+
+LazyEnergyMeterDataProvider::LazyEnergyMeterDataProvider(
+        LazyInstance<PowerStats::IEnergyMeterDataProvider>::Factory factory)
+    : mMeter(std::move(factory)) {}
+
+ndk::ScopedAStatus LazyEnergyMeterDataProvider::readEnergyMeter(
+        const std::vector<int32_t> &in_channelIds, std::vector<EnergyMeasurement> *_aidl_return) {
+    PowerStats::IEnergyMeterDataProvider *meter = mMeter.get();
+    if (meter == nullptr) {
+        return ndk::ScopedAStatus::fromExceptionCode(EX_UNSUPPORTED_OPERATION);
+    }
+    return meter->readEnergyMeter(in_channelIds, _aidl_return);
+}
+
+ndk::ScopedAStatus LazyEnergyMeterDataProvider::getEnergyMeterInfo(
+        std::vector<Channel> *_aidl_return) {
+    PowerStats::IEnergyMeterDataProvider *meter = mMeter.get();
+    if (meter == nullptr) {
+        return ndk::ScopedAStatus::fromExceptionCode(EX_UNSUPPORTED_OPERATION);
+    }
+    return meter->getEnergyMeterInfo(_aidl_return);
+}
+
+}  // namespace stats
+}  // namespace power
+}  // namespace hardware
+}  // namespace android
+}  // namespace aidl
@@ -0,0 +1,180 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <LinkIdleStateResidencyDataProvider.h>
+
+#include <android-base/logging.h>
+
+#include <time.h>
+
+namespace aidl {
+namespace android {
+namespace hardware {
+namespace power {
+namespace stats {
+
+namespace {
+
+constexpr char kLinkEntity[] = "link";
+constexpr int32_t kLinkUpStateId = 0;
+constexpr int32_t kLinkDownStateId = 1;
+
+// Same layout as the PCIe entities registered in addPCIe()
+std::vector<GenericStateResidencyDataProvider::PowerEntityConfig> linkConfigs() {
+    const GenericStateResidencyDataProvider::StateResidencyConfig linkStateConfig = {
+        .entryCountSupported = true,
+        .entryCountPrefix = "Cumulative count:",
+        .totalTimeSupported = true,
+        .totalTimePrefix = "Cumulative duration msec:",
+        .lastEntrySupported = true,
+        .lastEntryPrefix = "Last entry timestamp msec:",
+    };
+    const std::vector<std::pair<std::string, std::string>> linkStateHeaders = {
+        std::make_pair("UP", "Link up:"),
+        std::make_pair("DOWN", "Link down:"),
+    };
+    return {{generateGenericStateResidencyConfigs(linkStateConfig, linkStateHeaders), kLinkEntity,
+             "Version: 1"}};
+}
+
+int64_t bootTimeMs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_BOOTTIME, &ts);
+    return static_cast<int64_t>(ts.tv_sec) * 1000 + ts.tv_nsec / 1000000;
+}
+
+}  // namespace
+
+LinkIdleStateResidencyDataProvider::LinkIdleStateResidencyDataProvider(
+        std::unique_ptr<PowerStats::IStateResidencyDataProvider> device, const Config &config)
+    : mDevice(std::move(device)),
+      mLink(config.linkStatsPath, linkConfigs()),
+      kConfig(config),
+      mHaveSnapshot(false),
+      mSnapshotConfirmed(false),
+      mSnapshotLink({}),
+      mSnapshotTimeMs(0),
+      mDeviceReadTimeMs(0) {
+    const auto info = mDevice->getInfo();
+    for (const auto &[entity, stateName] : kConfig.sleepStates) {
+        auto it = info.find(entity);
+        if (it == info.end()) {
+            LOG(ERROR) << "Unknown entity " << entity;
+            continue;
+        }
+        for (const auto &state : it->second) {
+            if (state.name == stateName) {
+                mSleepStateIds.emplace_back(entity, state.id);
+            }
+        }
+    }
+}
+
+bool LinkIdleStateResidencyDataProvider::readLinkState(LinkState *state) {
+    std::unordered_map<std::string, std::vector<StateResidency>> residencies;
+    if (!mLink.getStateResidencies(&residencies)) {
+        return false;
+    }
+    auto it = residencies.find(kLinkEntity);
+    if (it == residencies.end()) {
+        return false;
+    }
+
+    const StateResidency *up = nullptr;
+    const StateResidency *down = nullptr;
+    for (const auto &r : it->second) {
+        if (r.id == kLinkUpStateId) {
+            up = &r;
+        } else if (r.id == kLinkDownStateId) {
+            down = &r;
+        }
+    }
+    if (up == nullptr || down == nullptr) {
+        return false;
+    }
+    state->upCount = up->totalStateEntryCount;
+    state->downCount = down->totalStateEntryCount;
+    state->down = down->lastEntryTimestampMs >= up->lastEntryTimestampMs;
+    return true;
+}
+
+bool LinkIdleStateResidencyDataProvider::isIdleSinceSnapshot(const LinkState &link) {
+    if (!mHaveSnapshot || !link.down || link.upCount != mSnapshotLink.upCount ||
+        bootTimeMs() - mDeviceReadTimeMs >= kConfig.maxExtrapolationMs) {
+        return false;
+    }
+    if (mSnapshotConfirmed) {
+        return link.downCount == mSnapshotLink.downCount;
+    }
+    // The device read kept the link up. Its one down transition since then ends that read, so the
+    // device has been idle since and the snapshot holds from now on.
+    if (link.downCount != mSnapshotLink.downCount + 1) {
+        return false;
+    }
+    mSnapshotConfirmed = true;
+    mSnapshotLink = link;
+    mSnapshotTimeMs = bootTimeMs();
+    return true;
+}
+
+bool LinkIdleStateResidencyDataProvider::getStateResidencies(
+        std::unordered_map<std::string, std::vector<StateResidency>> *residencies) {
+    std::scoped_lock lk(mLock);
+
+    LinkState link = {};
+    if (readLinkState(&link) && isIdleSinceSnapshot(link)) {
+        const int64_t elapsedMs = bootTimeMs() - mSnapshotTimeMs;
+        for (const auto &[entity, result] : mSnapshot) {
+            std::vector<StateResidency> extrapolated = result;
+            for (auto &r : extrapolated) {
+                for (const auto &[sleepEntity, sleepId] : mSleepStateIds) {
+                    if (sleepEntity == entity && sleepId == r.id) {
+                        r.totalTimeInStateMs += elapsedMs;
+                    }
+                }
+            }
+            residencies->emplace(entity, std::move(extrapolated));
+        }
+        return true;
+    }
+
+    std::unordered_map<std::string, std::vector<StateResidency>> fresh;
+    if (!mDevice->getStateResidencies(&fresh)) {
+        mHaveSnapshot = false;
+        return false;
+    }
+    residencies->insert(fresh.begin(), fresh.end());
+
+    // The read itself may have woken the link, so the baseline is the link state after it. Only
+    // snapshot when that state is known, otherwise the next query reads again.
+    mHaveSnapshot = readLinkState(&link);
+    mSnapshotConfirmed = link.down;
+    mSnapshotLink = link;
+    mDeviceReadTimeMs = bootTimeMs();
+    mSnapshotTimeMs = mDeviceReadTimeMs;
+    mSnapshot = std::move(fresh);
+    return true;
+}
+
+std::unordered_map<std::string, std::vector<State>> LinkIdleStateResidencyDataProvider::getInfo() {
+    return mDevice->getInfo();
+}
+
+}  // namespace stats
+}  // namespace power
+}  // namespace hardware
+}  // namespace android
+}  // namespace aidl
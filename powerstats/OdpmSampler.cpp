@@ -0,0 +1,345 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <OdpmSampler.h>
+
+#include <android-base/file.h>
+#include <android-base/logging.h>
+#include <android-base/strings.h>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/timerfd.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+namespace aidl {
+namespace android {
+namespace hardware {
+namespace power {
+namespace stats {
+
+namespace {
+
+constexpr char kIioRootDir[] = "/sys/bus/iio/devices/";
+constexpr char kDeviceType[] = "iio:device";
+constexpr char kEnergyValueNode[] = "energy_value";
+// Consecutive over-budget samples tolerated before the sampling period is lengthened
+constexpr uint32_t kOverBudgetSamples = 8;
+constexpr size_t kEnergyValueBufSize = 4096;
+
+uint64_t nowNs(clockid_t clock) {
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000000ULL + ts.tv_nsec;
+}
+
+bool armTimer(int fd, uint32_t periodUs) {
+    struct itimerspec spec = {};
+    spec.it_interval.tv_sec = periodUs / 1000000;
+    spec.it_interval.tv_nsec = (periodUs % 1000000) * 1000;
+    spec.it_value = spec.it_interval;
+    return timerfd_settime(fd, 0, &spec, nullptr) == 0;
+}
+
+}  // namespace
+
+OdpmSampler::OdpmSampler(const std::vector<std::string> &deviceNames,
+                         const std::vector<std::string> &railNames, uint32_t rateHz,
+                         uint32_t capacity)
+    : kDeviceNames(deviceNames),
+      kRailNames(railNames),
+      kRateHz(std::clamp<uint32_t>(rateHz, 1, kMaxRateHz)),
+      kCapacity(capacity),
+      mHeader(nullptr),
+      mSamples(nullptr) {}
+
+OdpmSampler::~OdpmSampler() {
+    stop();
+    if (mHeader != nullptr) {
+        munmap(mHeader, OdpmSampleRing::sizeFor(kCapacity));
+    }
+}
+
+bool OdpmSampler::findDevices() {
+    std::unique_ptr<DIR, decltype(&closedir)> dir(opendir(kIioRootDir), closedir);
+    if (!dir) {
+        PLOG(ERROR) << "Error opening directory" << kIioRootDir;
+        return false;
+    }
+
+    struct dirent *ent;
+    while ((ent = readdir(dir.get()))) {
+        if (strncmp(ent->d_name, kDeviceType, strlen(kDeviceType)) != 0) {
+            continue;
+        }
+        const std::string devicePath = std::string(kIioRootDir) + ent->d_name;
+        std::string deviceName;
+        if (!::android::base::ReadFileToString(devicePath + "/name", &deviceName)) {
+            continue;
+        }
+        deviceName = ::android::base::Trim(deviceName);
+        if (std::find(kDeviceNames.begin(), kDeviceNames.end(), deviceName) ==
+            kDeviceNames.end()) {
+            continue;
+        }
+
+        Device device;
+        device.fd.reset(open((devicePath + "/" + kEnergyValueNode).c_str(),
+                             O_RDONLY | O_CLOEXEC));
+        std::string data;
+        if (device.fd == -1 || !::android::base::ReadFdToString(device.fd, &data)) {
+            PLOG(ERROR) << "Failed to read " << devicePath << "/" << kEnergyValueNode;
+            continue;
+        }
+
+        // Lines look like "CH0(T=358356)[S4M_VDD_CPUCL0], 761330". Remember the line index of
+        // each wanted rail so sampling only has to count newlines.
+        std::vector<std::string> lines = ::android::base::Split(data, "\n");
+        for (size_t i = 0; i < lines.size(); i++) {
+            size_t nameStart = lines[i].find('[');
+            size_t nameEnd = lines[i].find(']');
+            if (nameStart == std::string::npos || nameEnd == std::string::npos ||
+                nameEnd < nameStart) {
+                continue;
+            }
+            const std::string rail = lines[i].substr(nameStart + 1, nameEnd - nameStart - 1);
+            auto it = std::find(kRailNames.begin(), kRailNames.end(), rail);
+            if (it != kRailNames.end()) {
+                device.channels.emplace_back(i, it - kRailNames.begin());
+            }
+        }
+        if (!device.channels.empty()) {
+            mDevices.push_back(std::move(device));
+        }
+    }
+
+    return !mDevices.empty();
+}
+
+bool OdpmSampler::createRing() {
+    const size_t size = OdpmSampleRing::sizeFor(kCapacity);
+    mRingFd.reset(memfd_create("powerstats_odpm_ring", MFD_CLOEXEC | MFD_ALLOW_SEALING));
+    if (mRingFd == -1 || ftruncate(mRingFd, size) != 0) {
+        PLOG(ERROR) << "Failed to create sample ring";
+        return false;
+    }
+
+    void *addr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, mRingFd, 0);
+    if (addr == MAP_FAILED) {
+        PLOG(ERROR) << "Failed to map sample ring";
+        return false;
+    }
+    // Our mapping stays writable; any mapping created after this point must be read-only.
+    if (fcntl(mRingFd, F_ADD_SEALS,
+              F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_FUTURE_WRITE | F_SEAL_SEAL) != 0) {
+        PLOG(WARNING) << "Failed to seal sample ring";
+    }
+
+    mHeader = static_cast<OdpmSampleRing::Header *>(addr);
+    mSamples = reinterpret_cast<OdpmSampleRing::Sample *>(static_cast<char *>(addr) +
+                                                          sizeof(OdpmSampleRing::Header));
+    mHeader->magic = OdpmSampleRing::kMagic;
+    mHeader->version = OdpmSampleRing::kVersion;
+    mHeader->numRails = kRailNames.size();
+    mHeader->capacity = kCapacity;
+    mHeader->periodUs.store(1000000 / kRateHz, std::memory_order_relaxed);
+    mHeader->overruns.store(0, std::memory_order_relaxed);
+    for (size_t i = 0; i < kRailNames.size(); i++) {
+        strlcpy(mHeader->railNames[i], kRailNames[i].c_str(), OdpmSampleRing::kMaxRailNameLen);
+    }
+    mHeader->head.store(0, std::memory_order_release);
+    return true;
+}
+
+bool OdpmSampler::createRingSocket() {
+    struct sockaddr_un addr = {};
+    addr.sun_family = AF_UNIX;
+    strlcpy(addr.sun_path, kRingSocketPath, sizeof(addr.sun_path));
+
+    mRingSocketFd.reset(socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC | SOCK_NONBLOCK, 0));
+    if (mRingSocketFd == -1) {
+        PLOG(ERROR) << "Failed to create sample ring socket";
+        return false;
+    }
+    // Left behind by a previous instance
+    unlink(kRingSocketPath);
+    if (bind(mRingSocketFd, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)) != 0 ||
+        chmod(kRingSocketPath, 0660) != 0 || listen(mRingSocketFd, 4) != 0) {
+        PLOG(ERROR) << "Failed to listen on " << kRingSocketPath;
+        return false;
+    }
+    return true;
+}
+
+void OdpmSampler::sendRing() {
+    ::android::base::unique_fd client(accept4(mRingSocketFd, nullptr, nullptr, SOCK_CLOEXEC));
+    if (client == -1) {
+        return;
+    }
+
+    char data = 0;
+    struct iovec iov = {.iov_base = &data, .iov_len = sizeof(data)};
+    union {
+        char buf[CMSG_SPACE(sizeof(int))];
+        struct cmsghdr align;
+    } control = {};
+    struct msghdr msg = {};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    const int ringFd = mRingFd.get();
+    memcpy(CMSG_DATA(cmsg), &ringFd, sizeof(ringFd));
+
+    // A client that does not read is dropped rather than stalling the sampler
+    if (TEMP_FAILURE_RETRY(sendmsg(client, &msg, MSG_NOSIGNAL | MSG_DONTWAIT)) < 0) {
+        PLOG(WARNING) << "Failed to send sample ring";
+    }
+}
+
+bool OdpmSampler::start() {
+    if (kRailNames.empty() || kRailNames.size() > OdpmSampleRing::kMaxRails || kCapacity == 0 ||
+        (kCapacity & (kCapacity - 1)) != 0) {
+        LOG(ERROR) << "Invalid ODPM sampler configuration";
+        return false;
+    }
+    if (!findDevices() || !createRing() || !createRingSocket()) {
+        return false;
+    }
+
+    mTimerFd.reset(timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC));
+    mStopFd.reset(eventfd(0, EFD_CLOEXEC));
+    if (mTimerFd == -1 || mStopFd == -1 ||
+        !armTimer(mTimerFd, mHeader->periodUs.load(std::memory_order_relaxed))) {
+        PLOG(ERROR) << "Failed to set up ODPM sampler timer";
+        return false;
+    }
+
+    mThread = std::thread(&OdpmSampler::samplerThread, this);
+    LOG(INFO) << "ODPM sampler running at " << kRateHz << " Hz, ring served on "
+              << kRingSocketPath;
+    return true;
+}
+
+void OdpmSampler::stop() {
+    if (!mThread.joinable()) {
+        return;
+    }
+    uint64_t val = 1;
+    TEMP_FAILURE_RETRY(write(mStopFd, &val, sizeof(val)));
+    mThread.join();
+}
+
+bool OdpmSampler::sample(OdpmSampleRing::Sample *s) {
+    char buf[kEnergyValueBufSize];
+
+    s->timestampNs = nowNs(CLOCK_BOOTTIME);
+    for (const auto &device : mDevices) {
+        ssize_t len = TEMP_FAILURE_RETRY(pread(device.fd, buf, sizeof(buf) - 1, 0));
+        if (len <= 0) {
+            return false;
+        }
+        buf[len] = '\0';
+
+        // Channels are ordered by line index, so one forward scan covers all of them
+        const char *p = buf;
+        size_t line = 0;
+        for (const auto &[lineIdx, railIdx] : device.channels) {
+            while (line < lineIdx && (p = strchr(p, '\n')) != nullptr) {
+                p++;
+                line++;
+            }
+            const char *value = p ? strstr(p, "], ") : nullptr;
+            if (value == nullptr) {
+                return false;
+            }
+            s->energyUWs[railIdx] = strtoull(value + 3, nullptr, 10);
+        }
+    }
+    return true;
+}
+
+void OdpmSampler::samplerThread() {
+    struct pollfd fds[] = {
+            {.fd = mTimerFd.get(), .events = POLLIN},
+            {.fd = mStopFd.get(), .events = POLLIN},
+            {.fd = mRingSocketFd.get(), .events = POLLIN},
+    };
+    uint32_t overBudget = 0;
+
+    while (true) {
+        if (TEMP_FAILURE_RETRY(poll(fds, 3, -1)) < 0 || (fds[1].revents & POLLIN)) {
+            break;
+        }
+        if (fds[2].revents & POLLIN) {
+            sendRing();
+        }
+        if (!(fds[0].revents & POLLIN)) {
+            continue;
+        }
+
+        uint64_t expirations;
+        if (TEMP_FAILURE_RETRY(read(mTimerFd, &expirations, sizeof(expirations))) !=
+            sizeof(expirations)) {
+            continue;
+        }
+        if (expirations > 1) {
+            mHeader->overruns.fetch_add(expirations - 1, std::memory_order_relaxed);
+        }
+
+        const uint64_t startNs = nowNs(CLOCK_MONOTONIC);
+        const uint64_t head = mHeader->head.load(std::memory_order_relaxed);
+        if (sample(&mSamples[head & (kCapacity - 1)])) {
+            mHeader->head.store(head + 1, std::memory_order_release);
+        }
+        const uint64_t costNs = nowNs(CLOCK_MONOTONIC) - startNs;
+
+        // Back off instead of letting the sampler's own CPU and bus traffic dominate the rails
+        const uint32_t periodUs = mHeader->periodUs.load(std::memory_order_relaxed);
+        if (costNs * 100 > static_cast<uint64_t>(periodUs) * 1000 * kMaxDutyCyclePercent) {
+            overBudget++;
+        } else {
+            overBudget = 0;
+        }
+        if (overBudget >= kOverBudgetSamples) {
+            overBudget = 0;
+            mHeader->periodUs.store(periodUs * 2, std::memory_order_relaxed);
+            armTimer(mTimerFd, periodUs * 2);
+            LOG(WARNING) << "ODPM sample took " << costNs / 1000 << "us, period raised to "
+                         << periodUs * 2 << "us";
+        }
+    }
+}
+
+}  // namespace stats
+}  // namespace power
+}  // namespace hardware
+}  // namespace android
+}  // namespace aidl
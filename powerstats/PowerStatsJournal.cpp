@@ -0,0 +1,492 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <PowerStatsJournal.h>
+
+#include <android-base/file.h>
+#include <android-base/logging.h>
+#include <android-base/strings.h>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/timerfd.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <array>
+
+namespace aidl {
+namespace android {
+namespace hardware {
+namespace power {
+namespace stats {
+
+namespace {
+
+using Format = PowerStatsJournalFormat;
+
+constexpr char kBootIdPath[] = "/proc/sys/kernel/random/boot_id";
+constexpr size_t kMinSizeBytes = 64 * 1024;
+
+uint32_t crc32(const uint8_t *data, size_t len) {
+    static const std::array<uint32_t, 256> table = [] {
+        std::array<uint32_t, 256> t;
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; k++) {
+                c = (c & 1) ? 0xedb88320 ^ (c >> 1) : c >> 1;
+            }
+            t[i] = c;
+        }
+        return t;
+    }();
+    uint32_t c = 0xffffffff;
+    for (size_t i = 0; i < len; i++) {
+        c = table[(c ^ data[i]) & 0xff] ^ (c >> 8);
+    }
+    return c ^ 0xffffffff;
+}
+
+void putVarint(std::string *out, uint64_t v) {
+    while (v >= 0x80) {
+        out->push_back(static_cast<char>(v | 0x80));
+        v >>= 7;
+    }
+    out->push_back(static_cast<char>(v));
+}
+
+void putSigned(std::string *out, int64_t v) {
+    putVarint(out, (static_cast<uint64_t>(v) << 1) ^ static_cast<uint64_t>(v >> 63));
+}
+
+bool getVarint(const uint8_t **p, const uint8_t *end, uint64_t *v) {
+    *v = 0;
+    for (int shift = 0; shift < 64 && *p < end; shift += 7) {
+        const uint8_t b = *(*p)++;
+        *v |= static_cast<uint64_t>(b & 0x7f) << shift;
+        if ((b & 0x80) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool getSigned(const uint8_t **p, const uint8_t *end, int64_t *v) {
+    uint64_t u;
+    if (!getVarint(p, end, &u)) {
+        return false;
+    }
+    *v = static_cast<int64_t>(u >> 1) ^ -static_cast<int64_t>(u & 1);
+    return true;
+}
+
+// Calls fn(offset, type, payload, payloadLen) for each intact record and returns the offset just
+// past the last one.
+template <typename Fn>
+size_t forEachRecord(const uint8_t *data, size_t size, Fn fn) {
+    size_t off = sizeof(Format::Header);
+    while (off + Format::kRecordHeaderSize < size) {
+        uint32_t len, crc;
+        memcpy(&len, data + off, sizeof(len));
+        memcpy(&crc, data + off + sizeof(len), sizeof(crc));
+        const uint8_t *body = data + off + Format::kRecordHeaderSize;
+        if (len == 0 || len > size - off - Format::kRecordHeaderSize || crc32(body, len) != crc) {
+            break;
+        }
+        fn(off, static_cast<Format::RecordType>(body[0]), body + 1, len - 1);
+        off += Format::kRecordHeaderSize + len;
+    }
+    return off;
+}
+
+int64_t nowMs(clockid_t clock) {
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return static_cast<int64_t>(ts.tv_sec) * 1000 + ts.tv_nsec / 1000000;
+}
+
+}  // namespace
+
+uint64_t readKernelBootId() {
+    std::string bootId;
+    if (!::android::base::ReadFileToString(kBootIdPath, &bootId)) {
+        return 0;
+    }
+    bootId = ::android::base::StringReplace(::android::base::Trim(bootId), "-", "", true);
+    return strtoull(bootId.substr(0, 16).c_str(), nullptr, 16);
+}
+
+bool readPowerStatsJournal(const std::string &path,
+                           const std::function<void(const PowerStatsJournalSnapshot &)> &fn) {
+    std::string file;
+    if (!::android::base::ReadFileToString(path, &file)) {
+        PLOG(ERROR) << "Failed to read " << path;
+        return false;
+    }
+    Format::Header header;
+    if (file.size() < sizeof(header)) {
+        return false;
+    }
+    memcpy(&header, file.data(), sizeof(header));
+    if (header.magic != Format::kMagic || header.version != Format::kVersion) {
+        LOG(ERROR) << path << " is not a power stats journal";
+        return false;
+    }
+
+    uint64_t bootId = 0;
+    std::vector<std::string> counters;
+    std::vector<int64_t> values;
+    bool haveKeyframe = false;
+    PowerStatsJournalSnapshot snapshot = {.counters = &counters, .values = &values};
+
+    forEachRecord(reinterpret_cast<const uint8_t *>(file.data()), file.size(),
+                  [&](size_t, Format::RecordType type, const uint8_t *p, size_t len) {
+        const uint8_t *end = p + len;
+        uint64_t count;
+        if (type == Format::kSchema) {
+            haveKeyframe = false;
+            if (!getVarint(&p, end, &bootId) || !getVarint(&p, end, &count)) {
+                return;
+            }
+            counters.clear();
+            for (uint64_t i = 0; i < count; i++) {
+                uint64_t nameLen;
+                if (!getVarint(&p, end, &nameLen) || nameLen > static_cast<size_t>(end - p)) {
+                    return;
+                }
+                counters.emplace_back(reinterpret_cast<const char *>(p), nameLen);
+                p += nameLen;
+            }
+            values.assign(counters.size(), 0);
+            return;
+        }
+
+        const bool delta = (type == Format::kDelta);
+        if ((type != Format::kKeyframe && !delta) || (delta && !haveKeyframe)) {
+            return;
+        }
+        int64_t realtimeMs, boottimeMs;
+        if (!getSigned(&p, end, &realtimeMs) || !getSigned(&p, end, &boottimeMs) ||
+            !getVarint(&p, end, &count) || count != values.size()) {
+            return;
+        }
+        for (auto &v : values) {
+            int64_t value;
+            if (!getSigned(&p, end, &value)) {
+                return;
+            }
+            v = delta ? v + value : value;
+        }
+        snapshot.bootId = bootId;
+        snapshot.realtimeMs = delta ? snapshot.realtimeMs + realtimeMs : realtimeMs;
+        snapshot.boottimeMs = delta ? snapshot.boottimeMs + boottimeMs : boottimeMs;
+        haveKeyframe = true;
+        fn(snapshot);
+    });
+    return true;
+}
+
+PowerStatsJournal::PowerStatsJournal(std::shared_ptr<PowerStats> p, const Config &config)
+    : mPowerStats(p),
+      kConfig(config),
+      mData(nullptr),
+      mEnd(0),
+      mBootId(0),
+      mResolved(false),
+      mSchemaWritten(false),
+      mSinceKeyframe(0),
+      mLastRealtimeMs(0),
+      mLastBoottimeMs(0) {}
+
+PowerStatsJournal::~PowerStatsJournal() {
+    stop();
+    unmapFile();
+}
+
+bool PowerStatsJournal::mapFile(::android::base::unique_fd fd) {
+    struct stat st;
+    if (fstat(fd, &st) != 0 ||
+        (static_cast<size_t>(st.st_size) != kConfig.sizeBytes &&
+         ftruncate(fd, kConfig.sizeBytes) != 0)) {
+        PLOG(ERROR) << "Failed to size " << kConfig.path;
+        return false;
+    }
+    void *addr = mmap(nullptr, kConfig.sizeBytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (addr == MAP_FAILED) {
+        PLOG(ERROR) << "Failed to map " << kConfig.path;
+        return false;
+    }
+    unmapFile();
+    mData = static_cast<uint8_t *>(addr);
+    return true;
+}
+
+void PowerStatsJournal::unmapFile() {
+    if (mData != nullptr) {
+        munmap(mData, kConfig.sizeBytes);
+        mData = nullptr;
+    }
+}
+
+void PowerStatsJournal::syncRange(size_t off, size_t len) {
+    const size_t pageSize = getpagesize();
+    const size_t start = off & ~(pageSize - 1);
+    msync(mData + start, off + len - start, MS_SYNC);
+}
+
+bool PowerStatsJournal::compact() {
+    // Keep the newest keyframe that leaves the journal at most half full, together with
+    // everything after it and the schema it was written under.
+    const size_t limit = (kConfig.sizeBytes - sizeof(Format::Header)) / 2;
+    size_t schemaOff = 0, schemaLen = 0;
+    size_t keepSchemaOff = 0, keepSchemaLen = 0, keepOff = 0;
+    forEachRecord(mData, mEnd, [&](size_t off, Format::RecordType type, const uint8_t *,
+                                   size_t len) {
+        if (type == Format::kSchema) {
+            schemaOff = off;
+            schemaLen = Format::kRecordHeaderSize + 1 + len;
+        } else if (type == Format::kKeyframe && keepOff == 0 && mEnd - off <= limit &&
+                   schemaLen > 0) {
+            keepSchemaOff = schemaOff;
+            keepSchemaLen = schemaLen;
+            keepOff = off;
+        }
+    });
+
+    std::string data(reinterpret_cast<const char *>(mData), sizeof(Format::Header));
+    if (keepOff > 0) {
+        if (keepSchemaOff + keepSchemaLen != keepOff) {
+            data.append(reinterpret_cast<const char *>(mData + keepSchemaOff), keepSchemaLen);
+        }
+        data.append(reinterpret_cast<const char *>(mData + keepOff), mEnd - keepOff);
+    } else {
+        // Nothing can be kept; start over with the next snapshot
+        mSchemaWritten = false;
+    }
+
+    // Rewrite through a temporary file so a crash leaves either the old or the new journal
+    const std::string tmpPath = kConfig.path + ".tmp";
+    ::android::base::unique_fd fd(
+            open(tmpPath.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0640));
+    if (fd == -1 || ftruncate(fd, kConfig.sizeBytes) != 0 ||
+        !::android::base::WriteFully(fd, data.data(), data.size()) || fsync(fd) != 0 ||
+        rename(tmpPath.c_str(), kConfig.path.c_str()) != 0) {
+        PLOG(ERROR) << "Failed to compact " << kConfig.path;
+        unlink(tmpPath.c_str());
+        return false;
+    }
+    if (!mapFile(std::move(fd))) {
+        return false;
+    }
+    mEnd = data.size();
+    LOG(INFO) << "Compacted " << kConfig.path << " to " << mEnd << " bytes";
+    return true;
+}
+
+bool PowerStatsJournal::append(Format::RecordType type, const std::string &payload) {
+    const uint32_t len = 1 + payload.size();
+    const size_t recordSize = Format::kRecordHeaderSize + len;
+    // Leave room for the zero length that terminates the journal
+    if (mEnd + recordSize + sizeof(uint32_t) > kConfig.sizeBytes) {
+        // Compaction may drop the current boot entirely, which invalidates a pending delta
+        if (!compact() || (type != Format::kSchema && !mSchemaWritten) ||
+            mEnd + recordSize + sizeof(uint32_t) > kConfig.sizeBytes) {
+            return false;
+        }
+    }
+
+    uint8_t *record = mData + mEnd;
+    uint8_t *body = record + Format::kRecordHeaderSize;
+    body[0] = type;
+    memcpy(body + 1, payload.data(), payload.size());
+    const uint32_t crc = crc32(body, len);
+    memset(record + recordSize, 0, sizeof(uint32_t));
+    memcpy(record + sizeof(len), &crc, sizeof(crc));
+    memcpy(record, &len, sizeof(len));
+    syncRange(mEnd, recordSize + sizeof(uint32_t));
+    mEnd += recordSize;
+    return true;
+}
+
+void PowerStatsJournal::resolve() {
+    mResolved = true;
+    mLayout = CounterLayout::build(mPowerStats.get(), kConfig.entities);
+    mLastValues.assign(mLayout.counters.size(), 0);
+}
+
+void PowerStatsJournal::snapshot(std::vector<int64_t> *values) {
+    // Anything that cannot be read keeps its last value
+    *values = mLastValues;
+
+    std::vector<EnergyMeasurement> measurements;
+    if (!mLayout.channelIds.empty() &&
+        mPowerStats->readEnergyMeter(mLayout.channelIds, &measurements).isOk()) {
+        for (const auto &m : measurements) {
+            const int32_t slot = mLayout.channelSlot(m.id);
+            if (slot >= 0) {
+                (*values)[slot] = m.energyUWs;
+            }
+        }
+    }
+
+    std::vector<StateResidencyResult> residencies;
+    if (!mLayout.entityIds.empty() &&
+        mPowerStats->getStateResidency(mLayout.entityIds, &residencies).isOk()) {
+        for (const auto &result : residencies) {
+            for (const auto &r : result.stateResidencyData) {
+                const int32_t slot = mLayout.stateSlot(result.id, r.id);
+                if (slot >= 0) {
+                    (*values)[slot] = r.totalTimeInStateMs;
+                }
+            }
+        }
+    }
+}
+
+void PowerStatsJournal::writeSnapshot() {
+    // The HAL can start before /data is mounted, so keep trying until the journal opens
+    if (mData == nullptr && !openJournal()) {
+        return;
+    }
+    if (!mResolved) {
+        resolve();
+    }
+
+    std::vector<int64_t> values;
+    snapshot(&values);
+    const int64_t realtimeMs = nowMs(CLOCK_REALTIME);
+    const int64_t boottimeMs = nowMs(CLOCK_BOOTTIME);
+
+    // A second attempt is needed if compaction had to drop the current schema
+    for (int attempt = 0; attempt < 2; attempt++) {
+        if (!mSchemaWritten) {
+            std::string schema;
+            putVarint(&schema, mBootId);
+            putVarint(&schema, mLayout.counters.size());
+            for (const auto &name : mLayout.counters) {
+                putVarint(&schema, name.size());
+                schema += name;
+            }
+            if (!append(Format::kSchema, schema)) {
+                return;
+            }
+            mSchemaWritten = true;
+            mSinceKeyframe = kKeyframeInterval;
+        }
+
+        const bool keyframe = mSinceKeyframe >= kKeyframeInterval;
+        std::string record;
+        putSigned(&record, keyframe ? realtimeMs : realtimeMs - mLastRealtimeMs);
+        putSigned(&record, keyframe ? boottimeMs : boottimeMs - mLastBoottimeMs);
+        putVarint(&record, values.size());
+        for (size_t i = 0; i < values.size(); i++) {
+            putSigned(&record, keyframe ? values[i] : values[i] - mLastValues[i]);
+        }
+        if (append(keyframe ? Format::kKeyframe : Format::kDelta, record)) {
+            mSinceKeyframe = keyframe ? 1 : mSinceKeyframe + 1;
+            mLastRealtimeMs = realtimeMs;
+            mLastBoottimeMs = boottimeMs;
+            mLastValues = std::move(values);
+            return;
+        }
+        mSchemaWritten = false;
+    }
+}
+
+bool PowerStatsJournal::openJournal() {
+    ::android::base::unique_fd fd(
+            open(kConfig.path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0640));
+    if (fd == -1) {
+        PLOG(ERROR) << "Failed to open " << kConfig.path;
+        return false;
+    }
+    if (!mapFile(std::move(fd))) {
+        return false;
+    }
+
+    Format::Header header;
+    memcpy(&header, mData, sizeof(header));
+    if (header.magic != Format::kMagic || header.version != Format::kVersion) {
+        memset(mData, 0, kConfig.sizeBytes);
+        header = {.magic = Format::kMagic, .version = Format::kVersion};
+        memcpy(mData, &header, sizeof(header));
+        msync(mData, kConfig.sizeBytes, MS_SYNC);
+    }
+    mEnd = forEachRecord(mData, kConfig.sizeBytes,
+                         [](size_t, Format::RecordType, const uint8_t *, size_t) {});
+    mBootId = readKernelBootId();
+    LOG(INFO) << "Power stats journal at " << kConfig.path << ", " << mEnd << " of "
+              << kConfig.sizeBytes << " bytes used";
+    return true;
+}
+
+bool PowerStatsJournal::start() {
+    if (kConfig.sizeBytes < kMinSizeBytes || kConfig.periodS == 0) {
+        LOG(ERROR) << "Invalid power stats journal configuration";
+        return false;
+    }
+
+    mTimerFd.reset(timerfd_create(CLOCK_BOOTTIME, TFD_CLOEXEC));
+    mStopFd.reset(eventfd(0, EFD_CLOEXEC));
+    struct itimerspec spec = {};
+    spec.it_interval.tv_sec = kConfig.periodS;
+    spec.it_value = spec.it_interval;
+    if (mTimerFd == -1 || mStopFd == -1 || timerfd_settime(mTimerFd, 0, &spec, nullptr) != 0) {
+        PLOG(ERROR) << "Failed to set up power stats journal timer";
+        return false;
+    }
+
+    mThread = std::thread(&PowerStatsJournal::journalThread, this);
+    return true;
+}
+
+void PowerStatsJournal::stop() {
+    if (!mThread.joinable()) {
+        return;
+    }
+    uint64_t val = 1;
+    TEMP_FAILURE_RETRY(write(mStopFd, &val, sizeof(val)));
+    mThread.join();
+}
+
+void PowerStatsJournal::journalThread() {
+    struct pollfd fds[] = {
+            {.fd = mTimerFd.get(), .events = POLLIN},
+            {.fd = mStopFd.get(), .events = POLLIN},
+    };
+
+    while (true) {
+        if (TEMP_FAILURE_RETRY(poll(fds, 2, -1)) < 0 || (fds[1].revents & POLLIN)) {
+            break;
+        }
+        uint64_t expirations;
+        if (TEMP_FAILURE_RETRY(read(mTimerFd, &expirations, sizeof(expirations))) !=
+            sizeof(expirations)) {
+            continue;
+        }
+        writeSnapshot();
+    }
+}
+
+}  // namespace stats
+}  // namespace power
+}  // namespace hardware
+}  // namespace android
+}  // namespace aidl
@@ -0,0 +1,148 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <ProfilingDataProviders.h>
+
+#include <android-base/logging.h>
+#include <android-base/unique_fd.h>
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+namespace aidl {
+namespace android {
+namespace hardware {
+namespace power {
+namespace stats {
+
+namespace {
+
+constexpr char kThreadIoPath[] = "/proc/thread-self/io";
+
+int64_t nowNs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<int64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+uint64_t parseIoField(const char *buf, const char *field) {
+    const char *p = strstr(buf, field);
+    return p ? strtoull(p + strlen(field), nullptr, 10) : 0;
+}
+
+// Reads this thread's syscr/syscw counters. The read() issued here is itself counted by the
+// kernel once it completes, which Scope compensates for.
+void readThreadIo(uint64_t *reads, uint64_t *writes) {
+    char buf[256];
+    ::android::base::unique_fd fd(open(kThreadIoPath, O_RDONLY | O_CLOEXEC));
+    ssize_t len = (fd == -1) ? -1 : TEMP_FAILURE_RETRY(read(fd, buf, sizeof(buf) - 1));
+    if (len <= 0) {
+        *reads = *writes = 0;
+        return;
+    }
+    buf[len] = '\0';
+    *reads = parseIoField(buf, "syscr: ");
+    *writes = parseIoField(buf, "syscw: ");
+}
+
+std::string describeEntities(const std::unordered_map<std::string, std::vector<State>> &info) {
+    std::vector<std::string> names;
+    for (const auto &[name, states] : info) {
+        names.push_back(name);
+    }
+    if (names.empty()) {
+        return "<none>";
+    }
+    std::sort(names.begin(), names.end());
+    return names.size() == 1 ? names[0]
+                             : names[0] + " (+" + std::to_string(names.size() - 1) + ")";
+}
+
+}  // namespace
+
+ProviderProfile::Scope::Scope(ProviderProfile *profile) : mProfile(profile) {
+    readThreadIo(&mStartReads, &mStartWrites);
+    mStartNs = nowNs();
+}
+
+ProviderProfile::Scope::~Scope() {
+    const int64_t latencyNs = nowNs() - mStartNs;
+    uint64_t reads, writes;
+    readThreadIo(&reads, &writes);
+    // Discount the read() that produced the starting counters
+    reads = (reads > mStartReads) ? reads - mStartReads - 1 : 0;
+    writes = (writes > mStartWrites) ? writes - mStartWrites : 0;
+    mProfile->record(latencyNs, reads, writes);
+}
+
+void ProviderProfile::record(int64_t latencyNs, uint64_t reads, uint64_t writes) {
+    std::scoped_lock lk(mLock);
+    mQueries++;
+    mTotalNs += latencyNs;
+    mMaxNs = std::max(mMaxNs, latencyNs);
+    mTotalReads += reads;
+    mTotalWrites += writes;
+
+    if (mQueries % kReportIntervalQueries == 0) {
+        LOG(INFO) << "profile " << kName << ": queries=" << mQueries
+                  << " avg_us=" << mTotalNs / mQueries / 1000 << " max_us=" << mMaxNs / 1000
+                  << " avg_read_syscalls=" << static_cast<double>(mTotalReads) / mQueries
+                  << " avg_write_syscalls=" << static_cast<double>(mTotalWrites) / mQueries;
+    }
+}
+
+ProfilingStateResidencyDataProvider::ProfilingStateResidencyDataProvider(
+        std::unique_ptr<PowerStats::IStateResidencyDataProvider> provider)
+    : mProvider(std::move(provider)), mProfile(describeEntities(mProvider->getInfo())) {}
+
+bool ProfilingStateResidencyDataProvider::getStateResidencies(
+        std::unordered_map<std::string, std::vector<StateResidency>> *residencies) {
+    ProviderProfile::Scope scope(&mProfile);
+    return mProvider->getStateResidencies(residencies);
+}
+
+std::unordered_map<std::string, std::vector<State>>
+ProfilingStateResidencyDataProvider::getInfo() {
+    return mProvider->getInfo();
+}
+
+ProfilingEnergyConsumer::ProfilingEnergyConsumer(
+        std::unique_ptr<PowerStats::IEnergyConsumer> consumer)
+    : mConsumer(std::move(consumer)), mProfile("consumer " + mConsumer->getConsumerName()) {}
+
+std::pair<EnergyConsumerType, std::string> ProfilingEnergyConsumer::getInfo() {
+    return mConsumer->getInfo();
+}
+
+std::optional<EnergyConsumerResult> ProfilingEnergyConsumer::getEnergyConsumed() {
+    ProviderProfile::Scope scope(&mProfile);
+    return mConsumer->getEnergyConsumed();
+}
+
+std::string ProfilingEnergyConsumer::getConsumerName() {
+    return mConsumer->getConsumerName();
+}
+
+}  // namespace stats
+}  // namespace power
+}  // namespace hardware
+}  // namespace android
+}  // namespace aidl
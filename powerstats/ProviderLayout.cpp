@@ -0,0 +1,323 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <ProviderLayout.h>
+
+#include <android-base/file.h>
+#include <android-base/logging.h>
+#include <android-base/parseint.h>
+#include <android-base/properties.h>
+#include <android-base/strings.h>
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/utsname.h>
+
+#include <algorithm>
+#include <functional>
+
+namespace aidl {
+namespace android {
+namespace hardware {
+namespace power {
+namespace stats {
+
+using ::android::base::GetProperty;
+using ::android::base::ParseUint;
+using ::android::base::ReadFileToString;
+using ::android::base::Split;
+using ::android::base::StartsWith;
+using ::android::base::Trim;
+using ::android::base::WriteStringToFile;
+
+namespace {
+
+constexpr char kPdStatsPath[] = "/sys/devices/platform/acpm_stats/pd_stats";
+constexpr char kFvpStatsPath[] = "/sys/devices/platform/acpm_stats/fvp_stats";
+constexpr char kTpuUsagePath[] = "/sys/devices/platform/1a000000.rio/tpu_usage";
+constexpr char kCpupmTimeInStatePath[] = "/sys/devices/system/cpu/cpupm/cpupm/time_in_state";
+constexpr char kCpuIdlePath[] = "/sys/devices/system/cpu/cpu0/cpuidle/";
+constexpr char kCachePath[] = "/data/vendor/powerstats/provider_layout";
+// Bumped whenever the cached fields change so caches from older builds are rediscovered
+constexpr char kCacheVersion[] = "3";
+
+bool isNumber(const std::string &s) {
+    uint64_t unused;
+    return ParseUint(s, &unused);
+}
+
+void forEachLine(const std::string &path, const std::function<void(const std::string &)> &fn) {
+    std::string data;
+    if (!ReadFileToString(path, &data)) {
+        PLOG(WARNING) << "Failed to read " << path;
+        return;
+    }
+    for (const auto &line : Split(data, "\n")) {
+        fn(Trim(line));
+    }
+}
+
+// pd_stats has one "pd-<name>:" header per domain followed by indented counters
+std::vector<std::string> discoverPowerDomains() {
+    std::vector<std::string> domains;
+    forEachLine(kPdStatsPath, [&domains](const std::string &line) {
+        if (StartsWith(line, "pd-") && line.back() == ':') {
+            domains.push_back(line.substr(0, line.size() - 1));
+        }
+    });
+    return domains;
+}
+
+// fvp_stats has a bare domain name line followed by one line per frequency that starts with the
+// frequency in kHz
+std::vector<std::pair<std::string, std::vector<std::string>>> discoverDvfsDomains() {
+    std::vector<std::pair<std::string, std::vector<std::string>>> domains;
+    forEachLine(kFvpStatsPath, [&domains](const std::string &line) {
+        if (line.empty()) {
+            return;
+        }
+        std::vector<std::string> parts = Split(line, " ");
+        if (parts.size() == 1 && !isNumber(parts[0])) {
+            domains.push_back({parts[0], {}});
+        } else if (!domains.empty() && isNumber(parts[0])) {
+            domains.back().second.push_back(parts[0]);
+        }
+    });
+    domains.erase(std::remove_if(domains.begin(), domains.end(),
+                                 [](const auto &d) { return d.second.empty(); }),
+                  domains.end());
+    return domains;
+}
+
+// tpu_usage starts with a "uid: <freq> <freq> ..." header
+std::vector<std::string> discoverTpuFreqs() {
+    std::vector<std::string> freqs;
+    std::string data;
+    if (!ReadFileToString(kTpuUsagePath, &data)) {
+        PLOG(WARNING) << "Failed to read " << kTpuUsagePath;
+        return freqs;
+    }
+    std::string header = data.substr(0, data.find('\n'));
+    if (!StartsWith(header, "uid:")) {
+        return freqs;
+    }
+    for (const auto &f : Split(Trim(header.substr(4)), " ")) {
+        if (isNumber(f)) {
+            freqs.push_back(f);
+        }
+    }
+    std::sort(freqs.begin(), freqs.end(), [](const std::string &a, const std::string &b) {
+        return std::stoull(a) > std::stoull(b);
+    });
+    return freqs;
+}
+
+// cpupm time_in_state repeats a "cpuN ..." line per CPU under each state header
+std::vector<std::string> discoverCpus() {
+    std::vector<std::string> cpus;
+    forEachLine(kCpupmTimeInStatePath, [&cpus](const std::string &line) {
+        std::string name = line.substr(0, line.find(' '));
+        if (StartsWith(name, "cpu") && isNumber(name.substr(3)) &&
+            std::find(cpus.begin(), cpus.end(), name) == cpus.end()) {
+            cpus.push_back(name);
+        }
+    });
+    return cpus;
+}
+
+// cpupm time_in_state has one "[stateN]" header per idle state. The cpupm state index matches the
+// cpuidle state index, which provides the name. Names are made safe for the cache format.
+std::vector<std::pair<std::string, std::string>> discoverCpuStates() {
+    std::vector<std::pair<std::string, std::string>> states;
+    forEachLine(kCpupmTimeInStatePath, [&states](const std::string &line) {
+        if (!StartsWith(line, "[state") || line.back() != ']') {
+            return;
+        }
+        const std::string idx = line.substr(6, line.size() - 7);
+        if (!isNumber(idx)) {
+            return;
+        }
+        std::string name;
+        if (ReadFileToString(std::string(kCpuIdlePath) + "state" + idx + "/name", &name)) {
+            name = Trim(name);
+            std::replace(name.begin(), name.end(), ' ', '_');
+        }
+        if (name.empty()) {
+            name = "STATE" + idx;
+        }
+        states.emplace_back(line, name);
+    });
+    return states;
+}
+
+/*
+ * Identifies everything the discovered nodes depend on. Under GKI the vendor modules that provide
+ * them (acpm_stats, edgetpu, cpupm) are updated without the kernel, so the vendor and vendor_dlkm
+ * builds are part of the key along with the kernel build. Any change triggers a new discovery.
+ */
+std::string getBuildId() {
+    struct utsname buf;
+    if (uname(&buf) != 0) {
+        return "";
+    }
+    const std::string vendor = GetProperty("ro.vendor.build.fingerprint", "");
+    if (vendor.empty()) {
+        return "";
+    }
+    const std::string vendorDlkm = GetProperty("ro.vendor_dlkm.build.fingerprint", "");
+    std::string id = vendor + " " + vendorDlkm + " " + buf.release + " " + buf.version;
+    // The id is a single line in the cache
+    std::replace(id.begin(), id.end(), '\n', ' ');
+    return id;
+}
+
+bool isAllNumbers(std::vector<std::string>::const_iterator begin,
+                  std::vector<std::string>::const_iterator end) {
+    return begin != end && std::all_of(begin, end, isNumber);
+}
+
+// Parses one cache line into layout. Returns false if the line is malformed.
+bool parseLayoutLine(const std::vector<std::string> &parts, ProviderLayout *layout) {
+    if (parts.size() < 2 || std::any_of(parts.begin(), parts.end(),
+                                        [](const std::string &p) { return p.empty(); })) {
+        return false;
+    }
+    if (parts[0] == "pd" && parts.size() == 2) {
+        if (!StartsWith(parts[1], "pd-")) {
+            return false;
+        }
+        layout->powerDomains.push_back(parts[1]);
+    } else if (parts[0] == "dvfs" && parts.size() >= 3) {
+        if (!isAllNumbers(parts.begin() + 2, parts.end())) {
+            return false;
+        }
+        layout->dvfsDomains.push_back({parts[1], {parts.begin() + 2, parts.end()}});
+    } else if (parts[0] == "tpu" && layout->tpuFreqs.empty()) {
+        if (!isAllNumbers(parts.begin() + 1, parts.end())) {
+            return false;
+        }
+        layout->tpuFreqs.assign(parts.begin() + 1, parts.end());
+    } else if (parts[0] == "cpu" && parts.size() == 2) {
+        if (!StartsWith(parts[1], "cpu") || !isNumber(parts[1].substr(3))) {
+            return false;
+        }
+        layout->cpus.push_back(parts[1]);
+    } else if (parts[0] == "cpustate" && parts.size() == 3) {
+        const std::string &header = parts[1];
+        if (!StartsWith(header, "[state") || header.back() != ']' ||
+            !isNumber(header.substr(6, header.size() - 7))) {
+            return false;
+        }
+        layout->cpuStates.emplace_back(header, parts[2]);
+    } else {
+        return false;
+    }
+    return true;
+}
+
+/*
+ * The cache is trusted only if every line parses, the trailing "end <lines>" marker matches and
+ * every category is present. Anything else, e.g. a truncated or corrupt file, is rediscovered.
+ */
+bool loadLayout(const std::string &buildId, ProviderLayout *layout) {
+    std::string data;
+    if (buildId.empty() || !ReadFileToString(kCachePath, &data)) {
+        return false;
+    }
+    std::vector<std::string> lines = Split(data, "\n");
+    if (!lines.empty() && lines.back().empty()) {
+        lines.pop_back();
+    }
+    if (lines.size() < 2 || lines[0] != std::string("build ") + kCacheVersion + " " + buildId ||
+        lines.back() != "end " + std::to_string(lines.size() - 2)) {
+        return false;
+    }
+
+    ProviderLayout parsed;
+    for (size_t i = 1; i < lines.size() - 1; i++) {
+        if (!parseLayoutLine(Split(lines[i], " "), &parsed)) {
+            LOG(WARNING) << "Discarding corrupt provider layout cache at line " << i;
+            return false;
+        }
+    }
+    if (parsed.powerDomains.empty() || parsed.dvfsDomains.empty() || parsed.tpuFreqs.empty() ||
+        parsed.cpus.empty() || parsed.cpuStates.empty()) {
+        return false;
+    }
+    *layout = std::move(parsed);
+    return true;
+}
+
+void saveLayout(const std::string &buildId, const ProviderLayout &layout) {
+    std::string data = std::string("build ") + kCacheVersion + " " + buildId + "\n";
+    for (const auto &pd : layout.powerDomains) {
+        data += "pd " + pd + "\n";
+    }
+    for (const auto &[name, freqs] : layout.dvfsDomains) {
+        data += "dvfs " + name + " " + ::android::base::Join(freqs, " ") + "\n";
+    }
+    if (!layout.tpuFreqs.empty()) {
+        data += "tpu " + ::android::base::Join(layout.tpuFreqs, " ") + "\n";
+    }
+    for (const auto &cpu : layout.cpus) {
+        data += "cpu " + cpu + "\n";
+    }
+    const size_t count = layout.powerDomains.size() + layout.dvfsDomains.size() +
+                         (layout.tpuFreqs.empty() ? 0 : 1) + layout.cpus.size() +
+                         layout.cpuStates.size();
+    for (const auto &[header, name] : layout.cpuStates) {
+        data += "cpustate " + header + " " + name + "\n";
+    }
+    data += "end " + std::to_string(count) + "\n";
+
+    // /data may not be available yet this early in boot; the next start will retry.
+    const std::string tmpPath = std::string(kCachePath) + ".tmp";
+    if (!WriteStringToFile(data, tmpPath) || rename(tmpPath.c_str(), kCachePath) != 0) {
+        LOG(INFO) << "Provider layout not cached: " << strerror(errno);
+    }
+}
+
+}  // namespace
+
+const ProviderLayout &ProviderLayout::get() {
+    static const ProviderLayout layout = [] {
+        ProviderLayout l;
+        const std::string buildId = getBuildId();
+        if (loadLayout(buildId, &l)) {
+            return l;
+        }
+
+        l.powerDomains = discoverPowerDomains();
+        l.dvfsDomains = discoverDvfsDomains();
+        l.tpuFreqs = discoverTpuFreqs();
+        l.cpus = discoverCpus();
+        l.cpuStates = discoverCpuStates();
+        // Only cache a complete layout so a node that was briefly unreadable is retried
+        if (!buildId.empty() && !l.powerDomains.empty() && !l.dvfsDomains.empty() &&
+            !l.tpuFreqs.empty() && !l.cpus.empty() && !l.cpuStates.empty()) {
+            saveLayout(buildId, l);
+        }
+        return l;
+    }();
+    return layout;
+}
+
+}  // namespace stats
+}  // namespace power
+}  // namespace hardware
+}  // namespace android
+}  // namespace aidl
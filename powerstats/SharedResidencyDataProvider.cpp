@@ -0,0 +1,269 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <SharedResidencyDataProvider.h>
+
+#include <PowerStatsJournal.h>
+#include <android-base/logging.h>
+#include <android-base/unique_fd.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+namespace aidl {
+namespace android {
+namespace hardware {
+namespace power {
+namespace stats {
+
+namespace {
+
+// A client update touches a few cache lines, so a handful of retries is plenty. A block that is
+// still inconsistent after that belongs to a client that died mid-update.
+constexpr int kReadAttempts = 8;
+
+std::string blockPath(const std::string &dir, const std::string &entity) {
+    return dir + "/" + entity;
+}
+
+}  // namespace
+
+std::unique_ptr<SharedResidencyWriter> SharedResidencyWriter::open(const std::string &dir,
+                                                                   const std::string &entity) {
+    const std::string path = blockPath(dir, entity);
+    ::android::base::unique_fd fd(::open(path.c_str(), O_RDWR | O_CLOEXEC));
+    // Marks the block as having a live writer. The HAL only holds the lock exclusively for the
+    // moment it takes to reset an abandoned block, so this does not wait long.
+    struct stat st;
+    if (fd == -1 || TEMP_FAILURE_RETRY(flock(fd, LOCK_SH)) != 0 || fstat(fd, &st) != 0 ||
+        static_cast<size_t>(st.st_size) < sizeof(SharedResidencyBlock)) {
+        return nullptr;
+    }
+
+    const size_t size = st.st_size;
+    void *addr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (addr == MAP_FAILED) {
+        PLOG(ERROR) << "Failed to map " << path;
+        return nullptr;
+    }
+    auto *block = static_cast<SharedResidencyBlock *>(addr);
+    if (block->magic != SharedResidencyBlock::kMagic ||
+        block->version != SharedResidencyBlock::kVersion || block->bootId != readKernelBootId() ||
+        SharedResidencyBlock::sizeFor(block->stateCount) > size) {
+        // Not (re)initialized by the HAL for this boot yet
+        munmap(addr, size);
+        return nullptr;
+    }
+    return std::unique_ptr<SharedResidencyWriter>(
+            new SharedResidencyWriter(std::move(fd), block, size));
+}
+
+SharedResidencyWriter::SharedResidencyWriter(::android::base::unique_fd fd,
+                                             SharedResidencyBlock *block, size_t size)
+    : mFd(std::move(fd)), mBlock(block), mSize(size) {}
+
+SharedResidencyWriter::~SharedResidencyWriter() {
+    munmap(mBlock, mSize);
+}
+
+void SharedResidencyWriter::publish(const std::vector<StateResidency> &residencies) {
+    // Start from an odd value even if a previous writer died in the middle of an update
+    const uint32_t seq = mBlock->seq.load(std::memory_order_relaxed) | 1;
+    mBlock->seq.store(seq, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    SharedResidencyBlock::Slot *slots = mBlock->slots();
+    const size_t count = std::min<size_t>(residencies.size(), mBlock->stateCount);
+    for (size_t i = 0; i < count; ++i) {
+        slots[i].totalTimeInStateMs.store(residencies[i].totalTimeInStateMs,
+                                          std::memory_order_relaxed);
+        slots[i].totalStateEntryCount.store(residencies[i].totalStateEntryCount,
+                                            std::memory_order_relaxed);
+        slots[i].lastEntryTimestampMs.store(residencies[i].lastEntryTimestampMs,
+                                            std::memory_order_relaxed);
+    }
+
+    mBlock->seq.store(seq + 1, std::memory_order_release);
+}
+
+SharedResidencyDataProvider::SharedResidencyDataProvider(
+        std::string dir, std::unordered_map<std::string, std::vector<State>> entities,
+        std::unique_ptr<PowerStats::IStateResidencyDataProvider> fallback)
+    : kDir(std::move(dir)),
+      kInfo(std::move(entities)),
+      mFallback(std::move(fallback)),
+      kBootId(readKernelBootId()) {
+    for (const auto &[name, states] : kInfo) {
+        mEntities.push_back({.name = name, .states = states, .fd = {}, .block = nullptr});
+    }
+}
+
+SharedResidencyDataProvider::~SharedResidencyDataProvider() {
+    for (const auto &entity : mEntities) {
+        if (entity.block != nullptr) {
+            munmap(entity.block, SharedResidencyBlock::sizeFor(entity.states.size()));
+        }
+    }
+}
+
+bool SharedResidencyDataProvider::mapBlock(Entity *entity) {
+    // The directory lives on /data, so this keeps failing quietly until it is mounted
+    const std::string path = blockPath(kDir, entity->name);
+    // Clients get write access through the group of the residency directory, which is setgid
+    ::android::base::unique_fd fd(::open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0660));
+    if (fd == -1) {
+        if (errno != ENOENT) {
+            PLOG(ERROR) << "Failed to open " << path;
+        }
+        return false;
+    }
+
+    const size_t size = SharedResidencyBlock::sizeFor(entity->states.size());
+    struct stat st;
+    if (fstat(fd, &st) != 0 ||
+        (static_cast<size_t>(st.st_size) != size && ftruncate(fd, size) != 0)) {
+        PLOG(ERROR) << "Failed to size " << path;
+        return false;
+    }
+    void *addr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (addr == MAP_FAILED) {
+        PLOG(ERROR) << "Failed to map " << path;
+        return false;
+    }
+
+    auto *block = static_cast<SharedResidencyBlock *>(addr);
+    if (block->magic != SharedResidencyBlock::kMagic ||
+        block->version != SharedResidencyBlock::kVersion || block->bootId != kBootId ||
+        block->stateCount != entity->states.size()) {
+        // Left over from an earlier boot or an older layout. Clients only open blocks that match
+        // the current boot, so nobody is writing to it.
+        block->seq.store(0, std::memory_order_relaxed);
+        for (size_t i = 0; i < entity->states.size(); ++i) {
+            block->slots()[i].totalTimeInStateMs.store(0, std::memory_order_relaxed);
+            block->slots()[i].totalStateEntryCount.store(0, std::memory_order_relaxed);
+            block->slots()[i].lastEntryTimestampMs.store(0, std::memory_order_relaxed);
+        }
+        block->magic = SharedResidencyBlock::kMagic;
+        block->version = SharedResidencyBlock::kVersion;
+        block->stateCount = entity->states.size();
+        // Clients accept the block once the boot id matches, so it goes last
+        std::atomic_thread_fence(std::memory_order_release);
+        block->bootId = kBootId;
+    }
+    entity->fd = std::move(fd);
+    entity->block = block;
+    return true;
+}
+
+bool SharedResidencyDataProvider::hasWriter(const Entity &entity) {
+    if (TEMP_FAILURE_RETRY(flock(entity.fd, LOCK_EX | LOCK_NB)) != 0) {
+        if (errno != EWOULDBLOCK) {
+            PLOG(ERROR) << "Failed to check the writer of " << entity.name;
+            return false;
+        }
+        return true;
+    }
+    // The client exited or closed the block. Nobody can open it while the lock is held, so the
+    // reset cannot race a restarted client's first update.
+    entity.block->seq.store(0, std::memory_order_relaxed);
+    flock(entity.fd, LOCK_UN);
+    return false;
+}
+
+bool SharedResidencyDataProvider::readBlock(const Entity &entity,
+                                            std::vector<StateResidency> *residency) {
+    SharedResidencyBlock *block = entity.block;
+    residency->resize(entity.states.size());
+    for (int attempt = 0; attempt < kReadAttempts; ++attempt) {
+        const uint32_t seq = block->seq.load(std::memory_order_acquire);
+        if (seq == 0) {
+            // The client still reports through its binder callback
+            return false;
+        }
+        if (attempt == 0 && !hasWriter(entity)) {
+            return false;
+        }
+        if (seq & 1) {
+            continue;
+        }
+        for (size_t i = 0; i < entity.states.size(); ++i) {
+            const SharedResidencyBlock::Slot &slot = block->slots()[i];
+            (*residency)[i] = {
+                    .id = entity.states[i].id,
+                    .totalTimeInStateMs = slot.totalTimeInStateMs.load(std::memory_order_relaxed),
+                    .totalStateEntryCount =
+                            slot.totalStateEntryCount.load(std::memory_order_relaxed),
+                    .lastEntryTimestampMs =
+                            slot.lastEntryTimestampMs.load(std::memory_order_relaxed),
+            };
+        }
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (block->seq.load(std::memory_order_relaxed) == seq) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool SharedResidencyDataProvider::getStateResidencies(
+        std::unordered_map<std::string, std::vector<StateResidency>> *residencies) {
+    std::scoped_lock lk(mLock);
+
+    std::vector<const std::string *> fallbackNames;
+    for (auto &entity : mEntities) {
+        std::vector<StateResidency> residency;
+        if ((entity.block != nullptr || mapBlock(&entity)) && readBlock(entity, &residency)) {
+            residencies->emplace(entity.name, std::move(residency));
+        } else {
+            fallbackNames.push_back(&entity.name);
+        }
+    }
+    if (fallbackNames.empty()) {
+        return true;
+    }
+
+    // Only pay for the binder callbacks when some client has not switched over
+    mFallbackResidencies.clear();
+    if (mFallback == nullptr || !mFallback->getStateResidencies(&mFallbackResidencies)) {
+        return false;
+    }
+    bool ok = true;
+    for (const std::string *name : fallbackNames) {
+        auto it = mFallbackResidencies.find(*name);
+        if (it == mFallbackResidencies.end()) {
+            ok = false;
+            continue;
+        }
+        residencies->emplace(*name, std::move(it->second));
+    }
+    return ok;
+}
+
+std::unordered_map<std::string, std::vector<State>> SharedResidencyDataProvider::getInfo() {
+    return kInfo;
+}
+
+}  // namespace stats
+}  // namespace power
+}  // namespace hardware
+}  // namespace android
+}  // namespace aidl
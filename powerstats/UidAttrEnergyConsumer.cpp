@@ -0,0 +1,284 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <UidAttrEnergyConsumer.h>
+
+#include <android-base/logging.h>
+
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+namespace aidl {
+namespace android {
+namespace hardware {
+namespace power {
+namespace stats {
+
+namespace {
+
+constexpr size_t kInitialBufSize = 16384;
+constexpr size_t kInitialUidCapacity = 256;
+
+const char *skipBlanks(const char *p, const char *end) {
+    while (p < end && (*p == ' ' || *p == '\t')) {
+        p++;
+    }
+    return p;
+}
+
+// Parses an unsigned decimal without crossing end or a newline. Returns nullptr if no digits.
+const char *parseUint(const char *p, const char *end, uint64_t *out) {
+    p = skipBlanks(p, end);
+    const char *start = p;
+    uint64_t val = 0;
+    while (p < end && *p >= '0' && *p <= '9') {
+        val = val * 10 + (*p - '0');
+        p++;
+    }
+    *out = val;
+    return (p == start) ? nullptr : p;
+}
+
+size_t hashUid(uint32_t uid, size_t mask) {
+    return static_cast<size_t>((uid * 0x9E3779B97F4A7C15ULL) >> 32) & mask;
+}
+
+}  // namespace
+
+UidAttrEnergyConsumer::UidAttrEnergyConsumer(std::shared_ptr<PowerStats> p,
+                                             EnergyConsumerType type, std::string name,
+                                             std::vector<std::string> channelNames,
+                                             std::string path,
+                                             std::function<int32_t(uint32_t)> coeffLookup)
+    : mPowerStats(p),
+      kType(type),
+      kName(name),
+      kChannelNames(channelNames),
+      kPath(path),
+      kCoeffLookup(coeffLookup),
+      mChannelsResolved(false),
+      mLastEnergyUWs(0),
+      mBuf(kInitialBufSize),
+      mUids(kInitialUidCapacity, UidEntry{kEmptyUid, 0, 0}),
+      mUidCount(0) {}
+
+void UidAttrEnergyConsumer::resolveChannelsLocked() {
+    mChannelsResolved = true;
+
+    std::vector<Channel> channels;
+    mPowerStats->getEnergyMeterInfo(&channels);
+    for (const auto &name : kChannelNames) {
+        auto it = std::find_if(channels.begin(), channels.end(),
+                               [&name](const Channel &c) { return c.name == name; });
+        if (it == channels.end()) {
+            LOG(ERROR) << kName << ": failed to find energy meter channel " << name;
+            continue;
+        }
+        mChannelIds.push_back(it->id);
+    }
+    mMeasurements.reserve(mChannelIds.size());
+}
+
+bool UidAttrEnergyConsumer::parseHeaderLocked(const char *line, const char *end) {
+    mHeader.assign(line, end);
+    mColumnCoeffs.clear();
+
+    const char *p = static_cast<const char *>(memchr(line, ':', end - line));
+    if (p == nullptr) {
+        return false;
+    }
+    p++;
+    uint64_t freq;
+    while ((p = parseUint(p, end, &freq)) != nullptr) {
+        mColumnCoeffs.push_back(kCoeffLookup(static_cast<uint32_t>(freq)));
+    }
+    return !mColumnCoeffs.empty();
+}
+
+void UidAttrEnergyConsumer::growLocked() {
+    std::vector<UidEntry> old(mUids.size() * 2, UidEntry{kEmptyUid, 0, 0});
+    old.swap(mUids);
+    const size_t mask = mUids.size() - 1;
+    for (const auto &e : old) {
+        if (e.uid == kEmptyUid) {
+            continue;
+        }
+        size_t slot = hashUid(e.uid, mask);
+        while (mUids[slot].uid != kEmptyUid) {
+            slot = (slot + 1) & mask;
+        }
+        mUids[slot] = e;
+    }
+}
+
+size_t UidAttrEnergyConsumer::findOrInsertLocked(uint32_t uid) {
+    const size_t mask = mUids.size() - 1;
+    size_t slot = hashUid(uid, mask);
+    while (mUids[slot].uid != uid) {
+        if (mUids[slot].uid == kEmptyUid) {
+            mUids[slot].uid = uid;
+            mUidCount++;
+            break;
+        }
+        slot = (slot + 1) & mask;
+    }
+    return slot;
+}
+
+bool UidAttrEnergyConsumer::readTableLocked() {
+    if (mFd == -1) {
+        mFd.reset(open(kPath.c_str(), O_RDONLY | O_CLOEXEC));
+        if (mFd == -1) {
+            PLOG(ERROR) << "Failed to open " << kPath;
+            return false;
+        }
+    }
+
+    size_t len = 0;
+    while (true) {
+        if (len + 1 >= mBuf.size()) {
+            mBuf.resize(mBuf.size() * 2);
+        }
+        ssize_t n = TEMP_FAILURE_RETRY(pread(mFd, mBuf.data() + len, mBuf.size() - len - 1, len));
+        if (n < 0) {
+            PLOG(ERROR) << "Failed to read " << kPath;
+            return false;
+        }
+        if (n == 0) {
+            break;
+        }
+        len += n;
+    }
+    const char *p = mBuf.data();
+    const char *end = p + len;
+
+    // Size the UID table for the worst case up front so slots stay stable during the pass
+    const size_t lines = std::count(p, end, '\n') + 1;
+    while ((mUidCount + lines) * 2 > mUids.size()) {
+        growLocked();
+    }
+
+    const char *eol = static_cast<const char *>(memchr(p, '\n', end - p));
+    if (eol == nullptr) {
+        eol = end;
+    }
+    // A new set of columns makes the previous weighted times incomparable. Rebaseline every UID
+    // without attributing anything for this interval.
+    bool rebaseline = false;
+    if (mHeader.size() != static_cast<size_t>(eol - p) ||
+        memcmp(mHeader.data(), p, eol - p) != 0) {
+        if (!parseHeaderLocked(p, eol)) {
+            LOG(ERROR) << "Failed to parse header of " << kPath;
+            mHeader.clear();
+            return false;
+        }
+        rebaseline = true;
+    }
+
+    mMoved.clear();
+    const size_t columns = mColumnCoeffs.size();
+    for (p = eol; p < end; p = eol) {
+        p++;
+        eol = static_cast<const char *>(memchr(p, '\n', end - p));
+        if (eol == nullptr) {
+            eol = end;
+        }
+
+        uint64_t uid;
+        const char *q = parseUint(p, eol, &uid);
+        if (q == nullptr || q >= eol || *q != ':' || uid >= kEmptyUid) {
+            continue;
+        }
+        q++;
+
+        uint64_t weightedTime = 0;
+        for (size_t col = 0; col < columns && q != nullptr; col++) {
+            uint64_t time;
+            q = parseUint(q, eol, &time);
+            weightedTime += time * mColumnCoeffs[col];
+        }
+
+        UidEntry &entry = mUids[findOrInsertLocked(static_cast<uint32_t>(uid))];
+        if (!rebaseline && weightedTime > entry.weightedTime) {
+            mMoved.push_back({static_cast<size_t>(&entry - mUids.data()),
+                              weightedTime - entry.weightedTime});
+        }
+        // Counters that went backwards were reset; take the new value as the baseline.
+        entry.weightedTime = weightedTime;
+    }
+    return true;
+}
+
+bool UidAttrEnergyConsumer::attributeLocked(int64_t deltaEnergyUWs) {
+    uint64_t totalDelta = 0;
+    for (const auto &m : mMoved) {
+        totalDelta += m.deltaWeightedTime;
+    }
+    if (totalDelta == 0 || deltaEnergyUWs <= 0) {
+        return false;
+    }
+
+    for (const auto &m : mMoved) {
+        mUids[m.slot].energyUWs += static_cast<int64_t>(
+                static_cast<double>(deltaEnergyUWs) * m.deltaWeightedTime / totalDelta);
+    }
+    return true;
+}
+
+std::optional<EnergyConsumerResult> UidAttrEnergyConsumer::getEnergyConsumed() {
+    std::scoped_lock lk(mLock);
+    if (!mChannelsResolved) {
+        resolveChannelsLocked();
+    }
+
+    int64_t totalEnergyUWs = 0;
+    int64_t timestampMs = 0;
+    if (!mChannelIds.empty()) {
+        mMeasurements.clear();
+        if (!mPowerStats->readEnergyMeter(mChannelIds, &mMeasurements).isOk()) {
+            LOG(ERROR) << "Failed to read energy meter";
+            return {};
+        }
+        for (const auto &m : mMeasurements) {
+            totalEnergyUWs += m.energyUWs;
+            timestampMs = m.timestampMs;
+        }
+    }
+
+    if (readTableLocked()) {
+        attributeLocked(totalEnergyUWs - mLastEnergyUWs);
+    }
+    mLastEnergyUWs = totalEnergyUWs;
+
+    EnergyConsumerResult result = {.timestampMs = timestampMs, .energyUWs = totalEnergyUWs};
+    result.attribution.reserve(mUidCount);
+    for (const auto &e : mUids) {
+        if (e.uid != kEmptyUid && e.energyUWs > 0) {
+            result.attribution.push_back(
+                    {.uid = static_cast<int32_t>(e.uid), .energyUWs = e.energyUWs});
+        }
+    }
+    return result;
+}
+
+}  // namespace stats
+}  // namespace power
+}  // namespace hardware
+}  // namespace android
+}  // namespace aidl
@@ -0,0 +1,174 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <WifiBtEnergyConsumer.h>
+
+#include <android-base/logging.h>
+
+#include <algorithm>
+
+namespace aidl {
+namespace android {
+namespace hardware {
+namespace power {
+namespace stats {
+
+WifiBtEnergyAttribution::WifiBtEnergyAttribution(std::shared_ptr<PowerStats> p,
+                                                 const Config &config)
+    : mPowerStats(p),
+      kConfig(config),
+      mResolved(false),
+      mChannelId(-1),
+      mLastRailEnergyUWs(0),
+      mTimestampMs(0) {}
+
+void WifiBtEnergyAttribution::resolveLocked() {
+    mResolved = true;
+
+    std::vector<Channel> channels;
+    mPowerStats->getEnergyMeterInfo(&channels);
+    for (const auto &c : channels) {
+        if (c.name == kConfig.railName) {
+            mChannelId = c.id;
+            break;
+        }
+    }
+    if (mChannelId == -1) {
+        LOG(ERROR) << "Failed to find energy meter channel " << kConfig.railName;
+    } else {
+        mChannelIds.push_back(mChannelId);
+    }
+
+    std::vector<PowerEntity> entities;
+    mPowerStats->getPowerEntityInfo(&entities);
+    auto resolve = [&entities](const std::string &entityName,
+                               const std::vector<std::string> &stateNames, Subsystem *subsystem) {
+        for (const auto &e : entities) {
+            if (e.name != entityName) {
+                continue;
+            }
+            subsystem->entityId = e.id;
+            for (const auto &s : e.states) {
+                if (std::find(stateNames.begin(), stateNames.end(), s.name) != stateNames.end()) {
+                    subsystem->activeStateIds.push_back(s.id);
+                }
+            }
+            return;
+        }
+        LOG(WARNING) << "Failed to find power entity " << entityName;
+    };
+    resolve(kConfig.wifiEntity, kConfig.wifiActiveStates, &mWifi);
+    resolve(kConfig.btEntity, kConfig.btActiveStates, &mBt);
+
+    for (const auto *s : {&mWifi, &mBt}) {
+        if (s->entityId != -1) {
+            mEntityIds.push_back(s->entityId);
+        }
+    }
+    mMeasurements.reserve(1);
+    mResidencies.reserve(mEntityIds.size());
+}
+
+int64_t WifiBtEnergyAttribution::readActiveMsLocked(const Subsystem &subsystem) {
+    int64_t activeMs = 0;
+    for (const auto &result : mResidencies) {
+        if (result.id != subsystem.entityId) {
+            continue;
+        }
+        for (const auto &r : result.stateResidencyData) {
+            if (std::find(subsystem.activeStateIds.begin(), subsystem.activeStateIds.end(),
+                          r.id) != subsystem.activeStateIds.end()) {
+                activeMs += r.totalTimeInStateMs;
+            }
+        }
+    }
+    return activeMs;
+}
+
+bool WifiBtEnergyAttribution::updateLocked() {
+    if (!mResolved) {
+        resolveLocked();
+    }
+    if (mChannelId == -1) {
+        return true;
+    }
+
+    mMeasurements.clear();
+    if (!mPowerStats->readEnergyMeter(mChannelIds, &mMeasurements).isOk() ||
+        mMeasurements.empty()) {
+        LOG(ERROR) << "Failed to read energy meter";
+        return false;
+    }
+    const int64_t railEnergyUWs = mMeasurements[0].energyUWs;
+    mTimestampMs = mMeasurements[0].timestampMs;
+
+    int64_t wifiActiveMs = mWifi.lastActiveMs;
+    int64_t btActiveMs = mBt.lastActiveMs;
+    mResidencies.clear();
+    if (!mEntityIds.empty() &&
+        mPowerStats->getStateResidency(mEntityIds, &mResidencies).isOk()) {
+        if (mWifi.entityId != -1) {
+            wifiActiveMs = readActiveMsLocked(mWifi);
+        }
+        if (mBt.entityId != -1) {
+            btActiveMs = readActiveMsLocked(mBt);
+        }
+    }
+
+    const int64_t deltaEnergyUWs = std::max<int64_t>(railEnergyUWs - mLastRailEnergyUWs, 0);
+    const int64_t deltaWifiMs = std::max<int64_t>(wifiActiveMs - mWifi.lastActiveMs, 0);
+    const int64_t deltaBtMs = std::max<int64_t>(btActiveMs - mBt.lastActiveMs, 0);
+
+    // With no residency movement on either side there is nothing to weigh against, so the
+    // rail is split evenly.
+    int64_t wifiEnergyUWs = deltaEnergyUWs >> 1;
+    if (deltaWifiMs + deltaBtMs > 0) {
+        wifiEnergyUWs = static_cast<int64_t>(static_cast<double>(deltaEnergyUWs) * deltaWifiMs /
+                                             (deltaWifiMs + deltaBtMs));
+    }
+    mWifi.energyUWs += wifiEnergyUWs;
+    mBt.energyUWs += deltaEnergyUWs - wifiEnergyUWs;
+
+    mLastRailEnergyUWs = railEnergyUWs;
+    mWifi.lastActiveMs = wifiActiveMs;
+    mBt.lastActiveMs = btActiveMs;
+    return true;
+}
+
+std::optional<EnergyConsumerResult> WifiBtEnergyAttribution::getEnergyConsumed(
+        EnergyConsumerType type) {
+    std::scoped_lock lk(mLock);
+    if (!updateLocked()) {
+        return {};
+    }
+
+    const Subsystem &subsystem = (type == EnergyConsumerType::WIFI) ? mWifi : mBt;
+    return EnergyConsumerResult{.timestampMs = mTimestampMs, .energyUWs = subsystem.energyUWs};
+}
+
+WifiBtEnergyConsumer::WifiBtEnergyConsumer(std::shared_ptr<WifiBtEnergyAttribution> attribution,
+                                           EnergyConsumerType type, std::string name)
+    : mAttribution(attribution), kType(type), kName(name) {}
+
+std::optional<EnergyConsumerResult> WifiBtEnergyConsumer::getEnergyConsumed() {
+    return mAttribution->getEnergyConsumed(kType);
+}
+
+}  // namespace stats
+}  // namespace power
+}  // namespace hardware
+}  // namespace android
+}  // namespace aidl
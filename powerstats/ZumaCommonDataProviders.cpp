@@ -16,135 +16,188 @@
 
 #include <PowerStatsAidl.h>
 #include <ZumaCommonDataProviders.h>
-#include <AocStateResidencyDataProvider.h>
-#include <CpupmStateResidencyDataProvider.h>
+#include <AocSnapshotStateResidencyDataProvider.h>
+#include <CachingDataProviders.h>
+#include <CounterTracer.h>
+#include <CpuIdleStateResidencyDataProvider.h>
 #include <DevfreqStateResidencyDataProvider.h>
+#include <FreqCoeffTable.h>
+#include <LazyDataProviders.h>
+#include <LinkIdleStateResidencyDataProvider.h>
+#include <OdpmSampler.h>
+#include <PowerStatsJournal.h>
+#include <ProfilingDataProviders.h>
+#include <ProviderLayout.h>
+#include <SharedResidencyDataProvider.h>
 #include <AdaptiveDvfsStateResidencyDataProvider.h>
 #include <TpuDvfsStateResidencyDataProvider.h>
 #include <UfsStateResidencyDataProvider.h>
+#include <UidAttrEnergyConsumer.h>
+#include <WifiBtEnergyConsumer.h>
 #include <dataproviders/GenericStateResidencyDataProvider.h>
 #include <dataproviders/IioEnergyMeterDataProvider.h>
 #include <dataproviders/PowerStatsEnergyConsumer.h>
-#include <dataproviders/PowerStatsEnergyAttribution.h>
 #include <dataproviders/PixelStateResidencyDataProvider.h>
 
 #include <android-base/logging.h>
 #include <android-base/properties.h>
+#include <android-base/stringprintf.h>
+#include <android-base/strings.h>
 #include <android/binder_manager.h>
 #include <android/binder_process.h>
 #include <log/log.h>
 #include <sys/stat.h>
 
+#include <algorithm>
+#include <chrono>
+#include <set>
+
 using aidl::android::hardware::power::stats::AdaptiveDvfsStateResidencyDataProvider;
-using aidl::android::hardware::power::stats::AocStateResidencyDataProvider;
-using aidl::android::hardware::power::stats::CpupmStateResidencyDataProvider;
+using aidl::android::hardware::power::stats::AocResidencySnapshot;
+using aidl::android::hardware::power::stats::AocSnapshotStateResidencyDataProvider;
+using aidl::android::hardware::power::stats::CachingEnergyConsumer;
+using aidl::android::hardware::power::stats::CachingStateResidencyDataProvider;
+using aidl::android::hardware::power::stats::CounterTracer;
+using aidl::android::hardware::power::stats::CpuIdleStateResidencyDataProvider;
 using aidl::android::hardware::power::stats::DevfreqStateResidencyDataProvider;
 using aidl::android::hardware::power::stats::DvfsStateResidencyDataProvider;
 using aidl::android::hardware::power::stats::UfsStateResidencyDataProvider;
 using aidl::android::hardware::power::stats::EnergyConsumerType;
 using aidl::android::hardware::power::stats::GenericStateResidencyDataProvider;
+using aidl::android::hardware::power::stats::makeFreqCoeffTable;
 using aidl::android::hardware::power::stats::IioEnergyMeterDataProvider;
+using aidl::android::hardware::power::stats::LazyEnergyMeterDataProvider;
+using aidl::android::hardware::power::stats::LazyStateResidencyDataProvider;
+using aidl::android::hardware::power::stats::LinkIdleStateResidencyDataProvider;
+using aidl::android::hardware::power::stats::OdpmSampler;
 using aidl::android::hardware::power::stats::PixelStateResidencyDataProvider;
+using aidl::android::hardware::power::stats::PowerStatsJournal;
 using aidl::android::hardware::power::stats::PowerStatsEnergyConsumer;
+using aidl::android::hardware::power::stats::ProfilingEnergyConsumer;
+using aidl::android::hardware::power::stats::ProfilingStateResidencyDataProvider;
+using aidl::android::hardware::power::stats::ProviderLayout;
+using aidl::android::hardware::power::stats::SharedResidencyDataProvider;
+using aidl::android::hardware::power::stats::State;
 using aidl::android::hardware::power::stats::TpuDvfsStateResidencyDataProvider;
+using aidl::android::hardware::power::stats::UidAttrEnergyConsumer;
+using aidl::android::hardware::power::stats::WifiBtEnergyAttribution;
+using aidl::android::hardware::power::stats::WifiBtEnergyConsumer;
+
+// Staleness window of the optional result cache. 0, the default, disables caching.
+static std::chrono::milliseconds getCacheWindow() {
+    static const std::chrono::milliseconds window(android::base::GetUintProperty<uint32_t>(
+            "persist.vendor.powerstats.cache_window_ms", 0));
+    return window;
+}
 
-// TODO (b/181070764) (b/182941084):
-// Remove this when Wifi/BT energy consumption models are available or revert before ship
-using aidl::android::hardware::power::stats::EnergyConsumerResult;
-using aidl::android::hardware::power::stats::Channel;
-using aidl::android::hardware::power::stats::EnergyMeasurement;
-class PlaceholderEnergyConsumer : public PowerStats::IEnergyConsumer {
-  public:
-    PlaceholderEnergyConsumer(std::shared_ptr<PowerStats> p, EnergyConsumerType type,
-            std::string name) : kType(type), kName(name), mPowerStats(p), mChannelId(-1) {
-        std::vector<Channel> channels;
-        mPowerStats->getEnergyMeterInfo(&channels);
-
-        for (const auto &c : channels) {
-            if (c.name == "VSYS_PWR_WLAN_BT") {
-                mChannelId = c.id;
-                break;
-            }
-        }
+// Logs per-provider query latency and syscall counts. Wraps the provider itself, not the
+// cache, so that the reported cost is that of the kernel reads.
+static bool isProfilingEnabled() {
+    static const bool enabled =
+            android::base::GetBoolProperty("persist.vendor.powerstats.profile", false);
+    return enabled;
+}
+
+static void registerStateResidencyDataProvider(std::shared_ptr<PowerStats> p,
+        std::unique_ptr<PowerStats::IStateResidencyDataProvider> sdp) {
+    if (!sdp) {
+        return;
     }
-    std::pair<EnergyConsumerType, std::string> getInfo() override { return {kType, kName}; }
-
-    std::optional<EnergyConsumerResult> getEnergyConsumed() override {
-        int64_t totalEnergyUWs = 0;
-        int64_t timestampMs = 0;
-        if (mChannelId != -1) {
-            std::vector<EnergyMeasurement> measurements;
-            if (mPowerStats->readEnergyMeter({mChannelId}, &measurements).isOk()) {
-                for (const auto &m : measurements) {
-                    totalEnergyUWs += m.energyUWs;
-                    timestampMs = m.timestampMs;
-                }
-            } else {
-                LOG(ERROR) << "Failed to read energy meter";
-                return {};
-            }
-        }
+    if (isProfilingEnabled()) {
+        sdp = std::make_unique<ProfilingStateResidencyDataProvider>(std::move(sdp));
+    }
+    if (getCacheWindow().count() > 0) {
+        sdp = std::make_unique<CachingStateResidencyDataProvider>(std::move(sdp),
+                getCacheWindow());
+    }
+    p->addStateResidencyDataProvider(std::move(sdp));
+}
 
-        return EnergyConsumerResult{.timestampMs = timestampMs,
-                                .energyUWs = totalEnergyUWs>>1};
+static void registerEnergyConsumer(std::shared_ptr<PowerStats> p,
+        std::unique_ptr<PowerStats::IEnergyConsumer> consumer) {
+    if (!consumer) {
+        return;
     }
+    if (isProfilingEnabled()) {
+        consumer = std::make_unique<ProfilingEnergyConsumer>(std::move(consumer));
+    }
+    if (getCacheWindow().count() > 0) {
+        consumer = std::make_unique<CachingEnergyConsumer>(std::move(consumer), getCacheWindow());
+    }
+    p->addEnergyConsumer(std::move(consumer));
+}
 
-    std::string getConsumerName() override {
-        return kName;
-    };
+// Meter consumers are only registered if this SKU has all of their rails, so looking up the
+// channels waits for the energy meter's background discovery. That discovery overlaps the phases
+// registered before the first meter consumer.
+static void registerMeterConsumer(std::shared_ptr<PowerStats> p, EnergyConsumerType type,
+        const std::string &name, const std::set<std::string> &channels) {
+    registerEnergyConsumer(p,
+            PowerStatsEnergyConsumer::createMeterConsumer(p, type, name, channels));
+}
 
-  private:
-    const EnergyConsumerType kType;
-    const std::string kName;
-    std::shared_ptr<PowerStats> mPowerStats;
-    int32_t mChannelId;
-};
+void addWifiBtEnergyConsumers(std::shared_ptr<PowerStats> p) {
+    // WiFi and Bluetooth share the VSYS_PWR_WLAN_BT rail. Split it by active residency.
+    const WifiBtEnergyAttribution::Config config = {
+            .railName = "VSYS_PWR_WLAN_BT",
+            .wifiEntity = "WIFI",
+            .wifiActiveStates = {"AWAKE"},
+            .btEntity = "Bluetooth",
+            .btActiveStates = {"Active", "Tx", "Rx"},
+    };
+    auto attribution = std::make_shared<WifiBtEnergyAttribution>(p, config);
+
+    registerEnergyConsumer(p, std::make_unique<WifiBtEnergyConsumer>(attribution,
+            EnergyConsumerType::WIFI, "Wifi"));
+    registerEnergyConsumer(p, std::make_unique<WifiBtEnergyConsumer>(attribution,
+            EnergyConsumerType::BLUETOOTH, "BT"));
+}
 
+// Retained for device trees that still register the WiFi/BT consumers under the old name
 void addPlaceholderEnergyConsumers(std::shared_ptr<PowerStats> p) {
-    p->addEnergyConsumer(
-            std::make_unique<PlaceholderEnergyConsumer>(p, EnergyConsumerType::WIFI, "Wifi"));
-    p->addEnergyConsumer(
-            std::make_unique<PlaceholderEnergyConsumer>(p, EnergyConsumerType::BLUETOOTH, "BT"));
+    addWifiBtEnergyConsumers(p);
 }
 
 void addAoC(std::shared_ptr<PowerStats> p) {
     // AoC clock is synced from "libaoc.c"
     static const uint64_t AOC_CLOCK = 24576;
     std::string base = "/sys/devices/platform/17000000.aoc/";
-    std::string prefix = base + "control/";
+
+    // All AoC residency nodes are read in one batched pass shared by the providers below
+    auto snapshot = std::make_shared<AocResidencySnapshot>(base + "control/");
 
     // Add AoC cores (a32, ff1, hf0, and hf1)
     std::vector<std::pair<std::string, std::string>> coreIds = {
-            {"AoC-A32", prefix + "a32_"},
-            {"AoC-FF1", prefix + "ff1_"},
-            {"AoC-HF1", prefix + "hf1_"},
-            {"AoC-HF0", prefix + "hf0_"},
+            {"AoC-A32", "a32_"},
+            {"AoC-FF1", "ff1_"},
+            {"AoC-HF1", "hf1_"},
+            {"AoC-HF0", "hf0_"},
     };
     std::vector<std::pair<std::string, std::string>> coreStates = {
             {"DWN", "off"}, {"RET", "retention"}, {"WFI", "wfi"}};
-    p->addStateResidencyDataProvider(std::make_unique<AocStateResidencyDataProvider>(coreIds,
-            coreStates, AOC_CLOCK));
+    registerStateResidencyDataProvider(p, std::make_unique<AocSnapshotStateResidencyDataProvider>(
+            snapshot, coreIds, coreStates, AOC_CLOCK));
 
     // Add AoC voltage stats
     std::vector<std::pair<std::string, std::string>> voltageIds = {
-            {"AoC-Voltage", prefix + "voltage_"},
+            {"AoC-Voltage", "voltage_"},
     };
     std::vector<std::pair<std::string, std::string>> voltageStates = {{"NOM", "nominal"},
                                                                       {"SUD", "super_underdrive"},
                                                                       {"UUD", "ultra_underdrive"},
                                                                       {"UD", "underdrive"}};
-    p->addStateResidencyDataProvider(
-            std::make_unique<AocStateResidencyDataProvider>(voltageIds, voltageStates, AOC_CLOCK));
+    registerStateResidencyDataProvider(p, std::make_unique<AocSnapshotStateResidencyDataProvider>(
+            snapshot, voltageIds, voltageStates, AOC_CLOCK));
 
     // Add AoC monitor mode
     std::vector<std::pair<std::string, std::string>> monitorIds = {
-            {"AoC", prefix + "monitor_"},
+            {"AoC", "monitor_"},
     };
     std::vector<std::pair<std::string, std::string>> monitorStates = {
             {"MON", "mode"},
     };
-    p->addStateResidencyDataProvider(
-            std::make_unique<AocStateResidencyDataProvider>(monitorIds, monitorStates, AOC_CLOCK));
+    registerStateResidencyDataProvider(p, std::make_unique<AocSnapshotStateResidencyDataProvider>(
+            snapshot, monitorIds, monitorStates, AOC_CLOCK));
 
     // Add AoC restart count
     const GenericStateResidencyDataProvider::StateResidencyConfig restartCountConfig = {
@@ -160,7 +213,7 @@ void addAoC(std::shared_ptr<PowerStats> p) {
     cfgs.emplace_back(
             generateGenericStateResidencyConfigs(restartCountConfig, restartCountHeaders),
             "AoC-Count", "");
-    p->addStateResidencyDataProvider(std::make_unique<GenericStateResidencyDataProvider>(
+    registerStateResidencyDataProvider(p, std::make_unique<GenericStateResidencyDataProvider>(
             base + "restart_count", cfgs));
 }
 
@@ -176,26 +229,42 @@ void addDvfsStats(std::shared_ptr<PowerStats> p) {
         std::make_pair("MIF",
                 "/sys/devices/platform/17000010.devfreq_mif/devfreq/17000010.devfreq_mif")};
 
-    p->addStateResidencyDataProvider(std::make_unique<AdaptiveDvfsStateResidencyDataProvider>(
+    registerStateResidencyDataProvider(p, std::make_unique<AdaptiveDvfsStateResidencyDataProvider>(
             path, NS_TO_MS, adpCfgs));
 
     std::vector<DvfsStateResidencyDataProvider::Config> cfgs;
-    cfgs.push_back({"AUR", {
-        std::make_pair("1065MHz", "1065000"),
-        std::make_pair("861MHz", "861000"),
-        std::make_pair("713MHz", "713000"),
-        std::make_pair("525MHz", "525000"),
-        std::make_pair("355MHz", "355000"),
-        std::make_pair("256MHz", "256000"),
-        std::make_pair("178MHz", "178000"),
-    }});
-
-    p->addStateResidencyDataProvider(std::make_unique<DvfsStateResidencyDataProvider>(
+    for (const auto &[name, freqs] : ProviderLayout::get().dvfsDomains) {
+        // CPU clusters and MIF are covered by the adaptive provider above, TPU by tpu_usage below
+        if (name == "TPU" || std::any_of(adpCfgs.begin(), adpCfgs.end(),
+                [&name](const auto &c) { return c.first == name; })) {
+            continue;
+        }
+        DvfsStateResidencyDataProvider::Config cfg = {name, {}};
+        for (const auto &freq : freqs) {
+            cfg.states.emplace_back(std::to_string(std::stoul(freq) / 1000) + "MHz", freq);
+        }
+        cfgs.push_back(std::move(cfg));
+    }
+    if (cfgs.empty()) {
+        cfgs.push_back({"AUR", {
+            std::make_pair("1065MHz", "1065000"),
+            std::make_pair("861MHz", "861000"),
+            std::make_pair("713MHz", "713000"),
+            std::make_pair("525MHz", "525000"),
+            std::make_pair("355MHz", "355000"),
+            std::make_pair("256MHz", "256000"),
+            std::make_pair("178MHz", "178000"),
+        }});
+    }
+
+    registerStateResidencyDataProvider(p, std::make_unique<DvfsStateResidencyDataProvider>(
             path, NS_TO_MS, cfgs));
 
     // TPU DVFS
     const int TICK_TO_MS = 100;
-    std::vector<std::string> freqs = {
+    std::vector<std::string> freqs = ProviderLayout::get().tpuFreqs;
+    if (freqs.empty()) {
+        freqs = {
             "1119000",
             "1066000",
             "845000",
@@ -203,8 +272,9 @@ void addDvfsStats(std::shared_ptr<PowerStats> p) {
             "627000",
             "455000",
             "226000"
-    };
-    p->addStateResidencyDataProvider(std::make_unique<TpuDvfsStateResidencyDataProvider>(
+        };
+    }
+    registerStateResidencyDataProvider(p, std::make_unique<TpuDvfsStateResidencyDataProvider>(
             "/sys/devices/platform/1a000000.rio/tpu_usage", freqs, TICK_TO_MS));
 }
 
@@ -275,13 +345,28 @@ void addSoC(std::shared_ptr<PowerStats> p) {
     cfgs.emplace_back(generateGenericStateResidencyConfigs(reqStateConfig, slcReqStateHeaders),
             "SLC-REQ", "SLC_REQ:");
 
-    p->addStateResidencyDataProvider(std::make_unique<GenericStateResidencyDataProvider>(
+    registerStateResidencyDataProvider(p, std::make_unique<GenericStateResidencyDataProvider>(
             "/sys/devices/platform/acpm_stats/soc_stats", cfgs));
 }
 
 void setEnergyMeter(std::shared_ptr<PowerStats> p) {
     std::vector<const std::string> deviceNames { "s2mpg14-odpm", "s2mpg15-odpm" };
-    p->setEnergyMeterDataProvider(std::make_unique<IioEnergyMeterDataProvider>(deviceNames, true));
+    // IIO channel discovery reads sysfs for every ODPM channel. Run it in the background.
+    p->setEnergyMeterDataProvider(std::make_unique<LazyEnergyMeterDataProvider>([deviceNames]() {
+        return std::make_unique<IioEnergyMeterDataProvider>(deviceNames, true);
+    }));
+
+    // Optional high-rate sampling of a few rails for power lab use. The binder path above only
+    // updates at the ODPM's own refresh rate.
+    const uint32_t sampleHz = android::base::GetUintProperty<uint32_t>(
+            "persist.vendor.powerstats.odpm_sample_hz", 0, OdpmSampler::kMaxRateHz);
+    if (sampleHz > 0) {
+        std::vector<std::string> rails = android::base::Split(android::base::GetProperty(
+                "persist.vendor.powerstats.odpm_sample_rails",
+                "S4M_VDD_CPUCL0,S2S_VDD_G3D,S7M_VDD_TPU"), ",");
+        static OdpmSampler sampler({deviceNames.begin(), deviceNames.end()}, rails, sampleHz);
+        sampler.start();
+    }
 }
 
 void addCPUclusters(std::shared_ptr<PowerStats> p) {
@@ -313,62 +398,66 @@ void addCPUclusters(std::shared_ptr<PowerStats> p) {
             name, name);
     }
 
-    p->addStateResidencyDataProvider(std::make_unique<GenericStateResidencyDataProvider>(
+    registerStateResidencyDataProvider(p, std::make_unique<GenericStateResidencyDataProvider>(
             "/sys/devices/platform/acpm_stats/core_stats", cfgs));
 
-    CpupmStateResidencyDataProvider::Config config = {
-        .entities = {
-            std::make_pair("CPU0", "cpu0"),
-            std::make_pair("CPU1", "cpu1"),
-            std::make_pair("CPU2", "cpu2"),
-            std::make_pair("CPU3", "cpu3"),
-            std::make_pair("CPU4", "cpu4"),
-            std::make_pair("CPU5", "cpu5"),
-            std::make_pair("CPU6", "cpu6"),
-            std::make_pair("CPU7", "cpu7"),
-            std::make_pair("CPU8", "cpu8")},
-        .states = {
-            std::make_pair("DOWN", "[state1]")}};
-
-    CpupmStateResidencyDataProvider::SleepConfig sleepConfig = {"LPM:", "SLEEP", "total_time_ns:"};
-
-    p->addStateResidencyDataProvider(std::make_unique<CpupmStateResidencyDataProvider>(
-            "/sys/devices/system/cpu/cpupm/cpupm/time_in_state", config,
-            "/sys/devices/platform/acpm_stats/soc_stats", sleepConfig));
-
-    p->addEnergyConsumer(PowerStatsEnergyConsumer::createMeterConsumer(p,
-            EnergyConsumerType::CPU_CLUSTER, "CPUCL0", {"S4M_VDD_CPUCL0"}));
-    p->addEnergyConsumer(PowerStatsEnergyConsumer::createMeterConsumer(p,
-            EnergyConsumerType::CPU_CLUSTER, "CPUCL1", {"S3M_VDD_CPUCL1"}));
-    p->addEnergyConsumer(PowerStatsEnergyConsumer::createMeterConsumer(p,
-            EnergyConsumerType::CPU_CLUSTER, "CPUCL2", {"S2M_VDD_CPUCL2"}));
+    std::vector<std::string> cpus = ProviderLayout::get().cpus;
+    if (cpus.empty()) {
+        cpus = {"cpu0", "cpu1", "cpu2", "cpu3", "cpu4", "cpu5", "cpu6", "cpu7", "cpu8"};
+    }
+    CpuIdleStateResidencyDataProvider::Config config = {
+        .timeInStatePath = "/sys/devices/system/cpu/cpupm/cpupm/time_in_state",
+        .sleepPath = "/sys/devices/platform/acpm_stats/soc_stats",
+        .sleepSection = "LPM:",
+        .sleepState = "SLEEP",
+        .sleepTimePrefix = "total_time_ns:",
+        .sleepCpuState = "[state1]",
+    };
+    for (const auto &cpu : cpus) {
+        config.cpus.emplace_back(android::base::StringReplace(cpu, "cpu", "CPU", false), cpu);
+    }
+    for (const auto &[header, name] : ProviderLayout::get().cpuStates) {
+        // [state1] has always been reported as DOWN, keep that name for existing consumers
+        config.states.emplace_back(header == "[state1]" ? "DOWN" : name, header);
+    }
+    if (config.states.empty()) {
+        config.states.emplace_back("DOWN", "[state1]");
+    }
+
+    registerStateResidencyDataProvider(p,
+            std::make_unique<CpuIdleStateResidencyDataProvider>(config));
+
+    registerMeterConsumer(p, EnergyConsumerType::CPU_CLUSTER, "CPUCL0", {"S4M_VDD_CPUCL0"});
+    registerMeterConsumer(p, EnergyConsumerType::CPU_CLUSTER, "CPUCL1", {"S3M_VDD_CPUCL1"});
+    registerMeterConsumer(p, EnergyConsumerType::CPU_CLUSTER, "CPUCL2", {"S2M_VDD_CPUCL2"});
 }
 
+constexpr auto kGpuStateCoeffs = makeFreqCoeffTable({
+        {150000,  637},
+        {302000, 1308},
+        {337000, 1461},
+        {376000, 1650},
+        {419000, 1861},
+        {467000, 2086},
+        {521000, 2334},
+        {580000, 2558},
+        {649000, 2886},
+        {723000, 3244},
+        {807000, 3762},
+        {890000, 4333}});
+static_assert(kGpuStateCoeffs.isSorted(), "GPU coefficients must be sorted by frequency");
+
 void addGPU(std::shared_ptr<PowerStats> p) {
     // Add gpu energy consumer
-    std::map<std::string, int32_t> stateCoeffs;
     std::string path = "/sys/devices/platform/1f000000.mali";
 
-    stateCoeffs = {
-        {"150000",  637},
-        {"302000", 1308},
-        {"337000", 1461},
-        {"376000", 1650},
-        {"419000", 1861},
-        {"467000", 2086},
-        {"521000", 2334},
-        {"580000", 2558},
-        {"649000", 2886},
-        {"723000", 3244},
-        {"807000", 3762},
-        {"890000", 4333}};
-
-    p->addEnergyConsumer(PowerStatsEnergyConsumer::createMeterAndAttrConsumer(p,
-            EnergyConsumerType::OTHER, "GPU", {"S2S_VDD_G3D", "S8S_VDD_G3D_L2"},
-            {{UID_TIME_IN_STATE, path + "/uid_time_in_state"}},
-            stateCoeffs));
-
-    p->addStateResidencyDataProvider(std::make_unique<DevfreqStateResidencyDataProvider>("GPU",
+    registerEnergyConsumer(p, std::make_unique<UidAttrEnergyConsumer>(p,
+            EnergyConsumerType::OTHER, "GPU",
+            std::vector<std::string>{"S2S_VDD_G3D", "S8S_VDD_G3D_L2"},
+            path + "/uid_time_in_state",
+            [](uint32_t freqKhz) { return kGpuStateCoeffs.lookup(freqKhz); }));
+
+    registerStateResidencyDataProvider(p, std::make_unique<DevfreqStateResidencyDataProvider>("GPU",
             path));
 }
 
@@ -398,12 +487,20 @@ void addMobileRadio(std::shared_ptr<PowerStats> p)
     cfgs.emplace_back(generateGenericStateResidencyConfigs(powerStateConfig, powerStateHeaders),
             "MODEM", "");
 
-    p->addStateResidencyDataProvider(std::make_unique<GenericStateResidencyDataProvider>(
-            "/sys/devices/platform/cpif/modem/power_stats", cfgs));
+    // Skip reading the modem while its PCIe link has stayed down. The modem still pages with the
+    // link down, so its SLEEP time is not extrapolated.
+    const LinkIdleStateResidencyDataProvider::Config linkIdleConfig = {
+            .linkStatsPath = "/sys/devices/platform/12100000.pcie/power_stats",
+            .sleepStates = {},
+            .maxExtrapolationMs = 60000,
+    };
+    registerStateResidencyDataProvider(p, std::make_unique<LinkIdleStateResidencyDataProvider>(
+            std::make_unique<GenericStateResidencyDataProvider>(
+                    "/sys/devices/platform/cpif/modem/power_stats", cfgs),
+            linkIdleConfig));
 
-    p->addEnergyConsumer(PowerStatsEnergyConsumer::createMeterConsumer(p,
-            EnergyConsumerType::MOBILE_RADIO, "MODEM",
-            {"VSYS_PWR_MODEM", "VSYS_PWR_RFFE", "VSYS_PWR_MMWAVE"}));
+    registerMeterConsumer(p, EnergyConsumerType::MOBILE_RADIO, "MODEM",
+            {"VSYS_PWR_MODEM", "VSYS_PWR_RFFE", "VSYS_PWR_MMWAVE"});
 }
 
 void addGNSS(std::shared_ptr<PowerStats> p)
@@ -435,11 +532,10 @@ void addGNSS(std::shared_ptr<PowerStats> p)
     cfgs.emplace_back(generateGenericStateResidencyConfigs(gnssStateConfig, gnssStateHeaders),
             "GPS", "");
 
-    p->addStateResidencyDataProvider(std::make_unique<GenericStateResidencyDataProvider>(
+    registerStateResidencyDataProvider(p, std::make_unique<GenericStateResidencyDataProvider>(
             "/dev/bbd_pwrstat", cfgs));
 
-    p->addEnergyConsumer(PowerStatsEnergyConsumer::createMeterConsumer(p,
-            EnergyConsumerType::GNSS, "GPS", {"L9S_GNSS_CORE"}));
+    registerMeterConsumer(p, EnergyConsumerType::GNSS, "GPS", {"L9S_GNSS_CORE"});
 }
 
 void addPCIe(std::shared_ptr<PowerStats> p) {
@@ -463,7 +559,7 @@ void addPCIe(std::shared_ptr<PowerStats> p) {
                 "Version: 1"}
     };
 
-    p->addStateResidencyDataProvider(std::make_unique<GenericStateResidencyDataProvider>(
+    registerStateResidencyDataProvider(p, std::make_unique<GenericStateResidencyDataProvider>(
             "/sys/devices/platform/12100000.pcie/power_stats", pcieModemCfgs));
 
     // Add PCIe - WiFi
@@ -472,7 +568,7 @@ void addPCIe(std::shared_ptr<PowerStats> p) {
             "PCIe-WiFi", "Version: 1"}
     };
 
-    p->addStateResidencyDataProvider(std::make_unique<GenericStateResidencyDataProvider>(
+    registerStateResidencyDataProvider(p, std::make_unique<GenericStateResidencyDataProvider>(
             "/sys/devices/platform/13120000.pcie/power_stats", pcieWifiCfgs));
 }
 
@@ -517,12 +613,20 @@ void addWifi(std::shared_ptr<PowerStats> p) {
                 "WIFI-PCIE"}
     };
 
-    p->addStateResidencyDataProvider(std::make_unique<GenericStateResidencyDataProvider>(
-            "/sys/wifi/power_stats", cfgs));
+    // Skip reading the WiFi chip while its PCIe link has stayed down. Firmware still scans with the
+    // link down, so only the link's own L2 time is extrapolated, not ASLEEP.
+    const LinkIdleStateResidencyDataProvider::Config linkIdleConfig = {
+            .linkStatsPath = "/sys/devices/platform/13120000.pcie/power_stats",
+            .sleepStates = {{"WIFI-PCIE", "L2"}},
+            .maxExtrapolationMs = 60000,
+    };
+    registerStateResidencyDataProvider(p, std::make_unique<LinkIdleStateResidencyDataProvider>(
+            std::make_unique<GenericStateResidencyDataProvider>("/sys/wifi/power_stats", cfgs),
+            linkIdleConfig));
 }
 
 void addUfs(std::shared_ptr<PowerStats> p) {
-    p->addStateResidencyDataProvider(std::make_unique<UfsStateResidencyDataProvider>(
+    registerStateResidencyDataProvider(p, std::make_unique<UfsStateResidencyDataProvider>(
             "/sys/bus/platform/devices/13200000.ufs/ufs_stats/"));
 }
 
@@ -546,8 +650,9 @@ void addPowerDomains(std::shared_ptr<PowerStats> p) {
             std::make_pair("ON", ""),
     };
 
-    std::vector<GenericStateResidencyDataProvider::PowerEntityConfig> cfgs;
-    for (std::string name : {
+    std::vector<std::string> names = ProviderLayout::get().powerDomains;
+    if (names.empty()) {
+        names = {
             "pd-tpu",
             "pd-ispfe",
             "pd-eh",
@@ -565,70 +670,73 @@ void addPowerDomains(std::shared_ptr<PowerStats> p) {
             "pd-dpuf0",
             "pd-dpub",
             "pd-embedded_g3d",
-            "pd-g3d"}) {
+            "pd-g3d"};
+    }
+
+    std::vector<GenericStateResidencyDataProvider::PowerEntityConfig> cfgs;
+    for (const std::string &name : names) {
         cfgs.emplace_back(generateGenericStateResidencyConfigs(cpuStateConfig, cpuStateHeaders),
             name, name + ":");
     }
 
-    p->addStateResidencyDataProvider(std::make_unique<GenericStateResidencyDataProvider>(
+    registerStateResidencyDataProvider(p, std::make_unique<GenericStateResidencyDataProvider>(
             "/sys/devices/platform/acpm_stats/pd_stats", cfgs));
 }
 
 void addDevfreq(std::shared_ptr<PowerStats> p) {
-    p->addStateResidencyDataProvider(std::make_unique<DevfreqStateResidencyDataProvider>(
+    registerStateResidencyDataProvider(p, std::make_unique<DevfreqStateResidencyDataProvider>(
             "INT",
             "/sys/devices/platform/17000020.devfreq_int/devfreq/17000020.devfreq_int"));
 
-    p->addStateResidencyDataProvider(std::make_unique<DevfreqStateResidencyDataProvider>(
+    registerStateResidencyDataProvider(p, std::make_unique<DevfreqStateResidencyDataProvider>(
             "INTCAM",
             "/sys/devices/platform/17000030.devfreq_intcam/devfreq/17000030.devfreq_intcam"));
 
-    p->addStateResidencyDataProvider(std::make_unique<DevfreqStateResidencyDataProvider>(
+    registerStateResidencyDataProvider(p, std::make_unique<DevfreqStateResidencyDataProvider>(
             "DISP",
             "/sys/devices/platform/17000040.devfreq_disp/devfreq/17000040.devfreq_disp"));
 
-    p->addStateResidencyDataProvider(std::make_unique<DevfreqStateResidencyDataProvider>(
+    registerStateResidencyDataProvider(p, std::make_unique<DevfreqStateResidencyDataProvider>(
             "CAM",
             "/sys/devices/platform/17000050.devfreq_cam/devfreq/17000050.devfreq_cam"));
 
-    p->addStateResidencyDataProvider(std::make_unique<DevfreqStateResidencyDataProvider>(
+    registerStateResidencyDataProvider(p, std::make_unique<DevfreqStateResidencyDataProvider>(
             "TNR",
             "/sys/devices/platform/17000060.devfreq_tnr/devfreq/17000060.devfreq_tnr"));
 
-    p->addStateResidencyDataProvider(std::make_unique<DevfreqStateResidencyDataProvider>(
+    registerStateResidencyDataProvider(p, std::make_unique<DevfreqStateResidencyDataProvider>(
             "MFC",
             "/sys/devices/platform/17000070.devfreq_mfc/devfreq/17000070.devfreq_mfc"));
 
-    p->addStateResidencyDataProvider(std::make_unique<DevfreqStateResidencyDataProvider>(
+    registerStateResidencyDataProvider(p, std::make_unique<DevfreqStateResidencyDataProvider>(
             "BW",
             "/sys/devices/platform/17000080.devfreq_bw/devfreq/17000080.devfreq_bw"));
 
-    p->addStateResidencyDataProvider(std::make_unique<DevfreqStateResidencyDataProvider>(
+    registerStateResidencyDataProvider(p, std::make_unique<DevfreqStateResidencyDataProvider>(
             "DSU",
             "/sys/devices/platform/17000090.devfreq_dsu/devfreq/17000090.devfreq_dsu"));
 
-    p->addStateResidencyDataProvider(std::make_unique<DevfreqStateResidencyDataProvider>(
+    registerStateResidencyDataProvider(p, std::make_unique<DevfreqStateResidencyDataProvider>(
             "BCI",
             "/sys/devices/platform/170000a0.devfreq_bci/devfreq/170000a0.devfreq_bci"));
 }
 
+// TODO (b/197721618): Measuring the TPU power numbers
+constexpr auto kTpuStateCoeffs = makeFreqCoeffTable({
+        {226000,  10},
+        {455000,  20},
+        {627000,  30},
+        {712000,  40},
+        {845000,  50},
+        {967000,  60},
+        {1119000, 70}});
+static_assert(kTpuStateCoeffs.isSorted(), "TPU coefficients must be sorted by frequency");
+
 void addTPU(std::shared_ptr<PowerStats> p) {
-    std::map<std::string, int32_t> stateCoeffs;
-
-    stateCoeffs = {
-        // TODO (b/197721618): Measuring the TPU power numbers
-        {"226000",  10},
-        {"455000",  20},
-        {"627000",  30},
-        {"712000",  40},
-        {"845000",  50},
-        {"967000",  60},
-        {"1119000", 70}};
-
-    p->addEnergyConsumer(PowerStatsEnergyConsumer::createMeterAndAttrConsumer(p,
-            EnergyConsumerType::OTHER, "TPU", {"S7M_VDD_TPU"},
-            {{UID_TIME_IN_STATE, "/sys/devices/platform/1a000000.rio/tpu_usage"}},
-            stateCoeffs));
+    registerEnergyConsumer(p, std::make_unique<UidAttrEnergyConsumer>(p,
+            EnergyConsumerType::OTHER, "TPU", std::vector<std::string>{"S7M_VDD_TPU"},
+            "/sys/devices/platform/1a000000.rio/tpu_usage",
+            [](uint32_t freqKhz) { return kTpuStateCoeffs.lookup(freqKhz); }));
 }
 
 /**
@@ -638,34 +746,91 @@ void addTPU(std::shared_ptr<PowerStats> p) {
  * vendor service register callbacks to provide state residency data for their given pwoer entity.
  */
 void addPixelStateResidencyDataProvider(std::shared_ptr<PowerStats> p) {
+    const std::unordered_map<std::string, std::vector<State>> entities = {
+            {"Bluetooth", {{0, "Idle"}, {1, "Active"}, {2, "Tx"}, {3, "Rx"}}},
+    };
 
-    auto pixelSdp = std::make_unique<PixelStateResidencyDataProvider>();
-
-    pixelSdp->addEntity("Bluetooth", {{0, "Idle"}, {1, "Active"}, {2, "Tx"}, {3, "Rx"}});
-
-    pixelSdp->start();
-
-    p->addStateResidencyDataProvider(std::move(pixelSdp));
+    // Publishing the vendor service waits on servicemanager, so do it in the background
+    auto callbacks = std::make_unique<LazyStateResidencyDataProvider>(entities, [entities]() {
+        auto pixelSdp = std::make_unique<PixelStateResidencyDataProvider>();
+        for (const auto &[name, states] : entities) {
+            pixelSdp->addEntity(name, states);
+        }
+        pixelSdp->start();
+        return pixelSdp;
+    });
+
+    // Clients that publish through a shared residency block are read without a binder call.
+    // The others keep being served by their callbacks.
+    registerStateResidencyDataProvider(p, std::make_unique<SharedResidencyDataProvider>(
+            "/data/vendor/powerstats/residency", entities, std::move(callbacks)));
 }
 
 void addZumaCommonDataProviders(std::shared_ptr<PowerStats> p) {
-    setEnergyMeter(p);
-
-    addAoC(p);
-    addPixelStateResidencyDataProvider(p);
-    addCPUclusters(p);
-    addSoC(p);
-    addGNSS(p);
-    addMobileRadio(p);
-    addNFC(p);
-    addPCIe(p);
-    addWifi(p);
-    addTPU(p);
-    addUfs(p);
-    addPowerDomains(p);
-    addDvfsStats(p);
-    addDevfreq(p);
-    addGPU(p);
+    using Clock = std::chrono::steady_clock;
+    const std::pair<const char *, void (*)(std::shared_ptr<PowerStats>)> phases[] = {
+            {"EnergyMeter", setEnergyMeter},
+            {"AoC", addAoC},
+            {"Pixel", addPixelStateResidencyDataProvider},
+            {"CPU", addCPUclusters},
+            {"SoC", addSoC},
+            {"GNSS", addGNSS},
+            {"MobileRadio", addMobileRadio},
+            {"NFC", addNFC},
+            {"PCIe", addPCIe},
+            {"Wifi", addWifi},
+            {"TPU", addTPU},
+            {"Ufs", addUfs},
+            {"PowerDomains", addPowerDomains},
+            {"Dvfs", addDvfsStats},
+            {"Devfreq", addDevfreq},
+            {"GPU", addGPU},
+    };
+
+    // Slow resolution work is deferred to background threads or first use, so each phase here
+    // should only cost the registration itself. The exception is the first phase with a meter
+    // consumer, which waits for any energy meter discovery still running.
+    std::string timings;
+    const Clock::time_point start = Clock::now();
+    for (const auto &[name, add] : phases) {
+        const Clock::time_point phaseStart = Clock::now();
+        add(p);
+        timings += android::base::StringPrintf(" %s=%lldus", name,
+                static_cast<long long>(std::chrono::duration_cast<std::chrono::microseconds>(
+                        Clock::now() - phaseStart).count()));
+    }
+    LOG(INFO) << "Providers registered in "
+              << std::chrono::duration_cast<std::chrono::milliseconds>(Clock::now() - start).count()
+              << "ms:" << timings;
+
+    // Optional counter tracks for Perfetto. Only reads anything while the "power" atrace
+    // category is being recorded.
+    const uint32_t tracePeriodMs = android::base::GetUintProperty<uint32_t>(
+            "persist.vendor.powerstats.trace_period_ms", 0);
+    if (tracePeriodMs > 0) {
+        static CounterTracer tracer(p, {
+            .periodMs = tracePeriodMs,
+            .budgetUs = android::base::GetUintProperty<uint32_t>(
+                    "persist.vendor.powerstats.trace_budget_us",
+                    CounterTracer::kDefaultBudgetUs),
+            .entities = {"pd-*", "AoC*", "INT", "INTCAM", "DISP", "CAM", "TNR", "MFC", "BW",
+                         "DSU", "BCI"},
+        });
+        tracer.start();
+    }
+
+    // Cross-reboot history of rail energy and SoC-level residency, read with powerstats_journal
+    const uint32_t journalPeriodS = android::base::GetUintProperty<uint32_t>(
+            "persist.vendor.powerstats.journal_period_s", 300);
+    if (journalPeriodS > 0) {
+        static PowerStatsJournal journal(p, {
+            .path = "/data/vendor/powerstats/journal",
+            .sizeBytes = 1024 * 1024,
+            .periodS = journalPeriodS,
+            .entities = {"LPM", "MIF", "SLC", "CLUSTER*", "AoC*", "MODEM", "WIFI"},
+        });
+        journal.start();
+    }
 }
 
 void addNFC(std::shared_ptr<PowerStats> p) {
@@ -687,14 +852,18 @@ void addNFC(std::shared_ptr<PowerStats> p) {
     cfgs.emplace_back(generateGenericStateResidencyConfigs(nfcStateConfig, nfcStateHeaders),
             "NFC", "NFC subsystem");
 
-    std::string path;
-    struct stat buffer;
-    for (int i = 0; i < 10; i++) {
-        std::string idx = std::to_string(i);
-        path = "/sys/devices/platform/10c80000.hsi2c/i2c-" + idx + "/" + idx + "-0008/power_stats";
-        if (!stat(path.c_str(), &buffer))
-            break;
-    }
-    p->addStateResidencyDataProvider(std::make_unique<GenericStateResidencyDataProvider>(
-            path, cfgs));
+    // The i2c bus number is not fixed, so probe for the node in the background
+    registerStateResidencyDataProvider(p, std::make_unique<LazyStateResidencyDataProvider>(
+            GenericStateResidencyDataProvider("", cfgs).getInfo(), [cfgs]() {
+                std::string path;
+                struct stat buffer;
+                for (int i = 0; i < 10; i++) {
+                    std::string idx = std::to_string(i);
+                    path = "/sys/devices/platform/10c80000.hsi2c/i2c-" + idx + "/" + idx +
+                            "-0008/power_stats";
+                    if (!stat(path.c_str(), &buffer))
+                        break;
+                }
+                return std::make_unique<GenericStateResidencyDataProvider>(path, cfgs);
+            }));
 }
@@ -0,0 +1,64 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <CounterTracer.h>
+#include <PowerStatsAidl.h>
+#include <ZumaCommonDataProviders.h>
+
+#include <benchmark/benchmark.h>
+
+#include <chrono>
+
+using aidl::android::hardware::power::stats::CounterTracer;
+
+namespace {
+
+// One CounterTracer tick over the providers it traces on zuma, on the fake sysfs tree set up by
+// main(). The tracer lengthens its period once ticks keep exceeding budget_us, so "over_budget"
+// is the fraction of ticks that would count towards that.
+void BM_CounterTracerTick(benchmark::State &state) {
+    std::shared_ptr<PowerStats> p = ndk::SharedRefBase::make<PowerStats>();
+    setEnergyMeter(p);
+    addAoC(p);
+    addPowerDomains(p);
+    addDevfreq(p);
+
+    // Same entities as addZumaCommonDataProviders() traces
+    CounterTracer tracer(p, {
+        .periodMs = 1000,
+        .budgetUs = CounterTracer::kDefaultBudgetUs,
+        .entities = {"pd-*", "AoC*", "INT", "INTCAM", "DISP", "CAM", "TNR", "MFC", "BW", "DSU",
+                     "BCI"},
+    });
+    // Builds the counter names and waits for the energy meter
+    tracer.tick();
+
+    uint64_t overBudget = 0;
+    for (auto _ : state) {
+        const auto start = std::chrono::steady_clock::now();
+        tracer.tick();
+        const auto us = std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::steady_clock::now() - start).count();
+        overBudget += (us > CounterTracer::kDefaultBudgetUs) ? 1 : 0;
+    }
+
+    state.counters["budget_us"] = CounterTracer::kDefaultBudgetUs;
+    state.counters["over_budget"] =
+            benchmark::Counter(overBudget, benchmark::Counter::kAvgIterations);
+}
+BENCHMARK(BM_CounterTracerTick)->Unit(benchmark::kMicrosecond);
+
+}  // namespace
@@ -0,0 +1,375 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "FakeSysfs.h"
+
+#include <android-base/file.h>
+#include <android-base/logging.h>
+#include <android-base/stringprintf.h>
+
+#include <errno.h>
+#include <sched.h>
+#include <sys/mount.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <filesystem>
+#include <utility>
+#include <vector>
+
+namespace aidl {
+namespace android {
+namespace hardware {
+namespace power {
+namespace stats {
+
+namespace {
+
+using ::android::base::StringAppendF;
+using ::android::base::StringPrintf;
+
+constexpr char kPlatform[] = "/sys/devices/platform/";
+constexpr char kGnssPath[] = "/dev/bbd_pwrstat";
+constexpr char kDataPath[] = "/data/vendor/powerstats";
+
+const std::vector<std::string> kCpus = {"cpu0", "cpu1", "cpu2", "cpu3", "cpu4",
+                                        "cpu5", "cpu6", "cpu7", "cpu8"};
+
+// Frequencies in kHz, highest first
+const std::vector<std::pair<std::string, std::vector<uint32_t>>> kDvfsDomains = {
+        {"CL0", {1950000, 1704000, 1401000, 1098000, 820000, 574000, 324000}},
+        {"CL1", {2600000, 2253000, 1945000, 1557000, 1197000, 851000, 402000}},
+        {"CL2", {3105000, 2802000, 2367000, 1869000, 1426000, 902000, 500000}},
+        {"MIF", {3744000, 3172000, 2730000, 2288000, 1716000, 1014000, 421000}},
+        {"TPU", {1119000, 1066000, 845000, 712000, 627000, 455000, 226000}},
+        {"AUR", {1065000, 861000, 713000, 525000, 355000, 256000, 178000}},
+};
+
+// Devfreq nodes under /sys/devices/platform, other than the MIF one in kDvfsDomains
+const std::vector<std::string> kDevfreqNodes = {
+        "17000020.devfreq_int", "17000030.devfreq_intcam", "17000040.devfreq_disp",
+        "17000050.devfreq_cam", "17000060.devfreq_tnr",    "17000070.devfreq_mfc",
+        "17000080.devfreq_bw",  "17000090.devfreq_dsu",    "170000a0.devfreq_bci",
+};
+
+const std::vector<uint32_t> kDevfreqFreqs = {664000, 533000, 400000, 333000, 200000, 100000};
+const std::vector<uint32_t> kGpuFreqs = {890000, 723000, 580000, 467000, 376000, 302000, 150000};
+
+const std::vector<std::string> kPowerDomains = {
+        "pd-tpu", "pd-ispfe", "pd-eh", "pd-bw", "pd-aur", "pd-yuvp", "pd-tnr", "pd-rgbp",
+        "pd-mfc", "pd-mcsc", "pd-gse", "pd-gdc", "pd-g2d", "pd-dpuf1", "pd-dpuf0", "pd-dpub",
+        "pd-embedded_g3d", "pd-g3d",
+};
+
+const std::vector<std::pair<std::string, std::vector<std::string>>> kOdpmRails = {
+        {"s2mpg14-odpm", {"S2M_VDD_CPUCL2", "S3M_VDD_CPUCL1", "S4M_VDD_CPUCL0", "S5M_VDD_INT",
+                          "S7M_VDD_TPU", "VSYS_PWR_MODEM", "VSYS_PWR_RFFE", "VSYS_PWR_MMWAVE"}},
+        {"s2mpg15-odpm", {"S1S_VDD_CAM", "S2S_VDD_G3D", "S8S_VDD_G3D_L2", "L9S_GNSS_CORE",
+                          "VSYS_PWR_WLAN_BT", "VSYS_PWR_DISPLAY", "L2S_VDD_AOC_RET",
+                          "S9S_VDD_AOC"}},
+};
+
+// UIDs in the TPU and GPU usage tables
+constexpr int kUsageUids = 64;
+
+// Returns a deterministic counter value for the n-th field of a node
+uint64_t counter(size_t n, uint64_t scale) {
+    return (n + 1) * scale + (n * 7919) % scale;
+}
+
+std::string acpmState(const std::string &prefix, size_t n) {
+    return StringPrintf("  %scount: %llu\n  total_%stime_ns: %llu\n  last_%stime_ns: %llu\n",
+                        prefix.c_str(), static_cast<unsigned long long>(counter(n, 1000)),
+                        prefix.c_str(),
+                        static_cast<unsigned long long>(counter(n, 1000000000)),
+                        prefix.c_str(),
+                        static_cast<unsigned long long>(counter(n, 100000000000)));
+}
+
+// power_stats layout shared by the modem, WiFi and GNSS drivers
+std::string usecState(const std::string &header, size_t n, bool lastEntry) {
+    std::string out = StringPrintf("%s\ncount: %llu\nduration_usec: %llu\n", header.c_str(),
+                                   static_cast<unsigned long long>(counter(n, 1000)),
+                                   static_cast<unsigned long long>(counter(n, 1000000000)));
+    if (lastEntry) {
+        StringAppendF(&out, "last_entry_timestamp_usec: %llu\n",
+                      static_cast<unsigned long long>(counter(n, 100000000000)));
+    }
+    return out;
+}
+
+// power_stats layout shared by the PCIe and NFC drivers
+std::string msecState(const std::string &header, size_t n, uint64_t lastEntryMs) {
+    return StringPrintf("%s\n  Cumulative count: %llu\n  Cumulative duration msec: %llu\n"
+                        "  Last entry timestamp msec: %llu\n",
+                        header.c_str(), static_cast<unsigned long long>(counter(n, 1000)),
+                        static_cast<unsigned long long>(counter(n, 1000000)),
+                        static_cast<unsigned long long>(lastEntryMs));
+}
+
+std::string usageTable(const std::vector<uint32_t> &freqs) {
+    std::string out = "uid:";
+    for (uint32_t f : freqs) {
+        StringAppendF(&out, " %u", f);
+    }
+    out += "\n";
+    for (int uid = 0; uid < kUsageUids; uid++) {
+        StringAppendF(&out, "%d:", uid < 8 ? uid * 1000 : 10000 + uid);
+        for (size_t col = 0; col < freqs.size(); col++) {
+            StringAppendF(&out, " %llu",
+                          static_cast<unsigned long long>(counter(uid * freqs.size() + col, 100)));
+        }
+        out += "\n";
+    }
+    return out;
+}
+
+std::string timeInState(const std::vector<uint32_t> &freqs) {
+    std::string out;
+    for (size_t i = 0; i < freqs.size(); i++) {
+        StringAppendF(&out, "%u %llu\n", freqs[i],
+                      static_cast<unsigned long long>(counter(i, 100000)));
+    }
+    return out;
+}
+
+std::string availableFrequencies(const std::vector<uint32_t> &freqs) {
+    std::string out;
+    for (size_t i = 0; i < freqs.size(); i++) {
+        StringAppendF(&out, "%s%u", i ? " " : "", freqs[i]);
+    }
+    return out + "\n";
+}
+
+bool bindMount(const std::string &source, const std::string &target) {
+    if (mount(source.c_str(), target.c_str(), nullptr, MS_BIND | MS_REC, nullptr) != 0) {
+        PLOG(ERROR) << "Failed to bind " << source << " over " << target;
+        return false;
+    }
+    return true;
+}
+
+}  // namespace
+
+FakeSysfs::~FakeSysfs() {
+    std::error_code ec;
+    std::filesystem::remove_all(kRoot, ec);
+}
+
+bool FakeSysfs::write(const std::string &path, const std::string &data) {
+    const std::string fullPath = kRoot + path;
+    std::error_code ec;
+    std::filesystem::create_directories(std::filesystem::path(fullPath).parent_path(), ec);
+    if (ec || !::android::base::WriteStringToFile(data, fullPath)) {
+        LOG(ERROR) << "Failed to create " << fullPath;
+        return false;
+    }
+    return true;
+}
+
+bool FakeSysfs::create() {
+    const std::string acpm = std::string(kPlatform) + "acpm_stats/";
+    bool ok = true;
+
+    std::string core;
+    for (size_t i = 0; i < 3; i++) {
+        StringAppendF(&core, "CLUSTER%zu\n", i);
+        core += acpmState("down_", i);
+    }
+    ok &= write(acpm + "core_stats", core);
+
+    std::string soc;
+    const std::vector<std::string> powerStates = {"SICD", "SLEEP", "SLEEP_SLCMON", "SLEEP_HSI1ON",
+                                                  "STOP"};
+    const std::vector<std::pair<std::string, std::vector<std::string>>> socSections = {
+            {"LPM:", powerStates},
+            {"MIF:", powerStates},
+            {"MIF_REQ:", {"AOC", "GSA", "TPU", "AUR"}},
+            {"SLC:", powerStates},
+            {"SLC_REQ:", {"AOC"}},
+    };
+    size_t n = 0;
+    for (const auto &[section, states] : socSections) {
+        soc += section + "\n";
+        for (const auto &state : states) {
+            soc += state + "\n";
+            if (section == "LPM:") {
+                StringAppendF(&soc, "  success_count: %llu\n  total_time_ns: %llu\n"
+                              "  last_entry_time_ns: %llu\n",
+                              static_cast<unsigned long long>(counter(n, 1000)),
+                              static_cast<unsigned long long>(counter(n, 1000000000)),
+                              static_cast<unsigned long long>(counter(n, 100000000000)));
+            } else {
+                soc += acpmState(section.find("_REQ") != std::string::npos ? "req_up_" : "down_",
+                                 n);
+            }
+            n++;
+        }
+    }
+    ok &= write(acpm + "soc_stats", soc);
+
+    std::string pd;
+    for (size_t i = 0; i < kPowerDomains.size(); i++) {
+        pd += kPowerDomains[i] + ":\n" + acpmState("on_", i);
+    }
+    ok &= write(acpm + "pd_stats", pd);
+
+    std::string fvp;
+    for (const auto &[name, freqs] : kDvfsDomains) {
+        fvp += name + "\n";
+        for (size_t i = 0; i < freqs.size(); i++) {
+            StringAppendF(&fvp, "%u %llu\n", freqs[i],
+                          static_cast<unsigned long long>(counter(i, 1000000000)));
+        }
+    }
+    ok &= write(acpm + "fvp_stats", fvp);
+
+    // CPU clusters and MIF, read by the adaptive DVFS provider
+    const std::vector<std::pair<std::string, size_t>> policies = {
+            {"/sys/devices/system/cpu/cpufreq/policy0/stats/", 0},
+            {"/sys/devices/system/cpu/cpufreq/policy4/stats/", 1},
+            {"/sys/devices/system/cpu/cpufreq/policy8/stats/", 2},
+            {std::string(kPlatform) + "17000010.devfreq_mif/devfreq/17000010.devfreq_mif/", 3},
+    };
+    for (const auto &[dir, domain] : policies) {
+        const auto &freqs = kDvfsDomains[domain].second;
+        ok &= write(dir + "time_in_state", timeInState(freqs));
+        ok &= write(dir + "available_frequencies", availableFrequencies(freqs));
+    }
+
+    for (const auto &node : kDevfreqNodes) {
+        const std::string dir = std::string(kPlatform) + node + "/devfreq/" + node + "/";
+        ok &= write(dir + "time_in_state", timeInState(kDevfreqFreqs));
+        ok &= write(dir + "available_frequencies", availableFrequencies(kDevfreqFreqs));
+    }
+
+    const std::string gpu = std::string(kPlatform) + "1f000000.mali/";
+    ok &= write(gpu + "time_in_state", timeInState(kGpuFreqs));
+    ok &= write(gpu + "available_frequencies", availableFrequencies(kGpuFreqs));
+    ok &= write(gpu + "uid_time_in_state", usageTable(kGpuFreqs));
+    ok &= write(std::string(kPlatform) + "1a000000.rio/tpu_usage",
+                usageTable(kDvfsDomains[4].second));
+
+    // cpupm residency per idle state, with the names cpuidle gives those states
+    const std::vector<std::pair<std::string, std::string>> cpuStates = {{"[state0]", "WFI"},
+                                                                        {"[state1]", "C2"}};
+    std::string cpupm;
+    for (size_t s = 0; s < cpuStates.size(); s++) {
+        cpupm += cpuStates[s].first + "\n";
+        for (size_t c = 0; c < kCpus.size(); c++) {
+            StringAppendF(&cpupm, "%s %llu %llu\n", kCpus[c].c_str(),
+                          static_cast<unsigned long long>(counter(c + s, 1000000000)),
+                          static_cast<unsigned long long>(counter(c + s, 10000)));
+        }
+        ok &= write(StringPrintf("/sys/devices/system/cpu/cpu0/cpuidle/state%zu/name", s),
+                    cpuStates[s].second + "\n");
+    }
+    ok &= write("/sys/devices/system/cpu/cpupm/cpupm/time_in_state", cpupm);
+
+    const std::string aoc = std::string(kPlatform) + "17000000.aoc/";
+    const std::vector<std::string> aocNodes = {
+            "a32_off", "a32_retention", "a32_wfi", "ff1_off", "ff1_retention", "ff1_wfi",
+            "hf1_off", "hf1_retention", "hf1_wfi", "hf0_off", "hf0_retention", "hf0_wfi",
+            "voltage_nominal", "voltage_super_underdrive", "voltage_ultra_underdrive",
+            "voltage_underdrive", "monitor_mode",
+    };
+    for (size_t i = 0; i < aocNodes.size(); i++) {
+        ok &= write(aoc + "control/" + aocNodes[i],
+                    StringPrintf("Counter: %llu\nCumulative time: %llu\nTime last entered: %llu\n",
+                                 static_cast<unsigned long long>(counter(i, 1000)),
+                                 static_cast<unsigned long long>(counter(i, 1000000000)),
+                                 static_cast<unsigned long long>(counter(i, 100000000000))));
+    }
+    ok &= write(aoc + "restart_count", "2\n");
+
+    // Links are reported up, so the link idle providers read the devices behind them every time
+    for (const auto &node : {"12100000.pcie", "13120000.pcie"}) {
+        ok &= write(std::string(kPlatform) + node + "/power_stats",
+                    "Version: 1\n" + msecState("Link up:", 0, 2000000) +
+                    msecState("Link down:", 1, 1000000));
+    }
+    ok &= write(std::string(kPlatform) + "cpif/modem/power_stats", usecState("SLEEP:", 0, true));
+    ok &= write(std::string(kPlatform) + "10c80000.hsi2c/i2c-0/0-0008/power_stats",
+                "NFC subsystem\n" + msecState("Idle mode:", 0, 3000) +
+                msecState("Active mode:", 1, 2000) +
+                msecState("Active Reader/Writer mode:", 2, 1000));
+
+    std::string wifi = "WIFI\n" + usecState("AWAKE:", 0, true) + usecState("ASLEEP:", 1, true);
+    wifi += "WIFI-PCIE\n";
+    const std::vector<std::string> pcieStates = {"L0:", "L1:", "L1_1:", "L1_2:", "L2:"};
+    for (size_t i = 0; i < pcieStates.size(); i++) {
+        wifi += usecState(pcieStates[i], i, false);
+    }
+    ok &= write("/sys/wifi/power_stats", wifi);
+
+    ok &= write(kGnssPath, usecState("GPS_ON:", 0, true) + usecState("GPS_OFF:", 1, true));
+
+    const std::string ufs = "/sys/bus/platform/devices/13200000.ufs/ufs_stats/";
+    ok &= write(ufs + "hibern8_exit_cnt", "12345\n");
+    ok &= write(ufs + "last_hibern8_enter_time", "987654321\n");
+    ok &= write(ufs + "last_hibern8_exit_time", "987654000\n");
+    ok &= write(ufs + "total_hibern8_time", "123456789\n");
+
+    for (size_t d = 0; d < kOdpmRails.size(); d++) {
+        const auto &[name, rails] = kOdpmRails[d];
+        const std::string dir = StringPrintf("/sys/bus/iio/devices/iio:device%zu/", d);
+        std::string enabled;
+        std::string energy = "t=123456789\n";
+        for (size_t ch = 0; ch < rails.size(); ch++) {
+            StringAppendF(&enabled, "CH%zu[%s]:%s\n", ch, rails[ch].c_str(), rails[ch].c_str());
+            StringAppendF(&energy, "CH%zu(T=123456789)[%s], %llu\n", ch, rails[ch].c_str(),
+                          static_cast<unsigned long long>(counter(ch, 1000000000)));
+        }
+        ok &= write(dir + "name", name + "\n");
+        ok &= write(dir + "enabled_rails", enabled);
+        ok &= write(dir + "energy_value", energy);
+    }
+
+    // Shared residency blocks are looked up here; none exist, so the callbacks serve them
+    std::error_code ec;
+    std::filesystem::create_directories(kRoot + kDataPath + "/residency", ec);
+    return ok && !ec;
+}
+
+bool FakeSysfs::mountOver() {
+    if (unshare(CLONE_NEWNS) != 0) {
+        PLOG(ERROR) << "Failed to create a mount namespace";
+        return false;
+    }
+    // Keep the binds below out of the parent namespace
+    if (mount(nullptr, "/", nullptr, MS_REC | MS_PRIVATE, nullptr) != 0) {
+        PLOG(ERROR) << "Failed to make mounts private";
+        return false;
+    }
+    if (!bindMount(kRoot + "/sys", "/sys")) {
+        return false;
+    }
+    // The GNSS node only exists on devices with the driver loaded; it cannot be created in /dev
+    if (access(kGnssPath, F_OK) == 0 && !bindMount(kRoot + kGnssPath, kGnssPath)) {
+        return false;
+    }
+    if (mkdir(kDataPath, 0770) != 0 && errno != EEXIST) {
+        PLOG(ERROR) << "Failed to create " << kDataPath;
+        return false;
+    }
+    return bindMount(kRoot + kDataPath, kDataPath);
+}
+
+}  // namespace stats
+}  // namespace power
+}  // namespace hardware
+}  // namespace android
+}  // namespace aidl
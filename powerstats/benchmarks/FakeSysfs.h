@@ -0,0 +1,54 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <string>
+
+namespace aidl {
+namespace android {
+namespace hardware {
+namespace power {
+namespace stats {
+
+/**
+ * A generated copy of every node the zuma providers read: acpm_stats, devfreq, cpufreq and cpupm
+ * stats, IIO ODPM, AoC control, PCIe, WiFi, modem, NFC and GNSS power_stats, ufs_stats and the
+ * TPU and GPU usage tables. Values are fixed, so every query parses the same input.
+ *
+ * The providers open absolute paths, so mountOver() moves the calling process into a private mount
+ * namespace and binds the tree over /sys, /dev/bbd_pwrstat and /data/vendor/powerstats. It must be
+ * called before any thread is started and needs CAP_SYS_ADMIN.
+ */
+class FakeSysfs {
+  public:
+    explicit FakeSysfs(std::string root) : kRoot(std::move(root)) {}
+    ~FakeSysfs();
+
+    bool create();
+    bool mountOver();
+
+  private:
+    bool write(const std::string &path, const std::string &data);
+
+    const std::string kRoot;
+};
+
+}  // namespace stats
+}  // namespace power
+}  // namespace hardware
+}  // namespace android
+}  // namespace aidl
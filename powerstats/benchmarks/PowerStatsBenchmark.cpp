@@ -0,0 +1,205 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Query cost of the zuma providers over a generated sysfs tree, see FakeSysfs. Reported per
+ * iteration: wall and CPU time, C++ heap allocations ("allocs") and read/write syscalls
+ * ("syscalls") of the querying thread.
+ *
+ *   adb root && adb shell stop vendor.power.stats
+ *   adb shell /data/benchmarktest64/powerstats_zuma_benchmark/powerstats_zuma_benchmark
+ *
+ * The HAL should be stopped while this runs: the full set publishes the same vendor callback
+ * service as the HAL does.
+ */
+
+#include "FakeSysfs.h"
+
+#include <PowerStatsAidl.h>
+#include <ZumaCommonDataProviders.h>
+
+#include <android-base/logging.h>
+#include <android-base/unique_fd.h>
+#include <benchmark/benchmark.h>
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <atomic>
+
+using aidl::android::hardware::power::stats::EnergyConsumerResult;
+using aidl::android::hardware::power::stats::EnergyMeasurement;
+using aidl::android::hardware::power::stats::FakeSysfs;
+using aidl::android::hardware::power::stats::StateResidencyResult;
+
+namespace {
+
+std::atomic<uint64_t> gAllocs{0};
+
+// Read plus write syscalls of the calling thread so far
+uint64_t threadSyscalls() {
+    char buf[256];
+    android::base::unique_fd fd(open("/proc/thread-self/io", O_RDONLY | O_CLOEXEC));
+    ssize_t len = (fd == -1) ? -1 : TEMP_FAILURE_RETRY(read(fd, buf, sizeof(buf) - 1));
+    if (len <= 0) {
+        return 0;
+    }
+    buf[len] = '\0';
+    uint64_t total = 0;
+    for (const char *field : {"syscr: ", "syscw: "}) {
+        const char *p = strstr(buf, field);
+        total += p ? strtoull(p + strlen(field), nullptr, 10) : 0;
+    }
+    return total;
+}
+
+struct Query {
+    std::vector<StateResidencyResult> residencies;
+    std::vector<EnergyConsumerResult> consumers;
+    std::vector<EnergyMeasurement> measurements;
+
+    // Everything a full dumpsys or a statsd pull reads: all entities, consumers and channels
+    void run(const std::shared_ptr<PowerStats> &p) {
+        residencies.clear();
+        consumers.clear();
+        measurements.clear();
+        p->getStateResidency({}, &residencies);
+        p->getEnergyConsumed({}, &consumers);
+        p->readEnergyMeter({}, &measurements);
+    }
+};
+
+void runQuery(benchmark::State &state, const std::shared_ptr<PowerStats> &p) {
+    Query query;
+    // The first query waits for the providers resolved in the background
+    query.run(p);
+
+    const uint64_t allocs = gAllocs.load(std::memory_order_relaxed);
+    const uint64_t syscalls = threadSyscalls();
+    for (auto _ : state) {
+        query.run(p);
+        benchmark::DoNotOptimize(query.residencies.data());
+    }
+    // Less the read of /proc/thread-self/io itself
+    const uint64_t syscallsUsed = threadSyscalls() - syscalls - 1;
+
+    using benchmark::Counter;
+    state.counters["allocs"] = Counter(gAllocs.load(std::memory_order_relaxed) - allocs,
+                                       Counter::kAvgIterations);
+    state.counters["syscalls"] = Counter(syscallsUsed, Counter::kAvgIterations);
+    // Entities and consumers that returned data, to catch providers that fail on the fake tree
+    state.counters["entities"] = query.residencies.size();
+    state.counters["consumers"] = query.consumers.size();
+}
+
+void BM_Provider(benchmark::State &state, void (*add)(std::shared_ptr<PowerStats>)) {
+    std::shared_ptr<PowerStats> p = ndk::SharedRefBase::make<PowerStats>();
+    // Consumers resolve their rails against the meter, so every provider set has one
+    setEnergyMeter(p);
+    if (add != nullptr) {
+        add(p);
+    }
+    runQuery(state, p);
+}
+
+void BM_Full(benchmark::State &state) {
+    // The tracer and journal started here are static, so the set is only built once
+    static const std::shared_ptr<PowerStats> p = []() {
+        std::shared_ptr<PowerStats> stats = ndk::SharedRefBase::make<PowerStats>();
+        addZumaCommonDataProviders(stats);
+        return stats;
+    }();
+    runQuery(state, p);
+}
+
+}  // namespace
+
+void *operator new(size_t size) {
+    gAllocs.fetch_add(1, std::memory_order_relaxed);
+    void *p = malloc(size ? size : 1);
+    if (p == nullptr) {
+        abort();
+    }
+    return p;
+}
+
+void *operator new[](size_t size) {
+    return operator new(size);
+}
+
+void operator delete(void *p) noexcept {
+    free(p);
+}
+
+void operator delete[](void *p) noexcept {
+    free(p);
+}
+
+void operator delete(void *p, size_t) noexcept {
+    free(p);
+}
+
+void operator delete[](void *p, size_t) noexcept {
+    free(p);
+}
+
+int main(int argc, char **argv) {
+    benchmark::Initialize(&argc, argv);
+
+    android::base::SetMinimumLogSeverity(android::base::WARNING);
+    char root[] = "/data/local/tmp/powerstats_benchmark.XXXXXX";
+    if (mkdtemp(root) == nullptr) {
+        PLOG(ERROR) << "Failed to create the fake sysfs root";
+        return 1;
+    }
+    FakeSysfs sysfs(root);
+    if (!sysfs.create() || !sysfs.mountOver()) {
+        return 1;
+    }
+
+    // One provider set per phase of addZumaCommonDataProviders(), plus the WiFi/BT consumers that
+    // device trees add. The Pixel callback provider is left to the full set since it publishes a
+    // binder service.
+    const std::pair<const char *, void (*)(std::shared_ptr<PowerStats>)> providers[] = {
+            {"EnergyMeter", nullptr},
+            {"AoC", addAoC},
+            {"CPU", addCPUclusters},
+            {"SoC", addSoC},
+            {"GNSS", addGNSS},
+            {"MobileRadio", addMobileRadio},
+            {"NFC", addNFC},
+            {"PCIe", addPCIe},
+            {"Wifi", addWifi},
+            {"WifiBt", addWifiBtEnergyConsumers},
+            {"TPU", addTPU},
+            {"Ufs", addUfs},
+            {"PowerDomains", addPowerDomains},
+            {"Dvfs", addDvfsStats},
+            {"Devfreq", addDevfreq},
+            {"GPU", addGPU},
+    };
+    for (const auto &[name, add] : providers) {
+        benchmark::RegisterBenchmark((std::string("BM_Provider/") + name).c_str(), BM_Provider,
+                                     add);
+    }
+    benchmark::RegisterBenchmark("BM_Full", BM_Full);
+
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+    return 0;
+}
@@ -0,0 +1,113 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <PowerStatsAidl.h>
+#include <android-base/unique_fd.h>
+
+#include <mutex>
+
+namespace aidl {
+namespace android {
+namespace hardware {
+namespace power {
+namespace stats {
+
+/**
+ * Snapshot of every AoC residency node under one control directory. The directory is opened
+ * once and each node keeps its own fd, so a refresh is one pread() per node with no path
+ * lookups. Several providers share one snapshot: a provider only triggers a refresh when it has
+ * already consumed the current snapshot or the snapshot is older than kMaxAgeMs, so the AoC
+ * providers queried back to back in one getStateResidency() call cost a single batched read.
+ */
+class AocResidencySnapshot {
+  public:
+    struct Counters {
+        bool valid;
+        uint64_t count;
+        uint64_t totalTicks;
+        uint64_t lastEntryTicks;
+    };
+
+    static constexpr int64_t kMaxAgeMs = 100;
+
+    explicit AocResidencySnapshot(const std::string &controlDir);
+    ~AocResidencySnapshot() = default;
+
+    // Registers a node relative to the control directory and returns its index
+    size_t addNode(const std::string &name);
+
+    // Returns the current generation, refreshing first if lastSeenGeneration is current or the
+    // snapshot is too old. Must be called with getLock() held.
+    uint64_t acquireLocked(uint64_t lastSeenGeneration);
+    const Counters &getLocked(size_t idx) const { return mCounters[idx]; }
+    std::mutex &getLock() { return mLock; }
+
+  private:
+    struct Node {
+        std::string name;
+        ::android::base::unique_fd fd;
+    };
+
+    void refreshLocked();
+    bool readNodeLocked(Node *node, Counters *counters);
+
+    const std::string kControlDir;
+    ::android::base::unique_fd mDirFd;
+    std::mutex mLock;
+    std::vector<Node> mNodes;
+    std::vector<Counters> mCounters;
+    uint64_t mGeneration;
+    int64_t mRefreshTimeMs;
+};
+
+/**
+ * Drop-in replacement for AocStateResidencyDataProvider that reads through a shared
+ * AocResidencySnapshot. Tick counts are converted to milliseconds with integer division.
+ */
+class AocSnapshotStateResidencyDataProvider : public PowerStats::IStateResidencyDataProvider {
+  public:
+    AocSnapshotStateResidencyDataProvider(
+            std::shared_ptr<AocResidencySnapshot> snapshot,
+            const std::vector<std::pair<std::string, std::string>> &ids,
+            const std::vector<std::pair<std::string, std::string>> &states,
+            const uint64_t aocClock);
+    ~AocSnapshotStateResidencyDataProvider() = default;
+
+    bool getStateResidencies(
+            std::unordered_map<std::string, std::vector<StateResidency>> *residencies) override;
+    std::unordered_map<std::string, std::vector<State>> getInfo() override;
+
+  private:
+    struct Entity {
+        std::string name;
+        // Snapshot node index for each state, in state id order
+        std::vector<size_t> nodes;
+    };
+
+    std::shared_ptr<AocResidencySnapshot> mSnapshot;
+    const std::vector<std::pair<std::string, std::string>> kStates;
+    const uint64_t kAocClock;
+    std::vector<Entity> mEntities;
+    uint64_t mLastGeneration;
+};
+
+}  // namespace stats
+}  // namespace power
+}  // namespace hardware
+}  // namespace android
+}  // namespace aidl
@@ -0,0 +1,119 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <PowerStatsAidl.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <optional>
+
+namespace aidl {
+namespace android {
+namespace hardware {
+namespace power {
+namespace stats {
+
+/**
+ * Result cache shared by the caching wrappers below. A result younger than the staleness window
+ * is served from memory. Concurrent callers that miss the cache while a refresh is already in
+ * flight wait for that refresh and share its result instead of issuing their own kernel reads.
+ */
+template <typename T>
+class SingleFlightCache {
+  public:
+    explicit SingleFlightCache(std::chrono::milliseconds window) : kWindow(window) {}
+
+    // Returns the cached result, or calls fetch() to refresh it. fetch() runs without the lock.
+    template <typename Fetch>
+    std::optional<T> get(Fetch fetch) {
+        std::unique_lock lk(mLock);
+        const uint64_t generation = mGeneration;
+        while (true) {
+            if (mGeneration != generation ||
+                (mHasResult && std::chrono::steady_clock::now() - mTime < kWindow)) {
+                return mResult;
+            }
+            if (!mInFlight) {
+                break;
+            }
+            mCv.wait(lk);
+        }
+
+        mInFlight = true;
+        lk.unlock();
+        std::optional<T> result = fetch();
+        lk.lock();
+
+        mResult = result;
+        mHasResult = true;
+        mTime = std::chrono::steady_clock::now();
+        mGeneration++;
+        mInFlight = false;
+        mCv.notify_all();
+        return result;
+    }
+
+  private:
+    const std::chrono::milliseconds kWindow;
+    std::mutex mLock;
+    std::condition_variable mCv;
+    bool mInFlight = false;
+    bool mHasResult = false;
+    // Incremented after every refresh so waiters can tell that a refresh completed
+    uint64_t mGeneration = 0;
+    std::chrono::steady_clock::time_point mTime;
+    std::optional<T> mResult;
+};
+
+class CachingStateResidencyDataProvider : public PowerStats::IStateResidencyDataProvider {
+  public:
+    CachingStateResidencyDataProvider(
+            std::unique_ptr<PowerStats::IStateResidencyDataProvider> provider,
+            std::chrono::milliseconds window);
+    ~CachingStateResidencyDataProvider() = default;
+
+    bool getStateResidencies(
+            std::unordered_map<std::string, std::vector<StateResidency>> *residencies) override;
+    std::unordered_map<std::string, std::vector<State>> getInfo() override;
+
+  private:
+    std::unique_ptr<PowerStats::IStateResidencyDataProvider> mProvider;
+    SingleFlightCache<std::unordered_map<std::string, std::vector<StateResidency>>> mCache;
+};
+
+class CachingEnergyConsumer : public PowerStats::IEnergyConsumer {
+  public:
+    CachingEnergyConsumer(std::unique_ptr<PowerStats::IEnergyConsumer> consumer,
+                          std::chrono::milliseconds window);
+    ~CachingEnergyConsumer() = default;
+
+    std::pair<EnergyConsumerType, std::string> getInfo() override;
+    std::optional<EnergyConsumerResult> getEnergyConsumed() override;
+    std::string getConsumerName() override;
+
+  private:
+    std::unique_ptr<PowerStats::IEnergyConsumer> mConsumer;
+    SingleFlightCache<EnergyConsumerResult> mCache;
+};
+
+}  // namespace stats
+}  // namespace power
+}  // namespace hardware
+}  // namespace android
+}  // namespace aidl
@@ -0,0 +1,59 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <PowerStatsAidl.h>
+
+namespace aidl {
+namespace android {
+namespace hardware {
+namespace power {
+namespace stats {
+
+// Returns true if name matches one of patterns. A pattern ending in '*' matches a name prefix.
+bool matchesEntityPattern(const std::vector<std::string> &patterns, const std::string &name);
+
+/**
+ * Flat list of counters for every energy meter rail and for each state of the selected power
+ * entities, as sampled by the counter tracer and the journal. Rails are named "rail.<channel>"
+ * and states "<entity>.<state>".
+ *
+ * Providers may be registered after the sampling client is constructed, so the layout is built
+ * on first use rather than at construction time.
+ */
+struct CounterLayout {
+    // Builds the layout from the providers registered with p so far
+    static CounterLayout build(PowerStats *p, const std::vector<std::string> &entityPatterns);
+
+    // Index into counters for a channel, or for a state of an entity. -1 if not laid out.
+    int32_t channelSlot(int32_t channelId) const;
+    int32_t stateSlot(int32_t entityId, int32_t stateId) const;
+
+    std::vector<std::string> counters;
+    // Ids to pass to readEnergyMeter() and getStateResidency()
+    std::vector<int32_t> channelIds;
+    std::vector<int32_t> entityIds;
+    // Indexed by channel id, and by entity id and state id
+    std::vector<int32_t> channelSlots;
+    std::vector<std::vector<int32_t>> stateSlots;
+};
+
+}  // namespace stats
+}  // namespace power
+}  // namespace hardware
+}  // namespace android
+}  // namespace aidl
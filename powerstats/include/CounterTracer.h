@@ -0,0 +1,85 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <CounterLayout.h>
+#include <PowerStatsAidl.h>
+#include <android-base/unique_fd.h>
+
+#include <thread>
+
+namespace aidl {
+namespace android {
+namespace hardware {
+namespace power {
+namespace stats {
+
+/**
+ * Periodically emits energy meter rails and selected state residencies as atrace counters, which
+ * Perfetto records as counter tracks when the "power" atrace category is enabled. Nothing is read
+ * while that category is off. Counter names are built once when tracing is first seen enabled,
+ * and each tick issues one energy meter read and one state residency read.
+ *
+ * The tick's own cost is emitted as the "PowerStats.tickUs" counter. If it exceeds the budget for
+ * several ticks in a row the period is doubled.
+ */
+class CounterTracer {
+  public:
+    // Tick cost allowed by default, see Config::budgetUs
+    static constexpr uint32_t kDefaultBudgetUs = 1000;
+
+    struct Config {
+        uint32_t periodMs;
+        uint32_t budgetUs;
+        // Power entities to trace, see matchesEntityPattern()
+        std::vector<std::string> entities;
+    };
+
+    CounterTracer(std::shared_ptr<PowerStats> p, const Config &config);
+    ~CounterTracer();
+
+    bool start();
+    void stop();
+
+    // Reads and emits every traced counter once on the calling thread. The tracer thread runs
+    // this on each period; benchmarks call it directly.
+    void tick();
+
+  private:
+    void resolve();
+    void tracerThread();
+
+    std::shared_ptr<PowerStats> mPowerStats;
+    const Config kConfig;
+    uint32_t mPeriodMs;
+
+    bool mResolved;
+    CounterLayout mLayout;
+    // Reused across ticks
+    std::vector<EnergyMeasurement> mMeasurements;
+    std::vector<StateResidencyResult> mResidencies;
+
+    ::android::base::unique_fd mTimerFd;
+    ::android::base::unique_fd mStopFd;
+    std::thread mThread;
+};
+
+}  // namespace stats
+}  // namespace power
+}  // namespace hardware
+}  // namespace android
+}  // namespace aidl
@@ -0,0 +1,87 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <PowerStatsAidl.h>
+#include <android-base/unique_fd.h>
+
+#include <mutex>
+
+namespace aidl {
+namespace android {
+namespace hardware {
+namespace power {
+namespace stats {
+
+/**
+ * Reports every cpupm idle state for every CPU. time_in_state lists a "[stateN]" header per idle
+ * state followed by a "cpuN <total time us> [<entry count>]" line per CPU. It is parsed in one
+ * pass into a flat [cpu][state] array, so the cost does not grow with the number of states
+ * queried. SoC sleep is not counted by cpupm, so the SoC sleep time from soc_stats is added to
+ * one configured state of every CPU, the one that has always been reported as DOWN.
+ */
+class CpuIdleStateResidencyDataProvider : public PowerStats::IStateResidencyDataProvider {
+  public:
+    struct Config {
+        std::string timeInStatePath;
+        // Entity name and the CPU token used in time_in_state, e.g. {"CPU0", "cpu0"}
+        std::vector<std::pair<std::string, std::string>> cpus;
+        // State name and the header used in time_in_state, shallowest first
+        std::vector<std::pair<std::string, std::string>> states;
+        // Where to find the total SoC sleep time in ns, e.g. "total_time_ns:" after "SLEEP"
+        // in the "LPM:" section
+        std::string sleepPath;
+        std::string sleepSection;
+        std::string sleepState;
+        std::string sleepTimePrefix;
+        // Header of the state that SoC sleep time is added to, e.g. "[state1]"
+        std::string sleepCpuState;
+    };
+
+    explicit CpuIdleStateResidencyDataProvider(const Config &config);
+    ~CpuIdleStateResidencyDataProvider() = default;
+
+    bool getStateResidencies(
+            std::unordered_map<std::string, std::vector<StateResidency>> *residencies) override;
+    std::unordered_map<std::string, std::vector<State>> getInfo() override;
+
+  private:
+    struct Counter {
+        uint64_t timeUs;
+        uint64_t count;
+    };
+
+    bool readNodeLocked(const std::string &path, ::android::base::unique_fd *fd, size_t *len);
+    bool parseTimeInStateLocked(size_t len);
+    uint64_t parseSleepMsLocked(size_t len) const;
+
+    const Config kConfig;
+    // Index of sleepCpuState in states, or -1 if SoC sleep is not reported
+    const int kSleepStateIndex;
+    std::mutex mLock;
+    ::android::base::unique_fd mTimeInStateFd;
+    ::android::base::unique_fd mSleepFd;
+    std::vector<char> mBuf;
+    // Indexed by cpu * states + state
+    std::vector<Counter> mCounters;
+};
+
+}  // namespace stats
+}  // namespace power
+}  // namespace hardware
+}  // namespace android
+}  // namespace aidl
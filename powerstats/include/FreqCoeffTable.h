@@ -0,0 +1,80 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+namespace aidl {
+namespace android {
+namespace hardware {
+namespace power {
+namespace stats {
+
+struct FreqCoeff {
+    uint32_t freqKhz;
+    int32_t coeff;
+};
+
+/**
+ * Frequency to coefficient table, sorted by frequency at compile time. Lookups are a fixed
+ * number of conditional moves over the table, so per-UID attribution can run over parsed integer
+ * frequencies without string keys or map nodes.
+ */
+template <size_t N>
+struct FreqCoeffTable {
+    static_assert(N > 0, "FreqCoeffTable must not be empty");
+
+    std::array<FreqCoeff, N> entries;
+
+    constexpr bool isSorted() const {
+        for (size_t i = 1; i < N; i++) {
+            if (entries[i - 1].freqKhz >= entries[i].freqKhz) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Returns the coefficient for freqKhz, or 0 if the frequency is not in the table
+    constexpr int32_t lookup(uint32_t freqKhz) const {
+        const FreqCoeff *base = entries.data();
+        size_t n = N;
+        while (n > 1) {
+            const size_t half = n / 2;
+            base = (base[half].freqKhz <= freqKhz) ? base + half : base;
+            n -= half;
+        }
+        return (base->freqKhz == freqKhz) ? base->coeff : 0;
+    }
+};
+
+template <size_t N>
+constexpr FreqCoeffTable<N> makeFreqCoeffTable(const FreqCoeff (&entries)[N]) {
+    FreqCoeffTable<N> table = {};
+    for (size_t i = 0; i < N; i++) {
+        table.entries[i] = entries[i];
+    }
+    return table;
+}
+
+}  // namespace stats
+}  // namespace power
+}  // namespace hardware
+}  // namespace android
+}  // namespace aidl
@@ -0,0 +1,99 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <PowerStatsAidl.h>
+
+#include <functional>
+#include <future>
+#include <mutex>
+
+namespace aidl {
+namespace android {
+namespace hardware {
+namespace power {
+namespace stats {
+
+/**
+ * Holds the result of a provider factory that is started on a background thread at construction.
+ * The factory runs exactly once, and callers block only until it has finished.
+ */
+template <typename T>
+class LazyInstance {
+  public:
+    using Factory = std::function<std::unique_ptr<T>()>;
+
+    explicit LazyInstance(Factory factory)
+        : mPending(std::async(std::launch::async, std::move(factory))) {}
+
+    // Returns nullptr if the factory could not create the instance
+    T *get() {
+        std::scoped_lock lk(mLock);
+        if (mPending.valid()) {
+            mInstance = mPending.get();
+        }
+        return mInstance.get();
+    }
+
+  private:
+    std::mutex mLock;
+    std::future<std::unique_ptr<T>> mPending;
+    std::unique_ptr<T> mInstance;
+};
+
+/**
+ * State residency provider whose entities are described up front, so that it can be registered
+ * immediately, while the provider itself is constructed on a background thread.
+ */
+class LazyStateResidencyDataProvider : public PowerStats::IStateResidencyDataProvider {
+  public:
+    LazyStateResidencyDataProvider(std::unordered_map<std::string, std::vector<State>> info,
+                                   LazyInstance<PowerStats::IStateResidencyDataProvider>::Factory
+                                           factory);
+    ~LazyStateResidencyDataProvider() = default;
+
+    bool getStateResidencies(
+            std::unordered_map<std::string, std::vector<StateResidency>> *residencies) override;
+    std::unordered_map<std::string, std::vector<State>> getInfo() override;
+
+  private:
+    const std::unordered_map<std::string, std::vector<State>> kInfo;
+    LazyInstance<PowerStats::IStateResidencyDataProvider> mProvider;
+};
+
+/**
+ * Energy meter whose channel discovery runs on a background thread.
+ */
+class LazyEnergyMeterDataProvider : public PowerStats::IEnergyMeterDataProvider {
+  public:
+    explicit LazyEnergyMeterDataProvider(
+            LazyInstance<PowerStats::IEnergyMeterDataProvider>::Factory factory);
+    ~LazyEnergyMeterDataProvider() = default;
+
+    ndk::ScopedAStatus readEnergyMeter(const std::vector<int32_t> &in_channelIds,
+                                       std::vector<EnergyMeasurement> *_aidl_return) override;
+    ndk::ScopedAStatus getEnergyMeterInfo(std::vector<Channel> *_aidl_return) override;
+
+  private:
+    LazyInstance<PowerStats::IEnergyMeterDataProvider> mMeter;
+};
+
+}  // namespace stats
+}  // namespace power
+}  // namespace hardware
+}  // namespace android
+}  // namespace aidl
@@ -0,0 +1,98 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <PowerStatsAidl.h>
+#include <dataproviders/GenericStateResidencyDataProvider.h>
+
+#include <mutex>
+
+namespace aidl {
+namespace android {
+namespace hardware {
+namespace power {
+namespace stats {
+
+/**
+ * Wraps the residency provider of a device that sits behind a PCIe link (WiFi, modem) and avoids
+ * reading the device while it is provably asleep. Reading those nodes can wake the link or the
+ * chip just to report that it was sleeping.
+ *
+ * The AP-side PCIe controller stats are cheap to read. The link state is sampled again right
+ * after each real device read, since the read itself may have woken the link. If the link has not
+ * come up since then and is currently down, the device has not been accessed and the cached
+ * device residencies are returned. A real read is still forced once the cache is older than
+ * maxExtrapolationMs to bound any drift.
+ *
+ * A link that is down does not prove that the device behind it is asleep, e.g. a modem still
+ * pages and WiFi firmware still scans. Cached states therefore stay as they were at the last
+ * read, and only sleepStates that the link state does prove accrue the time the link has been
+ * down since the snapshot.
+ */
+class LinkIdleStateResidencyDataProvider : public PowerStats::IStateResidencyDataProvider {
+  public:
+    struct Config {
+        // AP-side PCIe power_stats node for the link in front of the device
+        std::string linkStatsPath;
+        // (entity, state) pairs that the link being down proves, e.g. the device side of the link
+        // itself. Their time accrues while the link stays down.
+        std::vector<std::pair<std::string, std::string>> sleepStates;
+        int64_t maxExtrapolationMs;
+    };
+
+    LinkIdleStateResidencyDataProvider(
+            std::unique_ptr<PowerStats::IStateResidencyDataProvider> device,
+            const Config &config);
+    ~LinkIdleStateResidencyDataProvider() = default;
+
+    bool getStateResidencies(
+            std::unordered_map<std::string, std::vector<StateResidency>> *residencies) override;
+    std::unordered_map<std::string, std::vector<State>> getInfo() override;
+
+  private:
+    struct LinkState {
+        int64_t upCount;
+        int64_t downCount;
+        bool down;
+    };
+
+    bool readLinkState(LinkState *state);
+    // Confirms a snapshot taken while the link was still up once the link is seen down
+    bool isIdleSinceSnapshot(const LinkState &link);
+
+    std::unique_ptr<PowerStats::IStateResidencyDataProvider> mDevice;
+    GenericStateResidencyDataProvider mLink;
+    const Config kConfig;
+
+    std::mutex mLock;
+    bool mHaveSnapshot;
+    // Whether the link has been down since mSnapshotTimeMs
+    bool mSnapshotConfirmed;
+    LinkState mSnapshotLink;
+    // Start of the sleep time credited to the snapshot
+    int64_t mSnapshotTimeMs;
+    int64_t mDeviceReadTimeMs;
+    std::unordered_map<std::string, std::vector<StateResidency>> mSnapshot;
+    // (entity, state id) resolved from kConfig.sleepStates
+    std::vector<std::pair<std::string, int32_t>> mSleepStateIds;
+};
+
+}  // namespace stats
+}  // namespace power
+}  // namespace hardware
+}  // namespace android
+}  // namespace aidl
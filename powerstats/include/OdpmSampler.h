@@ -0,0 +1,138 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <android-base/unique_fd.h>
+
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace aidl {
+namespace android {
+namespace hardware {
+namespace power {
+namespace stats {
+
+/**
+ * Layout of the sample ring shared through the sampler's memfd. The ring has a single writer and
+ * any number of read-only readers. Readers never advance a tail; instead they check the head
+ * before and after copying a slot and drop the slot if the writer may have lapped it:
+ *
+ *   uint64_t h1 = header->head.load(std::memory_order_acquire);
+ *   ... copy slot (i % capacity) for some i < h1 ...
+ *   std::atomic_thread_fence(std::memory_order_acquire);
+ *   uint64_t h2 = header->head.load(std::memory_order_relaxed);
+ *   valid if (h2 - i < capacity)
+ *
+ * The fence keeps the slot reads from being reordered after the second head load, which an
+ * acquire load on its own does not.
+ */
+struct OdpmSampleRing {
+    static constexpr uint32_t kMagic = 0x4f44504d;  // "ODPM"
+    static constexpr uint32_t kVersion = 1;
+    static constexpr size_t kMaxRails = 16;
+    static constexpr size_t kMaxRailNameLen = 32;
+
+    struct Sample {
+        // CLOCK_BOOTTIME at which the sample was taken
+        uint64_t timestampNs;
+        // Accumulated rail energy as reported by the ODPM, indexed like Header::railNames
+        uint64_t energyUWs[kMaxRails];
+    };
+
+    struct Header {
+        uint32_t magic;
+        uint32_t version;
+        uint32_t numRails;
+        // Number of sample slots, always a power of two
+        uint32_t capacity;
+        // Current sampling period. May grow at runtime if sampling exceeds its overhead budget.
+        std::atomic<uint32_t> periodUs;
+        // Number of timer expirations that were skipped because a sample ran late
+        std::atomic<uint32_t> overruns;
+        char railNames[kMaxRails][kMaxRailNameLen];
+        // Total number of samples written. Slot (head - 1) % capacity is the newest.
+        alignas(64) std::atomic<uint64_t> head;
+    };
+
+    static size_t sizeFor(uint32_t capacity) {
+        return sizeof(Header) + static_cast<size_t>(capacity) * sizeof(Sample);
+    }
+};
+
+/**
+ * Samples a subset of ODPM rails at up to 1 kHz into an OdpmSampleRing backed by a sealed memfd.
+ * The IIO energy_value nodes are opened once and re-read with pread() each period, and only the
+ * requested channel lines are parsed. If a sample takes more than kMaxDutyCyclePercent of the
+ * period, the period is doubled so the sampler does not distort the rails it is measuring.
+ */
+class OdpmSampler {
+  public:
+    static constexpr uint32_t kMaxRateHz = 1000;
+    static constexpr uint32_t kMaxDutyCyclePercent = 2;
+    /*
+     * Clients connect to this SOCK_SEQPACKET socket and receive the ring memfd through
+     * SCM_RIGHTS. The memfd is sealed against resizing and new writable mappings, so they can only
+     * map it read-only.
+     */
+    static constexpr char kRingSocketPath[] = "/data/vendor/powerstats/odpm_ring";
+
+    OdpmSampler(const std::vector<std::string> &deviceNames,
+                const std::vector<std::string> &railNames, uint32_t rateHz,
+                uint32_t capacity = 4096);
+    ~OdpmSampler();
+
+    bool start();
+    void stop();
+
+  private:
+    struct Device {
+        ::android::base::unique_fd fd;
+        // For each wanted channel on this device: (line index in energy_value, ring rail index)
+        std::vector<std::pair<size_t, size_t>> channels;
+    };
+
+    bool findDevices();
+    bool createRing();
+    bool createRingSocket();
+    // Hands the ring memfd to one pending client
+    void sendRing();
+    bool sample(OdpmSampleRing::Sample *s);
+    void samplerThread();
+
+    const std::vector<std::string> kDeviceNames;
+    const std::vector<std::string> kRailNames;
+    const uint32_t kRateHz;
+    const uint32_t kCapacity;
+
+    std::vector<Device> mDevices;
+    ::android::base::unique_fd mRingFd;
+    ::android::base::unique_fd mRingSocketFd;
+    ::android::base::unique_fd mTimerFd;
+    ::android::base::unique_fd mStopFd;
+    OdpmSampleRing::Header *mHeader;
+    OdpmSampleRing::Sample *mSamples;
+    std::thread mThread;
+};
+
+}  // namespace stats
+}  // namespace power
+}  // namespace hardware
+}  // namespace android
+}  // namespace aidl
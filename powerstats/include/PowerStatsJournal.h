@@ -0,0 +1,150 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <CounterLayout.h>
+#include <PowerStatsAidl.h>
+#include <android-base/unique_fd.h>
+
+#include <functional>
+#include <thread>
+
+namespace aidl {
+namespace android {
+namespace hardware {
+namespace power {
+namespace stats {
+
+/**
+ * On-disk layout of the power stats journal. The file has a fixed size and starts with a
+ * Header, followed by records packed back to back up to the first zero length:
+ *
+ *   uint32_t length;   // of type + payload
+ *   uint32_t crc32;    // of type + payload
+ *   uint8_t type;
+ *   uint8_t payload[length - 1];
+ *
+ * Payload integers are LEB128 varints; signed values are zigzag encoded first.
+ *   kSchema:   bootId, count, then count length-prefixed counter names
+ *   kKeyframe: realtimeMs, boottimeMs, count, then count absolute values
+ *   kDelta:    the same fields as a keyframe, each as the difference from the previous snapshot
+ *
+ * Every boot starts with a schema followed by a keyframe. A record whose checksum does not match
+ * ends the journal, so a crash or brownout in the middle of an append loses only that record.
+ */
+struct PowerStatsJournalFormat {
+    static constexpr uint32_t kMagic = 0x4c4a5350;  // "PSJL"
+    static constexpr uint32_t kVersion = 1;
+
+    struct Header {
+        uint32_t magic;
+        uint32_t version;
+        uint64_t reserved;
+    };
+
+    enum RecordType : uint8_t {
+        kSchema = 1,
+        kKeyframe = 2,
+        kDelta = 3,
+    };
+
+    static constexpr size_t kRecordHeaderSize = 2 * sizeof(uint32_t);
+};
+
+struct PowerStatsJournalSnapshot {
+    uint64_t bootId;
+    int64_t realtimeMs;
+    int64_t boottimeMs;
+    const std::vector<std::string> *counters;
+    // Indexed like counters
+    const std::vector<int64_t> *values;
+};
+
+// Returns the first 64 bits of the kernel's random boot id, or 0 if it cannot be read
+uint64_t readKernelBootId();
+
+/**
+ * Decodes the journal at path and calls fn for each snapshot, oldest first. Returns false if the
+ * file cannot be read or is not a journal.
+ */
+bool readPowerStatsJournal(const std::string &path,
+                           const std::function<void(const PowerStatsJournalSnapshot &)> &fn);
+
+/**
+ * Periodically appends snapshots of every energy meter rail and of the selected state residencies
+ * to a memory-mapped journal that survives reboots. Snapshots are delta encoded against the
+ * previous one, with a keyframe every kKeyframeInterval snapshots. When the file is full the
+ * older half is compacted away, keeping the schema of the oldest retained keyframe.
+ */
+class PowerStatsJournal {
+  public:
+    static constexpr uint32_t kKeyframeInterval = 32;
+
+    struct Config {
+        std::string path;
+        size_t sizeBytes;
+        uint32_t periodS;
+        // Power entities to record, see matchesEntityPattern()
+        std::vector<std::string> entities;
+    };
+
+    PowerStatsJournal(std::shared_ptr<PowerStats> p, const Config &config);
+    ~PowerStatsJournal();
+
+    bool start();
+    void stop();
+
+  private:
+    // Everything below runs on the journal thread
+    bool openJournal();
+    bool mapFile(::android::base::unique_fd fd);
+    void unmapFile();
+    void syncRange(size_t off, size_t len);
+    bool compact();
+    bool append(PowerStatsJournalFormat::RecordType type, const std::string &payload);
+    void resolve();
+    void snapshot(std::vector<int64_t> *values);
+    void writeSnapshot();
+    void journalThread();
+
+    std::shared_ptr<PowerStats> mPowerStats;
+    const Config kConfig;
+
+    uint8_t *mData;
+    size_t mEnd;
+    uint64_t mBootId;
+
+    bool mResolved;
+    // Snapshot values are indexed by counter slot
+    CounterLayout mLayout;
+
+    bool mSchemaWritten;
+    uint32_t mSinceKeyframe;
+    int64_t mLastRealtimeMs;
+    int64_t mLastBoottimeMs;
+    std::vector<int64_t> mLastValues;
+
+    ::android::base::unique_fd mTimerFd;
+    ::android::base::unique_fd mStopFd;
+    std::thread mThread;
+};
+
+}  // namespace stats
+}  // namespace power
+}  // namespace hardware
+}  // namespace android
+}  // namespace aidl
@@ -0,0 +1,97 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <PowerStatsAidl.h>
+
+#include <mutex>
+
+namespace aidl {
+namespace android {
+namespace hardware {
+namespace power {
+namespace stats {
+
+/**
+ * Per-provider query cost: wall latency and the read/write syscalls issued by the querying
+ * thread, taken from /proc/thread-self/io around each call. A summary is logged every
+ * kReportIntervalQueries queries so provider changes can be compared on a device.
+ */
+class ProviderProfile {
+  public:
+    static constexpr uint64_t kReportIntervalQueries = 100;
+
+    explicit ProviderProfile(std::string name) : kName(std::move(name)) {}
+
+    class Scope {
+      public:
+        explicit Scope(ProviderProfile *profile);
+        ~Scope();
+
+      private:
+        ProviderProfile *mProfile;
+        int64_t mStartNs;
+        uint64_t mStartReads;
+        uint64_t mStartWrites;
+    };
+
+  private:
+    void record(int64_t latencyNs, uint64_t reads, uint64_t writes);
+
+    const std::string kName;
+    std::mutex mLock;
+    uint64_t mQueries = 0;
+    int64_t mTotalNs = 0;
+    int64_t mMaxNs = 0;
+    uint64_t mTotalReads = 0;
+    uint64_t mTotalWrites = 0;
+};
+
+class ProfilingStateResidencyDataProvider : public PowerStats::IStateResidencyDataProvider {
+  public:
+    explicit ProfilingStateResidencyDataProvider(
+            std::unique_ptr<PowerStats::IStateResidencyDataProvider> provider);
+    ~ProfilingStateResidencyDataProvider() = default;
+
+    bool getStateResidencies(
+            std::unordered_map<std::string, std::vector<StateResidency>> *residencies) override;
+    std::unordered_map<std::string, std::vector<State>> getInfo() override;
+
+  private:
+    std::unique_ptr<PowerStats::IStateResidencyDataProvider> mProvider;
+    ProviderProfile mProfile;
+};
+
+class ProfilingEnergyConsumer : public PowerStats::IEnergyConsumer {
+  public:
+    explicit ProfilingEnergyConsumer(std::unique_ptr<PowerStats::IEnergyConsumer> consumer);
+    ~ProfilingEnergyConsumer() = default;
+
+    std::pair<EnergyConsumerType, std::string> getInfo() override;
+    std::optional<EnergyConsumerResult> getEnergyConsumed() override;
+    std::string getConsumerName() override;
+
+  private:
+    std::unique_ptr<PowerStats::IEnergyConsumer> mConsumer;
+    ProviderProfile mProfile;
+};
+
+}  // namespace stats
+}  // namespace power
+}  // namespace hardware
+}  // namespace android
+}  // namespace aidl
@@ -0,0 +1,57 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace aidl {
+namespace android {
+namespace hardware {
+namespace power {
+namespace stats {
+
+/**
+ * Entities and states that the kernel actually reports, discovered from the ACPM, TPU and cpupm
+ * stats nodes and from cpuidle. Discovery runs once per process and the result is cached on /data
+ * keyed by the vendor and kernel builds, so later boots of the same build only read the cache. A
+ * cache that fails validation is ignored and rediscovered.
+ *
+ * Any list that cannot be discovered is left empty and the caller falls back to its defaults.
+ */
+struct ProviderLayout {
+    // Power domains in pd_stats, e.g. "pd-tpu"
+    std::vector<std::string> powerDomains;
+    // DVFS domains in fvp_stats with their frequencies in kHz, e.g. {"AUR", {"1065000", ...}}
+    std::vector<std::pair<std::string, std::vector<std::string>>> dvfsDomains;
+    // TPU frequencies in kHz from the tpu_usage header, highest first
+    std::vector<std::string> tpuFreqs;
+    // CPUs in cpupm time_in_state, e.g. "cpu0"
+    std::vector<std::string> cpus;
+    // Idle state headers in cpupm time_in_state with the matching cpuidle state name, e.g.
+    // {"[state0]", "WFI"}
+    std::vector<std::pair<std::string, std::string>> cpuStates;
+
+    static const ProviderLayout &get();
+};
+
+}  // namespace stats
+}  // namespace power
+}  // namespace hardware
+}  // namespace android
+}  // namespace aidl
@@ -0,0 +1,140 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <PowerStatsAidl.h>
+#include <android-base/unique_fd.h>
+
+#include <atomic>
+#include <mutex>
+
+namespace aidl {
+namespace android {
+namespace hardware {
+namespace power {
+namespace stats {
+
+/**
+ * Residency block shared between the HAL and a user-space client, one file per power entity. The
+ * HAL creates the file and fills in the header; the client maps it and updates the slots in place
+ * under the seqlock, so the HAL can read them without calling back into the client.
+ *
+ * seq is odd while an update is in progress and is bumped twice per update. A block whose seq is
+ * still 0 has never been written, and the HAL keeps using the client's binder callback for it.
+ *
+ * A client holds a shared flock on the file for as long as it has the block open. Once nobody
+ * holds it the HAL resets seq to 0, so a dead client's last values are not reported and a
+ * restarted client, which counts from zero again, starts over from an unwritten block.
+ */
+struct SharedResidencyBlock {
+    static constexpr uint32_t kMagic = 0x52534850;  // "PHSR"
+    static constexpr uint32_t kVersion = 1;
+
+    // One per state, in the order the entity's states are registered
+    struct Slot {
+        std::atomic<int64_t> totalTimeInStateMs;
+        std::atomic<int64_t> totalStateEntryCount;
+        std::atomic<int64_t> lastEntryTimestampMs;
+    };
+
+    uint32_t magic;
+    uint32_t version;
+    // Blocks left over from an earlier boot are reset by the HAL
+    uint64_t bootId;
+    uint32_t stateCount;
+    std::atomic<uint32_t> seq;
+
+    Slot *slots() { return reinterpret_cast<Slot *>(this + 1); }
+
+    static size_t sizeFor(uint32_t stateCount) {
+        return sizeof(SharedResidencyBlock) + stateCount * sizeof(Slot);
+    }
+};
+
+static_assert(std::atomic<uint32_t>::is_always_lock_free &&
+                      std::atomic<int64_t>::is_always_lock_free,
+              "SharedResidencyBlock atomics must be address free");
+
+/**
+ * Client side of a shared residency block. Maps the block that the HAL created for an entity and
+ * publishes residencies into it. The block is locked for the lifetime of the writer.
+ */
+class SharedResidencyWriter {
+  public:
+    // Returns nullptr if the HAL has not created a block for the entity yet
+    static std::unique_ptr<SharedResidencyWriter> open(const std::string &dir,
+                                                       const std::string &entity);
+    ~SharedResidencyWriter();
+
+    uint32_t getStateCount() const { return mBlock->stateCount; }
+    // residencies are indexed like the entity's states. Extra entries are ignored.
+    void publish(const std::vector<StateResidency> &residencies);
+
+  private:
+    SharedResidencyWriter(::android::base::unique_fd fd, SharedResidencyBlock *block, size_t size);
+
+    const ::android::base::unique_fd mFd;
+    SharedResidencyBlock *const mBlock;
+    const size_t mSize;
+};
+
+/**
+ * Reports user-space power entities from their shared residency blocks under dir, creating the
+ * blocks as needed. Entities whose client has never written its block, has exited, or whose
+ * block cannot be read consistently, are served by the fallback provider, which normally wraps
+ * the binder callbacks of PixelStateResidencyDataProvider. Checking for a live client costs one
+ * flock() per entity and query.
+ */
+class SharedResidencyDataProvider : public PowerStats::IStateResidencyDataProvider {
+  public:
+    SharedResidencyDataProvider(
+            std::string dir, std::unordered_map<std::string, std::vector<State>> entities,
+            std::unique_ptr<PowerStats::IStateResidencyDataProvider> fallback);
+    ~SharedResidencyDataProvider();
+
+    bool getStateResidencies(
+            std::unordered_map<std::string, std::vector<StateResidency>> *residencies) override;
+    std::unordered_map<std::string, std::vector<State>> getInfo() override;
+
+  private:
+    struct Entity {
+        std::string name;
+        std::vector<State> states;
+        ::android::base::unique_fd fd;
+        SharedResidencyBlock *block;
+    };
+
+    bool mapBlock(Entity *entity);
+    bool hasWriter(const Entity &entity);
+    bool readBlock(const Entity &entity, std::vector<StateResidency> *residency);
+
+    const std::string kDir;
+    const std::unordered_map<std::string, std::vector<State>> kInfo;
+    const std::unique_ptr<PowerStats::IStateResidencyDataProvider> mFallback;
+    const uint64_t kBootId;
+
+    std::mutex mLock;
+    std::vector<Entity> mEntities;
+    // Reused across queries
+    std::unordered_map<std::string, std::vector<StateResidency>> mFallbackResidencies;
+};
+
+}  // namespace stats
+}  // namespace power
+}  // namespace hardware
+}  // namespace android
+}  // namespace aidl
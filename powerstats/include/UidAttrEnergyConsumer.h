@@ -0,0 +1,104 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <PowerStatsAidl.h>
+#include <android-base/unique_fd.h>
+
+#include <functional>
+#include <mutex>
+
+namespace aidl {
+namespace android {
+namespace hardware {
+namespace power {
+namespace stats {
+
+/**
+ * Energy consumer that measures a set of rails and attributes the energy to UIDs from a
+ * uid_time_in_state style table:
+ *
+ *   uid: <freq0> <freq1> ...
+ *   <uid>: <time0> <time1> ...
+ *
+ * Attribution is incremental. Each UID's weighted time (sum of time * coefficient over all
+ * frequencies) is kept in a flat open-addressing table, the table file is parsed in one pass
+ * into reused buffers, and only UIDs whose weighted time moved since the previous query receive
+ * a share of the rail energy delta.
+ */
+class UidAttrEnergyConsumer : public PowerStats::IEnergyConsumer {
+  public:
+    UidAttrEnergyConsumer(std::shared_ptr<PowerStats> p, EnergyConsumerType type,
+                          std::string name, std::vector<std::string> channelNames,
+                          std::string path, std::function<int32_t(uint32_t)> coeffLookup);
+    ~UidAttrEnergyConsumer() = default;
+
+    std::pair<EnergyConsumerType, std::string> getInfo() override { return {kType, kName}; }
+    std::optional<EnergyConsumerResult> getEnergyConsumed() override;
+    std::string getConsumerName() override { return kName; }
+
+  private:
+    static constexpr uint32_t kEmptyUid = UINT32_MAX;
+
+    struct UidEntry {
+        uint32_t uid;
+        uint64_t weightedTime;
+        int64_t energyUWs;
+    };
+
+    struct Moved {
+        size_t slot;
+        uint64_t deltaWeightedTime;
+    };
+
+    void resolveChannelsLocked();
+    bool readTableLocked();
+    bool parseHeaderLocked(const char *line, const char *end);
+    size_t findOrInsertLocked(uint32_t uid);
+    void growLocked();
+    bool attributeLocked(int64_t deltaEnergyUWs);
+
+    std::shared_ptr<PowerStats> mPowerStats;
+    const EnergyConsumerType kType;
+    const std::string kName;
+    const std::vector<std::string> kChannelNames;
+    const std::string kPath;
+    const std::function<int32_t(uint32_t)> kCoeffLookup;
+
+    std::mutex mLock;
+    bool mChannelsResolved;
+    std::vector<int32_t> mChannelIds;
+    std::vector<EnergyMeasurement> mMeasurements;
+    int64_t mLastEnergyUWs;
+
+    ::android::base::unique_fd mFd;
+    std::vector<char> mBuf;
+    // Header of the table the coefficients were resolved for, and one coefficient per column
+    std::string mHeader;
+    std::vector<int32_t> mColumnCoeffs;
+
+    // Open-addressing table keyed by UID with linear probing. Capacity is a power of two.
+    std::vector<UidEntry> mUids;
+    size_t mUidCount;
+    std::vector<Moved> mMoved;
+};
+
+}  // namespace stats
+}  // namespace power
+}  // namespace hardware
+}  // namespace android
+}  // namespace aidl
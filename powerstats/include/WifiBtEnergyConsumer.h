@@ -0,0 +1,100 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <PowerStatsAidl.h>
+
+#include <mutex>
+
+namespace aidl {
+namespace android {
+namespace hardware {
+namespace power {
+namespace stats {
+
+/**
+ * WiFi and Bluetooth share the VSYS_PWR_WLAN_BT rail. This splits the energy measured on that
+ * rail between the two subsystems in proportion to their active residency over each interval.
+ * The rail channel and the power entity/state ids are resolved once on first use, and the
+ * measurement and residency buffers are reused across queries.
+ */
+class WifiBtEnergyAttribution {
+  public:
+    struct Config {
+        std::string railName;
+        // Power entity and the states counted as active for each subsystem
+        std::string wifiEntity;
+        std::vector<std::string> wifiActiveStates;
+        std::string btEntity;
+        std::vector<std::string> btActiveStates;
+    };
+
+    WifiBtEnergyAttribution(std::shared_ptr<PowerStats> p, const Config &config);
+    ~WifiBtEnergyAttribution() = default;
+
+    std::optional<EnergyConsumerResult> getEnergyConsumed(EnergyConsumerType type);
+
+  private:
+    struct Subsystem {
+        int32_t entityId = -1;
+        std::vector<int32_t> activeStateIds;
+        int64_t lastActiveMs = 0;
+        int64_t energyUWs = 0;
+    };
+
+    void resolveLocked();
+    bool updateLocked();
+    int64_t readActiveMsLocked(const Subsystem &subsystem);
+
+    std::shared_ptr<PowerStats> mPowerStats;
+    const Config kConfig;
+
+    std::mutex mLock;
+    bool mResolved;
+    int32_t mChannelId;
+    Subsystem mWifi;
+    Subsystem mBt;
+    int64_t mLastRailEnergyUWs;
+    int64_t mTimestampMs;
+    // Reused across queries to keep the query path allocation-free
+    std::vector<int32_t> mChannelIds;
+    std::vector<int32_t> mEntityIds;
+    std::vector<EnergyMeasurement> mMeasurements;
+    std::vector<StateResidencyResult> mResidencies;
+};
+
+class WifiBtEnergyConsumer : public PowerStats::IEnergyConsumer {
+  public:
+    WifiBtEnergyConsumer(std::shared_ptr<WifiBtEnergyAttribution> attribution,
+                         EnergyConsumerType type, std::string name);
+    ~WifiBtEnergyConsumer() = default;
+
+    std::pair<EnergyConsumerType, std::string> getInfo() override { return {kType, kName}; }
+    std::optional<EnergyConsumerResult> getEnergyConsumed() override;
+    std::string getConsumerName() override { return kName; }
+
+  private:
+    std::shared_ptr<WifiBtEnergyAttribution> mAttribution;
+    const EnergyConsumerType kType;
+    const std::string kName;
+};
+
+}  // namespace stats
+}  // namespace power
+}  // namespace hardware
+}  // namespace android
+}  // namespace aidl
@@ -35,5 +35,6 @@ void addSoC(std::shared_ptr<PowerStats> p);
 void addTPU(std::shared_ptr<PowerStats> p);
 void addUfs(std::shared_ptr<PowerStats> p);
 void addWifi(std::shared_ptr<PowerStats> p);
+void addWifiBtEnergyConsumers(std::shared_ptr<PowerStats> p);
 void addZumaCommonDataProviders(std::shared_ptr<PowerStats> p);
 void setEnergyMeter(std::shared_ptr<PowerStats> p);
@@ -0,0 +1,56 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Prints the power stats journal as CSV, one row per snapshot, oldest first. A new header row is
+ * printed whenever the boot or the set of recorded counters changes.
+ *
+ * Usage: powerstats_journal [path]
+ */
+
+#include <PowerStatsJournal.h>
+
+#include <inttypes.h>
+#include <stdio.h>
+
+using aidl::android::hardware::power::stats::PowerStatsJournalSnapshot;
+using aidl::android::hardware::power::stats::readPowerStatsJournal;
+
+int main(int argc, char **argv) {
+    const std::string path = (argc > 1) ? argv[1] : "/data/vendor/powerstats/journal";
+
+    bool first = true;
+    uint64_t lastBootId = 0;
+    std::vector<std::string> lastCounters;
+    const bool ok = readPowerStatsJournal(path, [&](const PowerStatsJournalSnapshot &s) {
+        if (first || s.bootId != lastBootId || *s.counters != lastCounters) {
+            printf("# boot %016" PRIx64 "\nrealtime_ms,boottime_ms", s.bootId);
+            for (const auto &name : *s.counters) {
+                printf(",%s", name.c_str());
+            }
+            printf("\n");
+            first = false;
+            lastBootId = s.bootId;
+            lastCounters = *s.counters;
+        }
+        printf("%" PRId64 ",%" PRId64, s.realtimeMs, s.boottimeMs);
+        for (int64_t v : *s.values) {
+            printf(",%" PRId64, v);
+        }
+        printf("\n");
+    });
+    return ok ? 0 : 1;
+}
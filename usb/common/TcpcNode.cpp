@@ -0,0 +1,170 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "android.hardware.usb.tcpc"
+
+#include "TcpcNode.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <utils/Log.h>
+
+namespace aidl {
+namespace android {
+namespace hardware {
+namespace usb {
+
+using ::android::base::unique_fd;
+
+// Sysfs attributes are at most a page
+static constexpr size_t kMaxAttributeSize = 4096;
+
+// The device directory or attribute went away, e.g. because the driver was unbound
+static bool isStaleErrno(int err) {
+    return err == ENOENT || err == ENODEV || err == ESTALE;
+}
+
+TcpcNode::TcpcNode(const std::string &hsi2cPath, const std::string &address)
+    : kHsi2cPath(hsi2cPath), kAddress(address) {}
+
+bool TcpcNode::resolve() {
+    std::scoped_lock lk(mLock);
+
+    return resolveLocked();
+}
+
+void TcpcNode::invalidate() {
+    std::scoped_lock lk(mLock);
+
+    invalidateLocked();
+}
+
+bool TcpcNode::resolveLocked() {
+    DIR *dp;
+    std::string bus;
+
+    if (mDeviceFd.get() != -1)
+        return true;
+
+    dp = opendir(kHsi2cPath.c_str());
+    if (dp == NULL) {
+        ALOGE("Failed to open %s", kHsi2cPath.c_str());
+        return false;
+    }
+
+    struct dirent *ep;
+    while ((ep = readdir(dp))) {
+        if (ep->d_type == DT_DIR && !strncmp(ep->d_name, "i2c-", strlen("i2c-"))) {
+            bus = ep->d_name + strlen("i2c-");
+        }
+    }
+    closedir(dp);
+
+    if (bus.empty()) {
+        ALOGE("No i2c bus under %s", kHsi2cPath.c_str());
+        return false;
+    }
+
+    std::string path = kHsi2cPath + "/i2c-" + bus + "/" + bus + "-" + kAddress;
+    mDeviceFd.reset(open(path.c_str(), O_PATH | O_DIRECTORY | O_CLOEXEC));
+    if (mDeviceFd.get() == -1) {
+        ALOGE("Failed to open %s; errno=%d", path.c_str(), errno);
+        return false;
+    }
+    mDevicePath = path;
+    ALOGI("tcpc located at %s", mDevicePath.c_str());
+    return true;
+}
+
+void TcpcNode::invalidateLocked() {
+    mAttributeFds.clear();
+    mDeviceFd.reset();
+    mDevicePath.clear();
+}
+
+int TcpcNode::attributeFdLocked(const std::string &attribute, int flags) {
+    if (!resolveLocked())
+        return -1;
+
+    unique_fd &fd = mAttributeFds[{attribute, flags}];
+    if (fd.get() == -1) {
+        fd.reset(openat(mDeviceFd.get(), attribute.c_str(), flags | O_CLOEXEC));
+    }
+    return fd.get();
+}
+
+bool TcpcNode::readAttribute(const std::string &attribute, std::string *value) {
+    std::scoped_lock lk(mLock);
+    char buf[kMaxAttributeSize];
+
+    for (int attempt = 0; attempt < 2; attempt++) {
+        int fd = attributeFdLocked(attribute, O_RDONLY);
+        ssize_t n = fd == -1 ? -1 : TEMP_FAILURE_RETRY(pread(fd, buf, sizeof(buf), 0));
+        if (n >= 0) {
+            value->assign(buf, n);
+            return true;
+        }
+        if (!isStaleErrno(errno))
+            break;
+        invalidateLocked();
+    }
+    ALOGE("Failed to read tcpc %s; errno=%d", attribute.c_str(), errno);
+    return false;
+}
+
+bool TcpcNode::writeAttribute(const std::string &attribute, const std::string &value) {
+    std::scoped_lock lk(mLock);
+
+    for (int attempt = 0; attempt < 2; attempt++) {
+        int fd = attributeFdLocked(attribute, O_WRONLY);
+        ssize_t n = fd == -1 ? -1 : TEMP_FAILURE_RETRY(pwrite(fd, value.data(), value.size(), 0));
+        if (n == static_cast<ssize_t>(value.size())) {
+            return true;
+        }
+        if (n >= 0 || !isStaleErrno(errno))
+            break;
+        invalidateLocked();
+    }
+    ALOGE("Failed to write %s to tcpc %s; errno=%d", value.c_str(), attribute.c_str(), errno);
+    return false;
+}
+
+bool TcpcNode::isDevpath(std::string_view devpath) const {
+    // <hsi2cPath without /sys>/i2c-<bus>/<bus>-<address>
+    std::string_view controller = kHsi2cPath;
+    if (controller.substr(0, strlen("/sys")) == "/sys")
+        controller.remove_prefix(strlen("/sys"));
+    if (devpath.substr(0, controller.size()) != controller)
+        return false;
+    devpath.remove_prefix(controller.size());
+    if (devpath.substr(0, strlen("/i2c-")) != "/i2c-")
+        return false;
+    devpath.remove_prefix(strlen("/i2c-"));
+
+    size_t sep = devpath.find('/');
+    if (sep == 0 || sep == std::string_view::npos)
+        return false;
+    std::string_view bus = devpath.substr(0, sep);
+    return devpath.substr(sep + 1) == std::string(bus) + "-" + kAddress;
+}
+
+}  // namespace usb
+}  // namespace hardware
+}  // namespace android
+}  // namespace aidl
@@ -0,0 +1,77 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <android-base/unique_fd.h>
+
+#include <map>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <utility>
+
+namespace aidl {
+namespace android {
+namespace hardware {
+namespace usb {
+
+/*
+ * Sysfs attributes of the TCPC, which sits at <hsi2cPath>/i2c-<bus>/<bus>-<address>. The bus
+ * number is assigned at probe time, so it is discovered by scanning hsi2cPath.
+ *
+ * The scan runs once. The device directory is then held open, and so is every attribute once it
+ * has been accessed. Reads and writes are a single pread()/pwrite() at offset 0, which makes sysfs
+ * regenerate or store the value just like a fresh open would.
+ *
+ * Everything is resolved again after invalidate(), which the owner calls when the TCPC driver
+ * binds or unbinds. An access that fails because the device went away also resolves again once.
+ */
+class TcpcNode {
+  public:
+    // hsi2cPath: i2c controller the TCPC hangs off. address: i2c address of the TCPC, e.g. "0025".
+    TcpcNode(const std::string &hsi2cPath, const std::string &address);
+
+    // Returns false if the TCPC device directory cannot be found
+    bool resolve();
+    // Drops the device directory and every cached attribute
+    void invalidate();
+
+    bool readAttribute(const std::string &attribute, std::string *value);
+    bool writeAttribute(const std::string &attribute, const std::string &value);
+    // Whether devpath, as found in a uevent, is the TCPC device on any bus number
+    bool isDevpath(std::string_view devpath) const;
+
+  private:
+    // All called with mLock held
+    bool resolveLocked();
+    void invalidateLocked();
+    int attributeFdLocked(const std::string &attribute, int flags);
+
+    const std::string kHsi2cPath;
+    const std::string kAddress;
+
+    std::mutex mLock;
+    std::string mDevicePath;
+    ::android::base::unique_fd mDeviceFd;
+    // Indexed by attribute name and O_RDONLY or O_WRONLY
+    std::map<std::pair<std::string, int>, ::android::base::unique_fd> mAttributeFds;
+};
+
+}  // namespace usb
+}  // namespace hardware
+}  // namespace android
+}  // namespace aidl
@@ -17,6 +17,7 @@
 #define LOG_TAG "android.hardware.usb.gadget.aidl-service"
 
 #include "UsbGadget.h"
+#include "TcpcNode.h"
 #include <dirent.h>
 #include <fcntl.h>
 #include <stdio.h>
@@ -39,35 +40,14 @@ namespace gadget {
 using ::android::base::GetBoolProperty;
 using ::android::hardware::google::pixel::usb::kUvcEnabled;
 
-string enabledPath;
 constexpr char kHsi2cPath[] = "/sys/devices/platform/10cb0000.hsi2c";
-constexpr char kI2CPath[] = "/sys/devices/platform/10cb0000.hsi2c/i2c-";
-constexpr char kAccessoryLimitCurrent[] = "-0025/usb_limit_accessory_current";
-constexpr char kAccessoryLimitCurrentEnable[] = "-0025/usb_limit_accessory_enable";
-constexpr char kUpdateSdpEnumTimeout[] = "-0025/update_sdp_enum_timeout";
-
-Status getI2cBusHelper(string *name) {
-    DIR *dp;
-
-    dp = opendir(kHsi2cPath);
-    if (dp != NULL) {
-        struct dirent *ep;
-
-        while ((ep = readdir(dp))) {
-            if (ep->d_type == DT_DIR) {
-                if (string::npos != string(ep->d_name).find("i2c-")) {
-                    std::strtok(ep->d_name, "-");
-                    *name = std::strtok(NULL, "-");
-                }
-            }
-        }
-        closedir(dp);
-        return Status::SUCCESS;
-    }
+constexpr char kTcpcI2cAddress[] = "0025";
+constexpr char kAccessoryLimitCurrent[] = "usb_limit_accessory_current";
+constexpr char kAccessoryLimitCurrentEnable[] = "usb_limit_accessory_enable";
+constexpr char kUpdateSdpEnumTimeout[] = "update_sdp_enum_timeout";
 
-    ALOGE("Failed to open %s", kHsi2cPath);
-    return Status::ERROR;
-}
+// Nothing here listens for uevents, so the node is re-resolved only when an access fails
+TcpcNode tcpcNode(kHsi2cPath, kTcpcI2cAddress);
 
 UsbGadget::UsbGadget() : mGadgetIrqPath("") {
     if (access(OS_DESC_PATH, R_OK) != 0) {
@@ -389,16 +369,8 @@ ScopedAStatus UsbGadget::reset(const shared_ptr<IUsbGadgetCallback> &callback,
 }
 
 void UsbGadget::updateSdpEnumTimeout() {
-    string i2c_node, update_sdp_enum_timeout_path;
-
-    Status status = getI2cBusHelper(&i2c_node);
-    if (status != Status::SUCCESS) {
-        ALOGE("%s: Unable to locate i2c bus node", __func__);
-    }
-
-    update_sdp_enum_timeout_path = kI2CPath + i2c_node + "/" + i2c_node + kUpdateSdpEnumTimeout;
-    if (!WriteStringToFile("1", update_sdp_enum_timeout_path)) {
-        ALOGE("%s: Unable to write to %s.", __func__, update_sdp_enum_timeout_path.c_str());
+    if (!tcpcNode.writeAttribute(kUpdateSdpEnumTimeout, "1")) {
+        ALOGE("%s: Unable to write to %s.", __func__, kUpdateSdpEnumTimeout);
     } else {
         ALOGI("%s: Updated SDP enumeration timeout value.", __func__);
     }
@@ -495,15 +467,9 @@ ScopedAStatus UsbGadget::setCurrentUsbFunctions(long functions,
     std::string current_usb_power_operation_mode, current_usb_type;
     std::string usb_limit_sink_enable;
 
-    string accessoryCurrentLimitEnablePath, accessoryCurrentLimitPath, path;
-
     mCurrentUsbFunctions = functions;
     mCurrentUsbFunctionsApplied = false;
 
-    getI2cBusHelper(&path);
-    accessoryCurrentLimitPath = kI2CPath + path + "/" + path + kAccessoryLimitCurrent;
-    accessoryCurrentLimitEnablePath = kI2CPath + path + "/" + path + kAccessoryLimitCurrentEnable;
-
     // Get the gadget IRQ number before tearDownGadget()
     if (mGadgetIrqPath.empty())
         getUsbGadgetIrqPath();
@@ -563,15 +529,15 @@ ScopedAStatus UsbGadget::setCurrentUsbFunctions(long functions,
         current_usb_type == "Unknown SDP [CDP] DCP" &&
         (current_usb_power_operation_mode == "default" ||
         current_usb_power_operation_mode == "1.5A")) {
-        if (!WriteStringToFile("1300000", accessoryCurrentLimitPath)) {
+        if (!tcpcNode.writeAttribute(kAccessoryLimitCurrent, "1300000")) {
             ALOGI("Write 1.3A to limit current fail");
         } else {
-            if (!WriteStringToFile("1", accessoryCurrentLimitEnablePath)) {
+            if (!tcpcNode.writeAttribute(kAccessoryLimitCurrentEnable, "1")) {
                 ALOGI("Enable limit current fail");
             }
         }
     } else {
-        if (!WriteStringToFile("0", accessoryCurrentLimitEnablePath))
+        if (!tcpcNode.writeAttribute(kAccessoryLimitCurrentEnable, "0"))
             ALOGI("unvote accessory limit current failed");
     }
 
@@ -0,0 +1,293 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "android.hardware.usb.aidl-service"
+
+#include "DisplayPortStateMachine.h"
+
+#include <android-base/parseint.h>
+#include <android-base/stringprintf.h>
+#include <android-base/strings.h>
+#include <inttypes.h>
+#include <string.h>
+#include <utils/Log.h>
+
+namespace aidl {
+namespace android {
+namespace hardware {
+namespace usb {
+
+using ::android::base::ParseUint;
+using ::android::base::StringAppendF;
+using ::android::base::Trim;
+using std::string;
+
+const char *displayPortStateName(DisplayPortState state) {
+    switch (state) {
+        case DisplayPortState::IDLE:
+            return "IDLE";
+        case DisplayPortState::BOUND:
+            return "BOUND";
+        case DisplayPortState::PIN_SET:
+            return "PIN_SET";
+        case DisplayPortState::HPD_HIGH:
+            return "HPD_HIGH";
+        case DisplayPortState::LINK_OK:
+            return "LINK_OK";
+        case DisplayPortState::LINK_FAIL:
+            return "LINK_FAIL";
+    }
+    return "UNKNOWN";
+}
+
+const char *displayPortStageName(int stage) {
+    switch (stage) {
+        case DISPLAYPORT_STAGE_BOUND:
+            return "bound";
+        case DISPLAYPORT_STAGE_PIN_SET:
+            return "pin_set";
+        case DISPLAYPORT_STAGE_ORIENTATION_SET:
+            return "orientation_set";
+        case DISPLAYPORT_STAGE_HPD_HIGH:
+            return "hpd_high";
+        case DISPLAYPORT_STAGE_LINK_TRAINED:
+            return "link_trained";
+        case DISPLAYPORT_STAGE_IRQ_HPD:
+            return "irq_hpd";
+        case DISPLAYPORT_STAGE_ACTIVATE_CHECK:
+            return "activate_check";
+        case DISPLAYPORT_STAGE_NOTIFY:
+            return "notify";
+    }
+    return "unknown";
+}
+
+DisplayPortStateMachine::DisplayPortStateMachine(AttributeReader reader, DrmWriter writer)
+    : mReader(std::move(reader)),
+      mWriter(std::move(writer)),
+      mState(DisplayPortState::IDLE),
+      mOrientationSet(false),
+      mIrqHpdCountCache(0) {}
+
+void DisplayPortStateMachine::recordStage(DisplayPortStage stage,
+                                          std::chrono::steady_clock::time_point since) {
+    const int64_t ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - since).count();
+
+    mLatency[stage].record(ms);
+    ALOGI("usbdp: worker: %s after %" PRId64 " ms", displayPortStageName(stage), ms);
+}
+
+string DisplayPortStateMachine::dumpLatency() const {
+    string out;
+
+    for (int stage = 0; stage < DISPLAYPORT_STAGE_COUNT; stage++) {
+        StringAppendF(&out, "  %-16s %s\n", displayPortStageName(stage),
+                      mLatency[stage].toString().c_str());
+    }
+    return out;
+}
+
+void DisplayPortStateMachine::setState(DisplayPortState state) {
+    if (mState == state) {
+        return;
+    }
+    ALOGI("usbdp: worker: %s -> %s", displayPortStateName(mState), displayPortStateName(state));
+    switch (state) {
+        case DisplayPortState::BOUND:
+            recordStage(DISPLAYPORT_STAGE_BOUND, mBindTime);
+            break;
+        case DisplayPortState::PIN_SET:
+            // Not when hpd drops again
+            if (mState == DisplayPortState::BOUND) {
+                recordStage(DISPLAYPORT_STAGE_PIN_SET, mBindTime);
+            }
+            break;
+        case DisplayPortState::HPD_HIGH:
+            recordStage(DISPLAYPORT_STAGE_HPD_HIGH, mBindTime);
+            mHpdHighTime = std::chrono::steady_clock::now();
+            break;
+        case DisplayPortState::LINK_OK:
+        case DisplayPortState::LINK_FAIL:
+            if (mState == DisplayPortState::HPD_HIGH) {
+                recordStage(DISPLAYPORT_STAGE_LINK_TRAINED, mHpdHighTime);
+            }
+            break;
+        case DisplayPortState::IDLE:
+            break;
+    }
+    mState = state;
+}
+
+bool DisplayPortStateMachine::pinSet() const {
+    return mState != DisplayPortState::IDLE && mState != DisplayPortState::BOUND;
+}
+
+bool DisplayPortStateMachine::writeDrmAttribute(const string &attribute, const string &value) {
+    auto cached = mDrmValues.find(attribute);
+    if (cached != mDrmValues.end() && cached->second == Trim(value)) {
+        ALOGI("usbdp: Skipping %s write, drm already has %s", attribute.c_str(), value.c_str());
+        return true;
+    }
+
+    if (!mWriter(attribute, value)) {
+        ALOGE("usbdp: Failed to write attribute %s to drm: %s", attribute.c_str(), value.c_str());
+        // The drm side is unknown now
+        mDrmValues.erase(attribute);
+        return false;
+    }
+    ALOGI("usbdp: Successfully wrote attribute %s: %s to drm.", attribute.c_str(), value.c_str());
+    mDrmValues[attribute] = Trim(value);
+    return true;
+}
+
+bool DisplayPortStateMachine::writeAttribute(const string &attribute, string attrUsb) {
+    if (attribute == "pin_assignment") {
+        size_t pos = attrUsb.find("[");
+        if (pos != string::npos) {
+            ALOGI("usbdp: Modifying Pin Config from %s", attrUsb.c_str());
+            attrUsb = attrUsb.substr(pos + 1, 1);
+        } else {
+            // Don't write anything
+            ALOGI("usbdp: Pin config not yet chosen, nothing written.");
+            return false;
+        }
+    }
+
+    return writeDrmAttribute(attribute, attrUsb);
+}
+
+void DisplayPortStateMachine::bind(std::chrono::steady_clock::time_point since) {
+    mBindTime = since;
+    // The drm driver may have been reset in between, so the first write of everything goes through
+    mDrmValues.clear();
+    // A new partner starts its own irq_hpd sequence, so its first count is forwarded even if it
+    // matches the last one of the previous partner
+    mIrqHpdCountCache = 0;
+    mOrientationSet = false;
+    setState(DisplayPortState::BOUND);
+}
+
+void DisplayPortStateMachine::unbind() {
+    if (mState == DisplayPortState::IDLE) {
+        return;
+    }
+    writeDrmAttribute("hpd", "0");
+    setState(DisplayPortState::IDLE);
+}
+
+bool DisplayPortStateMachine::attributeChanged(DisplayPortAttribute attribute) {
+    string hpd, pinAssignment, orientation, linkStatus;
+
+    // The attribute fired just before the partner went away
+    if (mState == DisplayPortState::IDLE) {
+        return false;
+    }
+
+    switch (attribute) {
+        case DisplayPortAttribute::HPD:
+            if (!mReader(DisplayPortAttribute::HPD, &hpd)) {
+                break;
+            }
+            if (!pinSet() || !mOrientationSet) {
+                ALOGW("usbdp: worker: HPD may be set before pin_assignment and orientation");
+                if (!pinSet() && mReader(DisplayPortAttribute::PIN_ASSIGNMENT, &pinAssignment) &&
+                    writeAttribute("pin_assignment", pinAssignment)) {
+                    setState(DisplayPortState::PIN_SET);
+                }
+                if (!mOrientationSet && mReader(DisplayPortAttribute::ORIENTATION, &orientation) &&
+                    writeAttribute("orientation", orientation)) {
+                    mOrientationSet = true;
+                    recordStage(DISPLAYPORT_STAGE_ORIENTATION_SET, mBindTime);
+                }
+            }
+            writeAttribute("hpd", hpd);
+            if (!strncmp(hpd.c_str(), "1", strlen("1"))) {
+                if (mState == DisplayPortState::PIN_SET) {
+                    setState(DisplayPortState::HPD_HIGH);
+                }
+            } else if (pinSet()) {
+                setState(DisplayPortState::PIN_SET);
+            }
+            break;
+        case DisplayPortAttribute::PIN_ASSIGNMENT:
+            if (!mReader(DisplayPortAttribute::PIN_ASSIGNMENT, &pinAssignment) ||
+                !writeAttribute("pin_assignment", pinAssignment)) {
+                return false;
+            }
+            if (mState == DisplayPortState::BOUND) {
+                setState(DisplayPortState::PIN_SET);
+            }
+            break;
+        case DisplayPortAttribute::ORIENTATION:
+            if (!mReader(DisplayPortAttribute::ORIENTATION, &orientation) ||
+                !writeAttribute("orientation", orientation)) {
+                return false;
+            }
+            if (!mOrientationSet) {
+                mOrientationSet = true;
+                recordStage(DISPLAYPORT_STAGE_ORIENTATION_SET, mBindTime);
+            }
+            break;
+        case DisplayPortAttribute::LINK_STATUS:
+            if (!mReader(DisplayPortAttribute::LINK_STATUS, &linkStatus)) {
+                break;
+            }
+            // Link training only happens while hpd is high
+            if (mState != DisplayPortState::HPD_HIGH && mState != DisplayPortState::LINK_OK &&
+                mState != DisplayPortState::LINK_FAIL) {
+                break;
+            }
+            linkStatus = Trim(linkStatus);
+            if (linkStatus == LINK_TRAINING_STATUS_SUCCESS) {
+                setState(DisplayPortState::LINK_OK);
+            } else if (linkStatus == LINK_TRAINING_STATUS_FAILURE ||
+                       linkStatus == LINK_TRAINING_STATUS_FAILURE_SINK) {
+                setState(DisplayPortState::LINK_FAIL);
+            }
+            break;
+    }
+    mChangeTime = std::chrono::steady_clock::now();
+    return true;
+}
+
+void DisplayPortStateMachine::irqHpd(const string &irqHpdCount,
+                                     std::chrono::steady_clock::time_point since) {
+    uint32_t count;
+
+    if (!ParseUint(Trim(irqHpdCount), &count)) {
+        ALOGE("usbdp: failed parsing irq_hpd_count:%s", irqHpdCount.c_str());
+        return;
+    }
+    ALOGI("usbdp: mIrqHpdCountCache:%u irq_hpd_count:%u", mIrqHpdCountCache, count);
+    if (mIrqHpdCountCache == count) {
+        return;
+    }
+    mIrqHpdCountCache = count;
+
+    // Every irq_hpd is an event of its own, so it bypasses the drm value cache
+    if (!mWriter("irq_hpd", irqHpdCount)) {
+        ALOGE("usbdp: Failed to write irq_hpd to drm: %s", irqHpdCount.c_str());
+        return;
+    }
+    ALOGI("usbdp: Successfully wrote irq_hpd: %s to drm.", irqHpdCount.c_str());
+    recordStage(DISPLAYPORT_STAGE_IRQ_HPD, since);
+}
+
+}  // namespace usb
+}  // namespace hardware
+}  // namespace android
+}  // namespace aidl
@@ -0,0 +1,156 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#include <chrono>
+#include <functional>
+#include <string>
+#include <unordered_map>
+
+#include "LatencyHistogram.h"
+
+#define LINK_TRAINING_STATUS_UNKNOWN "0"
+#define LINK_TRAINING_STATUS_SUCCESS "1"
+#define LINK_TRAINING_STATUS_FAILURE "2"
+#define LINK_TRAINING_STATUS_FAILURE_SINK "3"
+
+namespace aidl {
+namespace android {
+namespace hardware {
+namespace usb {
+
+/*
+ * DisplayPort worker states. The worker is armed when the displayport driver binds to the partner
+ * and disarmed when the partner goes away.
+ */
+enum class DisplayPortState {
+    // Nothing armed
+    IDLE,
+    // Watching the partner's sysfs nodes, pin assignment not chosen yet
+    BOUND,
+    // pin_assignment forwarded to the drm driver
+    PIN_SET,
+    // hpd high forwarded to the drm driver
+    HPD_HIGH,
+    LINK_OK,
+    LINK_FAIL,
+};
+
+// sysfs nodes the DisplayPort worker forwards to the drm driver
+enum class DisplayPortAttribute {
+    HPD,
+    PIN_ASSIGNMENT,
+    ORIENTATION,
+    LINK_STATUS,
+};
+
+/*
+ * Stages of a DisplayPort bring-up, each with its own latency histogram. Unless noted otherwise a
+ * stage is measured from the displayport driver binding to the partner.
+ */
+enum DisplayPortStage {
+    // Watching the partner's sysfs nodes
+    DISPLAYPORT_STAGE_BOUND,
+    DISPLAYPORT_STAGE_PIN_SET,
+    DISPLAYPORT_STAGE_ORIENTATION_SET,
+    DISPLAYPORT_STAGE_HPD_HIGH,
+    // From hpd high to link_status reporting success or failure
+    DISPLAYPORT_STAGE_LINK_TRAINED,
+    // From the tcpc uevent to irq_hpd reaching the drm driver
+    DISPLAYPORT_STAGE_IRQ_HPD,
+    // Each Alt Mode activate check, DISPLAYPORT_ACTIVATE_DEBOUNCE_MS apart
+    DISPLAYPORT_STAGE_ACTIVATE_CHECK,
+    // From the last attribute change to the framework notification, after
+    // DISPLAYPORT_STATUS_DEBOUNCE_MS
+    DISPLAYPORT_STAGE_NOTIFY,
+    DISPLAYPORT_STAGE_COUNT,
+};
+
+const char *displayPortStateName(DisplayPortState state);
+const char *displayPortStageName(int stage);
+
+/*
+ * Forwards the partner's DisplayPort attributes to the drm driver in the order it needs them, and
+ * tracks how far the bring-up got: IDLE -> BOUND -> PIN_SET -> HPD_HIGH -> LINK_OK or LINK_FAIL.
+ *
+ * All sysfs access goes through the reader and writer it is constructed with, so the transitions
+ * can be replayed without a partner. Not thread safe, the owner serializes every call.
+ */
+class DisplayPortStateMachine {
+  public:
+    // Reads the current value of a watched attribute
+    using AttributeReader = std::function<bool(DisplayPortAttribute attribute, std::string *value)>;
+    // Writes value to the named attribute of the drm driver
+    using DrmWriter = std::function<bool(const std::string &attribute, const std::string &value)>;
+
+    DisplayPortStateMachine(AttributeReader reader, DrmWriter writer);
+
+    DisplayPortState state() const { return mState; }
+    // When the partner was bound and when an attribute last changed
+    std::chrono::steady_clock::time_point bindTime() const { return mBindTime; }
+    std::chrono::steady_clock::time_point changeTime() const { return mChangeTime; }
+
+    // The displayport driver bound to a partner at since. Its attributes are readable from now on.
+    void bind(std::chrono::steady_clock::time_point since);
+    // The partner went away. hpd is dropped on the drm side.
+    void unbind();
+    /*
+     * Forwards a changed attribute and advances the state. Returns true if the framework should
+     * be notified of the change.
+     */
+    bool attributeChanged(DisplayPortAttribute attribute);
+    /*
+     * Forwards irq_hpd_count, as read from the TCPC, if it differs from the last one seen. since is
+     * when the irq_hpd was reported.
+     */
+    void irqHpd(const std::string &irqHpdCount, std::chrono::steady_clock::time_point since);
+
+    void recordStage(DisplayPortStage stage, std::chrono::steady_clock::time_point since);
+    // Latency of each stage, one per line
+    std::string dumpLatency() const;
+
+  private:
+    bool pinSet() const;
+    void setState(DisplayPortState state);
+    // Forwards attrUsb, the value of the Type-C attribute, to the drm driver
+    bool writeAttribute(const std::string &attribute, std::string attrUsb);
+    // Skips the write if the drm driver already has value
+    bool writeDrmAttribute(const std::string &attribute, const std::string &value);
+
+    const AttributeReader mReader;
+    const DrmWriter mWriter;
+
+    DisplayPortState mState;
+    bool mOrientationSet;
+    // Last value written to each drm attribute, trimmed. Writes of the same value are skipped.
+    std::unordered_map<std::string, std::string> mDrmValues;
+    // Used to cache the values read from tcpci's irq_hpd_count, reset on bind.
+    // Update drm driver when cached value is not the same as the read value.
+    uint32_t mIrqHpdCountCache;
+    // When the partner was bound, hpd went high and an attribute last changed
+    std::chrono::steady_clock::time_point mBindTime;
+    std::chrono::steady_clock::time_point mHpdHighTime;
+    std::chrono::steady_clock::time_point mChangeTime;
+    LatencyHistogram mLatency[DISPLAYPORT_STAGE_COUNT];
+};
+
+}  // namespace usb
+}  // namespace hardware
+}  // namespace android
+}  // namespace aidl
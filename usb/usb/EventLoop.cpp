@@ -0,0 +1,293 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "android.hardware.usb.aidl-service.EventLoop"
+
+#include "EventLoop.h"
+
+#include <cutils/uevent.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+#include <utils/Log.h>
+
+#include <algorithm>
+#include <string_view>
+
+#include "UeventFilter.h"
+
+namespace aidl {
+namespace android {
+namespace hardware {
+namespace usb {
+
+static constexpr int kUeventMsgLen = 2048;
+static constexpr int kMaxEvents = 64;
+
+static bool addEpollFd(int epollFd, int fd, uint32_t events) {
+    struct epoll_event ev;
+
+    ev.events = events;
+    ev.data.fd = fd;
+    if (epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &ev) != 0) {
+        ALOGE("epoll_ctl failed to add fd %d; errno=%d", fd, errno);
+        return false;
+    }
+    return true;
+}
+
+EventLoop::EventLoop() : mNextSubscriberId(0) {
+    mEpollFd.reset(epoll_create1(EPOLL_CLOEXEC));
+    if (mEpollFd.get() == -1) {
+        ALOGE("epoll_create failed; errno=%d", errno);
+        abort();
+    }
+
+    mStopFd.reset(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC));
+    if (mStopFd.get() == -1 || !addEpollFd(mEpollFd.get(), mStopFd.get(), EPOLLIN)) {
+        ALOGE("stop eventfd setup failed; errno=%d", errno);
+        abort();
+    }
+
+    mUeventFd.reset(uevent_open_socket(64 * 1024, true));
+    if (mUeventFd.get() == -1) {
+        ALOGE("uevent_open_socket failed");
+        abort();
+    }
+    fcntl(mUeventFd.get(), F_SETFL, O_NONBLOCK);
+    // Nothing is subscribed yet, so nothing needs to be queued
+    updateUeventFilter();
+    if (!addEpollFd(mEpollFd.get(), mUeventFd.get(), EPOLLIN)) {
+        abort();
+    }
+
+    mThread = std::thread(&EventLoop::loop, this);
+}
+
+EventLoop::~EventLoop() {
+    uint64_t val = 1;
+
+    write(mStopFd.get(), &val, sizeof(val));
+    if (mThread.joinable()) {
+        mThread.join();
+    }
+}
+
+bool EventLoop::addFd(int fd, uint32_t events, FdHandler handler) {
+    std::scoped_lock lk(mLock);
+
+    if (!addEpollFd(mEpollFd.get(), fd, events)) {
+        return false;
+    }
+    mHandlers[fd] = std::make_shared<FdHandler>(std::move(handler));
+    return true;
+}
+
+void EventLoop::removeFd(int fd) {
+    std::scoped_lock lk(mLock);
+
+    epoll_ctl(mEpollFd.get(), EPOLL_CTL_DEL, fd, NULL);
+    mHandlers.erase(fd);
+}
+
+int EventLoop::createTimer(std::function<void()> handler) {
+    unique_fd timerFd(timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC));
+    if (timerFd.get() == -1) {
+        ALOGE("timerfd_create failed; errno=%d", errno);
+        return -1;
+    }
+
+    const int fd = timerFd.get();
+    if (!addFd(fd, EPOLLIN, [fd, handler = std::move(handler)](uint32_t) {
+            uint64_t expirations;
+            // Nothing to read if the timer was re-armed since it fired
+            if (read(fd, &expirations, sizeof(expirations)) == sizeof(expirations)) {
+                handler();
+            }
+        })) {
+        return -1;
+    }
+
+    std::scoped_lock lk(mLock);
+    mTimers[fd] = std::move(timerFd);
+    return fd;
+}
+
+void EventLoop::armTimer(int timer, int ms) {
+    struct itimerspec ts = {};
+
+    ts.it_value.tv_sec = ms / 1000;
+    ts.it_value.tv_nsec = (ms % 1000) * 1000000;
+    if (timerfd_settime(timer, 0, &ts, NULL) != 0) {
+        ALOGE("timerfd_settime failed; errno=%d", errno);
+    }
+}
+
+void EventLoop::destroyTimer(int timer) {
+    removeFd(timer);
+
+    std::scoped_lock lk(mLock);
+    mTimers.erase(timer);
+}
+
+int EventLoop::subscribeUevents(std::vector<std::string> devpathPrefixes,
+                                UeventHandler handler, UeventsLostHandler lostHandler) {
+    std::scoped_lock lk(mLock);
+
+    const int id = mNextSubscriberId++;
+    mSubscribers.push_back({id, std::move(devpathPrefixes),
+                            std::make_shared<UeventHandler>(std::move(handler)),
+                            lostHandler ? std::make_shared<UeventsLostHandler>(
+                                                  std::move(lostHandler))
+                                        : nullptr});
+    updateUeventFilter();
+    return id;
+}
+
+void EventLoop::unsubscribeUevents(int subscription) {
+    std::scoped_lock lk(mLock);
+
+    mSubscribers.erase(std::remove_if(mSubscribers.begin(), mSubscribers.end(),
+                                      [subscription](const UeventSubscriber &s) {
+                                          return s.id == subscription;
+                                      }),
+                       mSubscribers.end());
+    updateUeventFilter();
+}
+
+void EventLoop::updateUeventFilter() {
+    std::vector<std::string> prefixes;
+
+    for (const auto &s : mSubscribers) {
+        for (const auto &prefix : s.devpathPrefixes) {
+            if (std::find(prefixes.begin(), prefixes.end(), prefix) == prefixes.end()) {
+                prefixes.push_back(prefix);
+            }
+        }
+    }
+
+    // Without a filter every uevent is delivered and matched in handleUevent() instead
+    if (!attachUeventFilter(mUeventFd.get(), prefixes)) {
+        int unused = 0;
+        setsockopt(mUeventFd.get(), SOL_SOCKET, SO_DETACH_FILTER, &unused, sizeof(unused));
+    }
+}
+
+void EventLoop::handleUevent() {
+    char msg[kUeventMsgLen + 2];
+    int n;
+
+    n = uevent_kernel_multicast_recv(mUeventFd.get(), msg, kUeventMsgLen);
+    if (n < 0 && errno == ENOBUFS) {
+        // The socket buffer overran during a burst, and any subscriber may have missed one
+        ALOGW("uevents lost");
+        handleUeventsLost();
+        return;
+    }
+    if (n <= 0)
+        return;
+    if (n >= kUeventMsgLen) { /* overflow -- discard */
+        handleUeventsLost();
+        return;
+    }
+
+    msg[n] = '\0';
+    msg[n + 1] = '\0';
+
+    const char *at = strchr(msg, '@');
+    const std::string_view devpath = at ? at + 1 : "";
+    std::vector<std::shared_ptr<UeventHandler>> handlers;
+    {
+        std::scoped_lock lk(mLock);
+        for (const auto &s : mSubscribers) {
+            for (const auto &prefix : s.devpathPrefixes) {
+                if (devpath.substr(0, prefix.size()) == prefix) {
+                    handlers.push_back(s.handler);
+                    break;
+                }
+            }
+        }
+    }
+
+    for (const auto &handler : handlers) {
+        (*handler)(msg);
+    }
+}
+
+void EventLoop::handleUeventsLost() {
+    std::vector<std::shared_ptr<UeventsLostHandler>> handlers;
+    {
+        std::scoped_lock lk(mLock);
+        for (const auto &s : mSubscribers) {
+            if (s.lostHandler) {
+                handlers.push_back(s.lostHandler);
+            }
+        }
+    }
+
+    for (const auto &handler : handlers) {
+        (*handler)();
+    }
+}
+
+void EventLoop::loop() {
+    struct epoll_event events[kMaxEvents];
+    int nevents = 0;
+
+    ALOGI("event loop started");
+    while (true) {
+        nevents = epoll_wait(mEpollFd.get(), events, kMaxEvents, -1);
+        if (nevents == -1) {
+            if (errno == EINTR)
+                continue;
+            ALOGE("usb epoll_wait failed; errno=%d", errno);
+            break;
+        }
+
+        for (int n = 0; n < nevents; ++n) {
+            const int fd = events[n].data.fd;
+            if (fd == mStopFd.get()) {
+                ALOGI("exiting event loop");
+                return;
+            }
+            if (fd == mUeventFd.get()) {
+                handleUevent();
+                continue;
+            }
+
+            std::shared_ptr<FdHandler> handler;
+            {
+                std::scoped_lock lk(mLock);
+                auto it = mHandlers.find(fd);
+                if (it != mHandlers.end()) {
+                    handler = it->second;
+                }
+            }
+            if (handler) {
+                (*handler)(events[n].events);
+            }
+        }
+    }
+}
+
+}  // namespace usb
+}  // namespace hardware
+}  // namespace android
+}  // namespace aidl
@@ -0,0 +1,103 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <android-base/unique_fd.h>
+
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace aidl {
+namespace android {
+namespace hardware {
+namespace usb {
+
+using ::android::base::unique_fd;
+
+/*
+ * EventLoop runs every fd, timer and uevent handler of the USB HAL on a single thread.
+ *
+ * Kernel uevents are received once on a shared netlink socket and fanned out to the subscribers
+ * whose devpath prefixes match. The socket filter is the union of all subscriptions, so uevents
+ * no subscriber wants never leave the kernel. Timers are timerfds owned by the loop.
+ *
+ * Handlers run on the loop thread and must not block on it. Registration calls are safe from any
+ * thread. The thread starts in the constructor and is stopped and joined by the destructor.
+ */
+class EventLoop {
+  public:
+    using FdHandler = std::function<void(uint32_t events)>;
+    // msg holds NUL separated lines and ends with an empty line
+    using UeventHandler = std::function<void(const char *msg)>;
+    // Called when uevents were dropped, e.g. on a receive buffer overrun
+    using UeventsLostHandler = std::function<void()>;
+
+    EventLoop();
+    ~EventLoop();
+
+    bool addFd(int fd, uint32_t events, FdHandler handler);
+    void removeFd(int fd);
+
+    // Returns a timer id, or -1 on failure
+    int createTimer(std::function<void()> handler);
+    // Fires the timer once after ms milliseconds. 0 disarms it.
+    void armTimer(int timer, int ms);
+    void destroyTimer(int timer);
+
+    // Returns a subscription id, or -1 on failure
+    int subscribeUevents(std::vector<std::string> devpathPrefixes, UeventHandler handler,
+                         UeventsLostHandler lostHandler = nullptr);
+    void unsubscribeUevents(int subscription);
+
+  private:
+    struct UeventSubscriber {
+        int id;
+        std::vector<std::string> devpathPrefixes;
+        std::shared_ptr<UeventHandler> handler;
+        std::shared_ptr<UeventsLostHandler> lostHandler;
+    };
+
+    void loop();
+    void handleUevent();
+    void handleUeventsLost();
+    // Called with mLock held
+    void updateUeventFilter();
+
+    unique_fd mEpollFd;
+    unique_fd mStopFd;
+    unique_fd mUeventFd;
+
+    // Protects everything below
+    std::mutex mLock;
+    // Indexed by fd. Shared so a handler can be removed while it runs.
+    std::unordered_map<int, std::shared_ptr<FdHandler>> mHandlers;
+    std::unordered_map<int, unique_fd> mTimers;
+    std::vector<UeventSubscriber> mSubscribers;
+    int mNextSubscriberId;
+
+    std::thread mThread;
+};
+
+}  // namespace usb
+}  // namespace hardware
+}  // namespace android
+}  // namespace aidl
@@ -0,0 +1,72 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "LatencyHistogram.h"
+
+#include <android-base/stringprintf.h>
+#include <inttypes.h>
+
+#include <algorithm>
+
+namespace aidl {
+namespace android {
+namespace hardware {
+namespace usb {
+
+using ::android::base::StringAppendF;
+
+LatencyHistogram::LatencyHistogram()
+    : mBuckets(), mCount(0), mSumMs(0), mMinMs(INT64_MAX), mMaxMs(0) {}
+
+void LatencyHistogram::record(int64_t ms) {
+    int bucket = 0;
+
+    ms = std::max<int64_t>(ms, 0);
+    while (bucket < kBuckets - 1 && ms >= (int64_t{1} << bucket)) {
+        bucket++;
+    }
+    mBuckets[bucket]++;
+    mCount++;
+    mSumMs += ms;
+    mMinMs = std::min(mMinMs, ms);
+    mMaxMs = std::max(mMaxMs, ms);
+}
+
+std::string LatencyHistogram::toString() const {
+    std::string out;
+
+    if (mCount == 0) {
+        return "n=0";
+    }
+    StringAppendF(&out, "n=%" PRIu64 " min=%" PRId64 " avg=%" PRId64 " max=%" PRId64 " ms |",
+                  mCount, mMinMs, mSumMs / static_cast<int64_t>(mCount), mMaxMs);
+    for (int i = 0; i < kBuckets; i++) {
+        if (mBuckets[i] == 0) {
+            continue;
+        }
+        if (i == kBuckets - 1) {
+            StringAppendF(&out, " >=%" PRId64 ":%" PRIu64, int64_t{1} << (i - 1), mBuckets[i]);
+        } else {
+            StringAppendF(&out, " <%" PRId64 ":%" PRIu64, int64_t{1} << i, mBuckets[i]);
+        }
+    }
+    return out;
+}
+
+}  // namespace usb
+}  // namespace hardware
+}  // namespace android
+}  // namespace aidl
@@ -0,0 +1,53 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#include <string>
+
+namespace aidl {
+namespace android {
+namespace hardware {
+namespace usb {
+
+/*
+ * Distribution of latencies in milliseconds over power of two buckets: [0, 1), [1, 2), [2, 4) up
+ * to [16384, inf). Not thread safe, the owner serializes record() and toString().
+ */
+class LatencyHistogram {
+  public:
+    LatencyHistogram();
+
+    void record(int64_t ms);
+    // One line: count, min, average and max, followed by the non-empty buckets
+    std::string toString() const;
+
+  private:
+    static constexpr int kBuckets = 16;
+
+    uint64_t mBuckets[kBuckets];
+    uint64_t mCount;
+    int64_t mSumMs;
+    int64_t mMinMs;
+    int64_t mMaxMs;
+};
+
+}  // namespace usb
+}  // namespace hardware
+}  // namespace android
+}  // namespace aidl
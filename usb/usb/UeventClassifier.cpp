@@ -0,0 +1,87 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "UeventClassifier.h"
+
+#include <string.h>
+
+namespace aidl {
+namespace android {
+namespace hardware {
+namespace usb {
+
+constexpr char kOverheatStatsDriver[] = "google,usbc_port_cooling_dev";
+
+struct UeventRule {
+    std::string_view key;
+    // Matched against the start of the value
+    std::string_view valuePrefix;
+    UeventLine line;
+};
+
+/*
+ * Dispatch table for the "KEY=value" lines, in priority order. Only the key is compared for
+ * most lines, since almost every line of a power_supply uevent has a key that is not listed.
+ */
+constexpr UeventRule kUeventRules[] = {
+    {"DEVTYPE", "typec_", UeventLine::TYPEC_CHANGED},
+    {"DRIVER", "max77759tcpc", UeventLine::TCPC_CHANGED},
+    {"DRIVER", "pogo-transport", UeventLine::PORT_CHANGED},
+    {"POWER_SUPPLY_NAME", "usb", UeventLine::PORT_CHANGED},
+    {"DRIVER", kOverheatStatsDriver, UeventLine::OVERHEAT},
+    {"ACTION", "", UeventLine::ACTION},
+    {"DEVPATH", "", UeventLine::DEVPATH},
+    {"DRIVER", "typec_displayport", UeventLine::DISPLAYPORT_DRIVER},
+};
+
+enum UeventType matchUeventType(std::string_view action) {
+    if (action.substr(0, strlen("bind")) == "bind") {
+        return UeventType::BIND;
+    } else if (action.substr(0, strlen("unbind")) == "unbind") {
+        return UeventType::UNBIND;
+    } else if (action.substr(0, strlen("change")) == "change") {
+        return UeventType::CHANGE;
+    }
+    return UeventType::UNKNOWN;
+}
+
+UeventLine classifyUeventLine(std::string_view line, std::string_view *value) {
+    size_t sep = line.find('=');
+    if (sep == std::string_view::npos) {
+        // "add@/devices/.../port0-partner"
+        constexpr std::string_view kAdd = "add";
+        constexpr std::string_view kPartner = "-partner";
+        if (line.size() >= kAdd.size() + kPartner.size() && line.substr(0, kAdd.size()) == kAdd &&
+            line.substr(line.size() - kPartner.size()) == kPartner) {
+            return UeventLine::PARTNER_ADDED;
+        }
+        return UeventLine::IGNORED;
+    }
+
+    std::string_view key = line.substr(0, sep);
+    *value = line.substr(sep + 1);
+    for (const UeventRule &rule : kUeventRules) {
+        if (key == rule.key && value->substr(0, rule.valuePrefix.size()) == rule.valuePrefix) {
+            return rule.line;
+        }
+    }
+    return UeventLine::IGNORED;
+}
+
+}  // namespace usb
+}  // namespace hardware
+}  // namespace android
+}  // namespace aidl
@@ -0,0 +1,72 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <string_view>
+
+namespace aidl {
+namespace android {
+namespace hardware {
+namespace usb {
+
+enum UeventType { UNKNOWN, BIND, UNBIND, CHANGE };
+
+UeventType matchUeventType(std::string_view action);
+
+/*
+ * What a single uevent line means to the HAL. Lines are "KEY=value", except for the leading
+ * "action@devpath" line.
+ */
+enum class UeventLine {
+    IGNORED,
+    PARTNER_ADDED,
+    // typec port, partner or alt mode change
+    TYPEC_CHANGED,
+    // tcpc change, which also re-checks the DisplayPort irq_hpd count
+    TCPC_CHANGED,
+    // pogo or usb power supply change
+    PORT_CHANGED,
+    OVERHEAT,
+    ACTION,
+    // Follows ACTION
+    DEVPATH,
+    DISPLAYPORT_DRIVER,
+};
+
+// Sets value to the part after '=' for "KEY=value" lines
+UeventLine classifyUeventLine(std::string_view line, std::string_view *value);
+
+/*
+ * Calls fn(UeventLine, std::string_view value) for every line of a uevent message, whose lines are
+ * NUL separated and which ends with an empty line. Stops early once fn returns false.
+ */
+template <typename Fn>
+void forEachUeventLine(const char *msg, Fn fn) {
+    for (const char *cp = msg; *cp;) {
+        std::string_view line(cp);
+        std::string_view value;
+        cp += line.size() + 1;
+        if (!fn(classifyUeventLine(line, &value), value)) {
+            return;
+        }
+    }
+}
+
+}  // namespace usb
+}  // namespace hardware
+}  // namespace android
+}  // namespace aidl
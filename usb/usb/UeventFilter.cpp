@@ -0,0 +1,129 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "android.hardware.usb.aidl-service.UeventFilter"
+
+#include "UeventFilter.h"
+
+#include <errno.h>
+#include <linux/filter.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <utils/Log.h>
+
+namespace aidl {
+namespace android {
+namespace hardware {
+namespace usb {
+
+// Lengths of the kobject actions: add, bind/move, change/online/remove/unbind, offline
+static constexpr uint32_t kActionLengths[] = {3, 4, 6, 7};
+static constexpr uint32_t kAccept = 0xffffffff;
+static constexpr uint32_t kDrop = 0;
+
+/*
+ * Appends instructions that compare the packet at offset against prefix and accept the packet on
+ * a match. On a mismatch control falls through to whatever follows the block. Absolute loads in
+ * classic BPF are big endian.
+ */
+static bool appendPrefixMatch(std::vector<sock_filter> *prog, uint32_t offset,
+                              const std::string &prefix) {
+    struct Chunk {
+        uint16_t size;
+        uint32_t off;
+        uint32_t value;
+    };
+    std::vector<Chunk> chunks;
+    for (size_t i = 0; i < prefix.size();) {
+        const size_t size = prefix.size() - i >= 4 ? 4 : prefix.size() - i >= 2 ? 2 : 1;
+        uint32_t value = 0;
+        for (size_t j = 0; j < size; j++) {
+            value = (value << 8) | static_cast<uint8_t>(prefix[i + j]);
+        }
+        chunks.push_back({static_cast<uint16_t>(size == 4 ? BPF_W : size == 2 ? BPF_H : BPF_B),
+                          static_cast<uint32_t>(offset + i), value});
+        i += size;
+    }
+
+    // Each mismatch jumps over the rest of the block, including the final accept
+    if (2 * chunks.size() > 255) {
+        ALOGE("uevent filter prefix too long: %s", prefix.c_str());
+        return false;
+    }
+    for (size_t i = 0; i < chunks.size(); i++) {
+        const uint8_t skip = 2 * (chunks.size() - i - 1) + 1;
+        prog->push_back(BPF_STMT(BPF_LD | chunks[i].size | BPF_ABS, chunks[i].off));
+        prog->push_back(BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, chunks[i].value, 0, skip));
+    }
+    prog->push_back(BPF_STMT(BPF_RET | BPF_K, kAccept));
+    return true;
+}
+
+bool attachUeventFilter(int ueventFd, const std::vector<std::string> &devpathPrefixes) {
+    std::vector<sock_filter> prog;
+
+    /*
+     * For each possible action length L:
+     *     if (pkt[L] == '@') {
+     *         if (pkt[L + 1..] starts with any prefix) accept;
+     *         drop;
+     *     }
+     * drop;
+     *
+     * A load past the end of the packet drops it, which is fine since every kernel uevent
+     * carries ACTION=, DEVPATH=, SUBSYSTEM= and SEQNUM= after the header and is therefore
+     * longer than any prefix.
+     */
+    for (uint32_t length : kActionLengths) {
+        prog.push_back(BPF_STMT(BPF_LD | BPF_B | BPF_ABS, length));
+        prog.push_back(BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, '@', 1, 0));
+        const size_t skipIndex = prog.size();
+        prog.push_back(BPF_STMT(BPF_JMP | BPF_JA, 0));
+        for (const std::string &prefix : devpathPrefixes) {
+            if (!appendPrefixMatch(&prog, length + 1, prefix)) {
+                return false;
+            }
+        }
+        prog.push_back(BPF_STMT(BPF_RET | BPF_K, kDrop));
+        prog[skipIndex].k = prog.size() - skipIndex - 1;
+    }
+    prog.push_back(BPF_STMT(BPF_RET | BPF_K, kDrop));
+
+    if (prog.size() > BPF_MAXINSNS) {
+        ALOGE("uevent filter too large: %zu instructions", prog.size());
+        return false;
+    }
+    struct sock_fprog fprog = {
+        .len = static_cast<unsigned short>(prog.size()),
+        .filter = prog.data(),
+    };
+    if (setsockopt(ueventFd, SOL_SOCKET, SO_ATTACH_FILTER, &fprog, sizeof(fprog)) != 0) {
+        ALOGE("uevent filter attach failed; errno=%d", errno);
+        return false;
+    }
+    ALOGI("uevent filter attached: %zu prefixes, %zu instructions", devpathPrefixes.size(),
+          prog.size());
+    return true;
+}
+
+std::string ueventRegexDevpathPrefix(const std::string &regex) {
+    return regex.substr(0, regex.find_first_of(".[]()*+?{}|^$\\"));
+}
+
+}  // namespace usb
+}  // namespace hardware
+}  // namespace android
+}  // namespace aidl
@@ -0,0 +1,48 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+namespace aidl {
+namespace android {
+namespace hardware {
+namespace usb {
+
+/*
+ * Attaches a classic BPF socket filter to a NETLINK_KOBJECT_UEVENT socket so that the kernel only
+ * queues uevents whose devpath starts with one of devpathPrefixes. The devpath is taken from the
+ * "action@devpath" line that starts every kernel uevent, which is the only part of the message at
+ * a position the filter can compute. Everything else, including userspace (libudev) messages, is
+ * dropped in the kernel and never wakes the HAL.
+ *
+ * Returns false if the filter could not be attached, in which case the socket still receives
+ * every uevent.
+ */
+bool attachUeventFilter(int ueventFd, const std::vector<std::string> &devpathPrefixes);
+
+/*
+ * Returns the literal part of a devpath regex up to its first metacharacter, which is a devpath
+ * prefix that every match of the regex starts with.
+ */
+std::string ueventRegexDevpathPrefix(const std::string &regex);
+
+}  // namespace usb
+}  // namespace hardware
+}  // namespace android
+}  // namespace aidl
@@ -19,26 +19,29 @@
 #include <android-base/logging.h>
 #include <android-base/parseint.h>
 #include <android-base/properties.h>
+#include <android-base/stringprintf.h>
 #include <android-base/strings.h>
 #include <assert.h>
 #include <cstring>
 #include <dirent.h>
+#include <fcntl.h>
+#include <inttypes.h>
 #include <pthread.h>
 #include <stdio.h>
 #include <sys/types.h>
 #include <unistd.h>
-#include <regex>
+#include <chrono>
+#include <string_view>
 #include <thread>
 #include <unordered_map>
 
-#include <cutils/uevent.h>
 #include <sys/epoll.h>
-#include <sys/eventfd.h>
-#include <sys/timerfd.h>
 #include <utils/Errors.h>
 #include <utils/StrongPointer.h>
 
 #include "Usb.h"
+#include "TcpcNode.h"
+#include "UeventClassifier.h"
 
 #include <aidl/android/frameworks/stats/IStats.h>
 #include <android_hardware_usb_flags.h>
@@ -51,6 +54,7 @@ using aidl::android::frameworks::stats::IStats;
 using android::base::GetProperty;
 using android::base::Join;
 using android::base::ParseUint;
+using android::base::StringAppendF;
 using android::base::Tokenize;
 using android::base::Trim;
 using android::hardware::google::pixel::getStatsService;
@@ -61,32 +65,28 @@ namespace aidl {
 namespace android {
 namespace hardware {
 namespace usb {
-// Set by the signal handler to destroy the thread
-volatile bool destroyThread;
-volatile bool destroyDisplayPortThread;
 
-string enabledPath;
 constexpr char kHsi2cPath[] = "/sys/devices/platform/10cb0000.hsi2c";
-constexpr char kI2CPath[] = "/sys/devices/platform/10cb0000.hsi2c/i2c-";
-constexpr char kContaminantDetectionPath[] = "-0025/contaminant_detection";
+constexpr char kTcpcI2cAddress[] = "0025";
+constexpr char kContaminantDetectionPath[] = "contaminant_detection";
 constexpr char kDisplayPortDrmPath[] = "/sys/devices/platform/110f0000.drmdp/drm-displayport/";
 constexpr char kDisplayPortUsbPath[] = "/sys/class/typec/port0-partner/";
+constexpr char kDisplayPortOrientationPath[] = "/sys/class/typec/port0/orientation";
 constexpr char kComplianceWarningsPath[] = "device/non_compliant_reasons";
 constexpr char kComplianceWarningBC12[] = "bc12";
 constexpr char kComplianceWarningDebugAccessory[] = "debug-accessory";
 constexpr char kComplianceWarningMissingRp[] = "missing_rp";
 constexpr char kComplianceWarningOther[] = "other";
 constexpr char kComplianceWarningInputPowerLimited[] = "input_power_limited";
-constexpr char kStatusPath[] = "-0025/contaminant_detection_status";
-constexpr char kSinkLimitEnable[] = "-0025/usb_limit_sink_enable";
-constexpr char kSourceLimitEnable[] = "-0025/usb_limit_source_enable";
-constexpr char kSinkLimitCurrent[] = "-0025/usb_limit_sink_current";
-constexpr char kCcToggleEnable[] = "-0025/cc_toggle_enable";
-constexpr char kDataPathEnable[] = "-0025/data_path_enable";
+constexpr char kStatusPath[] = "contaminant_detection_status";
+constexpr char kSinkLimitEnable[] = "usb_limit_sink_enable";
+constexpr char kSourceLimitEnable[] = "usb_limit_source_enable";
+constexpr char kSinkLimitCurrent[] = "usb_limit_sink_current";
+constexpr char kCcToggleEnable[] = "cc_toggle_enable";
+constexpr char kDataPathEnable[] = "data_path_enable";
 constexpr char kTypecPath[] = "/sys/class/typec";
 constexpr char kDisableContatminantDetection[] = "vendor.usb.contaminantdisable";
 constexpr char kOverheatStatsPath[] = "/sys/devices/platform/google,usbc_port_cooling_dev/";
-constexpr char kOverheatStatsDev[] = "DRIVER=google,usbc_port_cooling_dev";
 constexpr char kThermalZoneForTrip[] = "VIRTUAL-USB-THROTTLING";
 constexpr char kThermalZoneForTempReadPrimary[] = "usb_pwr_therm2";
 constexpr char kThermalZoneForTempReadSecondary1[] = "usb_pwr_therm";
@@ -94,7 +94,7 @@ constexpr char kThermalZoneForTempReadSecondary2[] = "qi_therm";
 constexpr char kPogoUsbActive[] = "/sys/devices/platform/google,pogo/pogo_usb_active";
 constexpr char kPogoEnableUsb[] = "/sys/devices/platform/google,pogo/enable_usb";
 constexpr char kPowerSupplyUsbType[] = "/sys/class/power_supply/usb/usb_type";
-constexpr char kIrqHpdCounPath[] = "-0025/irq_hpd_count";
+constexpr char kIrqHpdCounPath[] = "irq_hpd_count";
 constexpr char kUdcUeventRegex[] =
     "/devices/platform/11210000.usb/11210000.dwc3/udc/11210000.dwc3";
 constexpr char kUdcStatePath[] =
@@ -107,8 +107,28 @@ constexpr char kHost2UeventRegex[] =
 constexpr char kHost2StatePath[] = "/sys/bus/usb/devices/usb2/2-0:1.0/usb2-port1/state";
 constexpr char kDataRolePath[] = "/sys/devices/platform/11210000.usb/new_data_role";
 constexpr int kSamplingIntervalSec = 5;
-void queryVersionHelper(android::hardware::usb::Usb *usb,
+// Longest DisplayPort sysfs value, a pin_assignment list such as "C [D] E"
+constexpr int kMaxDisplayPortAttributeSize = 64;
+// Re-resolved when the tcpc driver binds or unbinds
+TcpcNode tcpcNode(kHsi2cPath, kTcpcI2cAddress);
+// A typec attach emits a burst of uevents over a few tens of milliseconds
+constexpr int kPortStatusCoalesceMs = 50;
+/*
+ * Devices whose uevents uevent_event() handles: the TCPC with its typec ports, partners, alt
+ * modes and usb power supply, the pogo transport, and the port cooling device.
+ */
+const std::vector<string> kUeventDevpathPrefixes = {
+    "/devices/platform/10cb0000.hsi2c/",
+    "/devices/platform/google,pogo",
+    "/devices/platform/google,usbc_port_cooling_dev",
+};
+bool queryVersionHelper(android::hardware::usb::Usb *usb, uint32_t changed, bool force,
                         std::vector<PortStatus> *currentPortStatus);
+void handlePendingPortChange(android::hardware::usb::Usb *usb);
+void finishRoleSwitch(android::hardware::usb::Usb *usb, Status status, const char *outcome);
+void expireRoleSwitch(android::hardware::usb::Usb *usb);
+void displayPortActivateCheck(android::hardware::usb::Usb *usb);
+void displayPortIrqHpd(android::hardware::usb::Usb *usb);
 AltModeData::DisplayPortAltModeData constructAltModeData(string hpd, string pin_assignment,
                                                          string link_status, string vdo);
 
@@ -150,7 +170,9 @@ ScopedAStatus Usb::enableUsbData(const string& in_portName, bool in_enable,
                 } else {
                     ALOGI("Successfully enabled DisplayPort Alt Mode on partner at %s",
                             displayPortPartnerPath.c_str());
-                    setupDisplayPortPoll();
+                    pthread_mutex_lock(&mDisplayPortLock);
+                    armDisplayPort();
+                    pthread_mutex_unlock(&mDisplayPortLock);
                 }
             }
         }
@@ -186,7 +208,9 @@ ScopedAStatus Usb::enableUsbData(const string& in_portName, bool in_enable,
             } else {
                 ALOGI("Successfully disabled DisplayPort Alt Mode on partner at %s",
                         displayPortPartnerPath.c_str());
-                shutdownDisplayPortPoll(true);
+                pthread_mutex_lock(&mDisplayPortLock);
+                disarmDisplayPort(true);
+                pthread_mutex_unlock(&mDisplayPortLock);
             }
         }
 
@@ -210,7 +234,8 @@ ScopedAStatus Usb::enableUsbData(const string& in_portName, bool in_enable,
         ALOGE("Not notifying the userspace. Callback is not set");
     }
     pthread_mutex_unlock(&mLock);
-    queryVersionHelper(this, &currentPortStatus);
+    queryVersionHelper(this, PORT_STATUS_PORTS | PORT_STATUS_DISPLAYPORT, false,
+                       &currentPortStatus);
 
     return ScopedAStatus::ok();
 }
@@ -244,7 +269,7 @@ ScopedAStatus Usb::enableUsbDataWhileDocked(const string& in_portName,
         ALOGE("Not notifying the userspace. Callback is not set");
     }
     pthread_mutex_unlock(&mLock);
-    queryVersionHelper(this, &currentPortStatus);
+    queryVersionHelper(this, PORT_STATUS_PORTS, false, &currentPortStatus);
 
     return ScopedAStatus::ok();
 }
@@ -274,120 +299,83 @@ ScopedAStatus Usb::resetUsbPort(const std::string& in_portName, int64_t in_trans
     return ::ndk::ScopedAStatus::ok();
 }
 
-Status getI2cBusHelper(string *name) {
-    DIR *dp;
-
-    dp = opendir(kHsi2cPath);
-    if (dp != NULL) {
-        struct dirent *ep;
-
-        while ((ep = readdir(dp))) {
-            if (ep->d_type == DT_DIR) {
-                if (string::npos != string(ep->d_name).find("i2c-")) {
-                    std::strtok(ep->d_name, "-");
-                    *name = std::strtok(NULL, "-");
-                }
-            }
-        }
-        closedir(dp);
-        return Status::SUCCESS;
-    }
-
-    ALOGE("Failed to open %s", kHsi2cPath);
-    return Status::ERROR;
-}
-
-Status queryMoistureDetectionStatus(std::vector<PortStatus> *currentPortStatus) {
-    string enabled, status, path, DetectedPath;
+// Fills in the contaminant fields of portStatus, which describes the first port
+Status queryMoistureDetectionStatus(PortStatus *portStatus) {
+    string enabled, status;
 
-    (*currentPortStatus)[0].supportedContaminantProtectionModes
+    portStatus->supportedContaminantProtectionModes
             .push_back(ContaminantProtectionMode::FORCE_DISABLE);
-    (*currentPortStatus)[0].contaminantProtectionStatus = ContaminantProtectionStatus::NONE;
-    (*currentPortStatus)[0].contaminantDetectionStatus = ContaminantDetectionStatus::DISABLED;
-    (*currentPortStatus)[0].supportsEnableContaminantPresenceDetection = true;
-    (*currentPortStatus)[0].supportsEnableContaminantPresenceProtection = false;
-
-    getI2cBusHelper(&path);
-    enabledPath = kI2CPath + path + "/" + path + kContaminantDetectionPath;
-    if (!ReadFileToString(enabledPath, &enabled)) {
+    portStatus->contaminantProtectionStatus = ContaminantProtectionStatus::NONE;
+    portStatus->contaminantDetectionStatus = ContaminantDetectionStatus::DISABLED;
+    portStatus->supportsEnableContaminantPresenceDetection = true;
+    portStatus->supportsEnableContaminantPresenceProtection = false;
+
+    if (!tcpcNode.readAttribute(kContaminantDetectionPath, &enabled)) {
         ALOGE("Failed to open moisture_detection_enabled");
         return Status::ERROR;
     }
 
     enabled = Trim(enabled);
     if (enabled == "1") {
-        DetectedPath = kI2CPath + path + "/" + path + kStatusPath;
-        if (!ReadFileToString(DetectedPath, &status)) {
+        if (!tcpcNode.readAttribute(kStatusPath, &status)) {
             ALOGE("Failed to open moisture_detected");
             return Status::ERROR;
         }
         status = Trim(status);
         if (status == "1") {
-            (*currentPortStatus)[0].contaminantDetectionStatus =
-                ContaminantDetectionStatus::DETECTED;
-            (*currentPortStatus)[0].contaminantProtectionStatus =
-                ContaminantProtectionStatus::FORCE_DISABLE;
+            portStatus->contaminantDetectionStatus = ContaminantDetectionStatus::DETECTED;
+            portStatus->contaminantProtectionStatus = ContaminantProtectionStatus::FORCE_DISABLE;
         } else {
-            (*currentPortStatus)[0].contaminantDetectionStatus =
-                ContaminantDetectionStatus::NOT_DETECTED;
+            portStatus->contaminantDetectionStatus = ContaminantDetectionStatus::NOT_DETECTED;
         }
     }
 
     ALOGI("ContaminantDetectionStatus:%d ContaminantProtectionStatus:%d",
-            (*currentPortStatus)[0].contaminantDetectionStatus,
-            (*currentPortStatus)[0].contaminantProtectionStatus);
+            portStatus->contaminantDetectionStatus,
+            portStatus->contaminantProtectionStatus);
 
     return Status::SUCCESS;
 }
 
-Status queryNonCompliantChargerStatus(std::vector<PortStatus> *currentPortStatus) {
+// Reads the non compliant charger reasons of portName. warnings stays empty if there are none.
+Status queryNonCompliantChargerStatus(const string &portName,
+                                      std::vector<ComplianceWarning> *warnings) {
     string reasons, path;
 
-    for (int i = 0; i < currentPortStatus->size(); i++) {
-        (*currentPortStatus)[i].supportsComplianceWarnings = true;
-        path = string(kTypecPath) + "/" + (*currentPortStatus)[i].portName + "/" +
-                string(kComplianceWarningsPath);
-        if (ReadFileToString(path.c_str(), &reasons)) {
-            std::vector<string> reasonsList = Tokenize(reasons.c_str(), "[], \n\0");
-            for (string reason : reasonsList) {
-                if (!strncmp(reason.c_str(), kComplianceWarningDebugAccessory,
-                            strlen(kComplianceWarningDebugAccessory))) {
-                    (*currentPortStatus)[i].complianceWarnings.push_back(ComplianceWarning::DEBUG_ACCESSORY);
-                    continue;
-                }
-                if (!strncmp(reason.c_str(), kComplianceWarningBC12,
-                            strlen(kComplianceWarningBC12))) {
-                    (*currentPortStatus)[i].complianceWarnings.push_back(ComplianceWarning::BC_1_2);
-                    continue;
-                }
-                if (!strncmp(reason.c_str(), kComplianceWarningMissingRp,
-                            strlen(kComplianceWarningMissingRp))) {
-                    (*currentPortStatus)[i].complianceWarnings.push_back(ComplianceWarning::MISSING_RP);
-                    continue;
-                }
-                if (!strncmp(reason.c_str(), kComplianceWarningOther,
-                             strlen(kComplianceWarningOther)) ||
-                    !strncmp(reason.c_str(), kComplianceWarningInputPowerLimited,
-                             strlen(kComplianceWarningInputPowerLimited))) {
-                    if (usb_flags::enable_usb_data_compliance_warning() &&
-                        usb_flags::enable_input_power_limited_warning()) {
-                        ALOGI("Report through INPUT_POWER_LIMITED warning");
-                        (*currentPortStatus)[i].complianceWarnings.push_back(
-                            ComplianceWarning::INPUT_POWER_LIMITED);
-                        continue;
-                    } else {
-                        (*currentPortStatus)[i].complianceWarnings.push_back(
-                            ComplianceWarning::OTHER);
-                        continue;
-                    }
-                }
-            }
-            if ((*currentPortStatus)[i].complianceWarnings.size() > 0 &&
-                 (*currentPortStatus)[i].currentPowerRole == PortPowerRole::NONE) {
-                (*currentPortStatus)[i].currentMode = PortMode::UFP;
-                (*currentPortStatus)[i].currentPowerRole = PortPowerRole::SINK;
-                (*currentPortStatus)[i].currentDataRole = PortDataRole::NONE;
-                (*currentPortStatus)[i].powerBrickStatus = PowerBrickStatus::CONNECTED;
+    path = string(kTypecPath) + "/" + portName + "/" + string(kComplianceWarningsPath);
+    if (!ReadFileToString(path.c_str(), &reasons)) {
+        return Status::ERROR;
+    }
+
+    std::vector<string> reasonsList = Tokenize(reasons.c_str(), "[], \n\0");
+    for (string reason : reasonsList) {
+        if (!strncmp(reason.c_str(), kComplianceWarningDebugAccessory,
+                    strlen(kComplianceWarningDebugAccessory))) {
+            warnings->push_back(ComplianceWarning::DEBUG_ACCESSORY);
+            continue;
+        }
+        if (!strncmp(reason.c_str(), kComplianceWarningBC12,
+                    strlen(kComplianceWarningBC12))) {
+            warnings->push_back(ComplianceWarning::BC_1_2);
+            continue;
+        }
+        if (!strncmp(reason.c_str(), kComplianceWarningMissingRp,
+                    strlen(kComplianceWarningMissingRp))) {
+            warnings->push_back(ComplianceWarning::MISSING_RP);
+            continue;
+        }
+        if (!strncmp(reason.c_str(), kComplianceWarningOther,
+                     strlen(kComplianceWarningOther)) ||
+            !strncmp(reason.c_str(), kComplianceWarningInputPowerLimited,
+                     strlen(kComplianceWarningInputPowerLimited))) {
+            if (usb_flags::enable_usb_data_compliance_warning() &&
+                usb_flags::enable_input_power_limited_warning()) {
+                ALOGI("Report through INPUT_POWER_LIMITED warning");
+                warnings->push_back(ComplianceWarning::INPUT_POWER_LIMITED);
+                continue;
+            } else {
+                warnings->push_back(ComplianceWarning::OTHER);
+                continue;
             }
         }
     }
@@ -459,72 +447,174 @@ void switchToDrp(const string &portName) {
     }
 }
 
-bool switchMode(const string &portName, const PortRole &in_role, struct Usb *usb) {
-    string filename = appendRoleNodeHelper(string(portName.c_str()), in_role.getTag());
-    string written;
+static void notifyRoleSwitch(android::hardware::usb::Usb *usb, const string &portName,
+                             const PortRole &role, Status status, int64_t transactionId) {
+    pthread_mutex_lock(&usb->mLock);
+    if (usb->mCallback != NULL) {
+        ScopedAStatus ret = usb->mCallback->notifyRoleSwitchStatus(portName, role, status,
+                                                                   transactionId);
+        if (!ret.isOk())
+            ALOGE("RoleSwitchStatus error %s", ret.getDescription().c_str());
+    } else {
+        ALOGE("Not notifying the userspace. Callback is not set");
+    }
+    pthread_mutex_unlock(&usb->mLock);
+}
+
+/*
+ * Takes the pending port mode switch out of mRoleSwitch and records how long it took. Called with
+ * mRoleSwitchStateLock held; the switch is completed by completeRoleSwitch() once it is released.
+ */
+static RoleSwitchRequest takeRoleSwitchLocked(android::hardware::usb::Usb *usb) {
+    RoleSwitchRequest request = usb->mRoleSwitch;
+
+    usb->mRoleSwitch.pending = false;
+    usb->mEventLoop.armTimer(usb->mRoleSwitchTimer, 0);
+    usb->mLastRoleSwitchLatencyMs = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - request.start).count();
+    return request;
+}
+
+/*
+ * Reports a port mode switch taken by takeRoleSwitchLocked(). A port that did not reach the
+ * requested mode is put back into dual role unless revert is false, which is the case when a new
+ * mode is about to be written anyway.
+ */
+static void completeRoleSwitch(android::hardware::usb::Usb *usb, const RoleSwitchRequest &request,
+                               int64_t latencyMs, Status status, const char *outcome,
+                               bool revert) {
+    ALOGI("role switch of %s to %s %s after %" PRId64 "ms", request.portName.c_str(),
+          convertRoletoString(request.role).c_str(), outcome, latencyMs);
+
+    if (status != Status::SUCCESS && revert)
+        switchToDrp(request.portName);
+    notifyRoleSwitch(usb, request.portName, request.role, status, request.transactionId);
+}
+
+/*
+ * Completes the pending port mode switch, if there is one. While the new mode is still being
+ * written the outcome is only recorded, and startSwitchMode() applies it once the write returns.
+ */
+void finishRoleSwitch(android::hardware::usb::Usb *usb, Status status, const char *outcome) {
+    pthread_mutex_lock(&usb->mRoleSwitchStateLock);
+    if (!usb->mRoleSwitch.pending) {
+        pthread_mutex_unlock(&usb->mRoleSwitchStateLock);
+        return;
+    }
+    if (usb->mRoleSwitch.writing) {
+        if (usb->mRoleSwitch.deferredOutcome == NULL) {
+            usb->mRoleSwitch.deferredStatus = status;
+            usb->mRoleSwitch.deferredOutcome = outcome;
+        }
+        pthread_mutex_unlock(&usb->mRoleSwitchStateLock);
+        return;
+    }
+    RoleSwitchRequest request = takeRoleSwitchLocked(usb);
+    int64_t latencyMs = usb->mLastRoleSwitchLatencyMs;
+    pthread_mutex_unlock(&usb->mRoleSwitchStateLock);
+
+    completeRoleSwitch(usb, request, latencyMs, status, outcome, true);
+}
+
+void expireRoleSwitch(android::hardware::usb::Usb *usb) {
+    pthread_mutex_lock(&usb->mRoleSwitchStateLock);
+    // The timer may have fired for a switch that was superseded while this waited for the lock
+    bool expired = std::chrono::steady_clock::now() - usb->mRoleSwitch.start >=
+                   std::chrono::seconds(PORT_TYPE_TIMEOUT);
+    pthread_mutex_unlock(&usb->mRoleSwitchStateLock);
+
+    if (expired)
+        finishRoleSwitch(usb, Status::ERROR, "timed out");
+}
+
+/*
+ * Writes the new port mode and returns without waiting for the partner to come back. The switch
+ * completes on the event loop when the partner is added again, or fails after PORT_TYPE_TIMEOUT.
+ * A switch that is still pending is superseded and reported as failed. Called with
+ * mRoleSwitchLock held, but not mRoleSwitchStateLock, which is not held across the write.
+ */
+static void startSwitchMode(android::hardware::usb::Usb *usb, const string &portName,
+                            const PortRole &in_role, int64_t transactionId) {
+    string filename = appendRoleNodeHelper(portName, in_role.getTag());
+    RoleSwitchRequest superseded = {};
+    int64_t latencyMs = 0;
+    Status status = Status::ERROR;
+    const char *outcome = "failed";
     FILE *fp;
-    bool roleSwitch = false;
+    bool written = false;
 
-    if (filename == "") {
-        ALOGE("Fatal: invalid node type");
-        return false;
+    pthread_mutex_lock(&usb->mRoleSwitchStateLock);
+    if (usb->mRoleSwitch.pending) {
+        superseded = takeRoleSwitchLocked(usb);
+        latencyMs = usb->mLastRoleSwitchLatencyMs;
     }
+    /*
+     * Pending before the write, the partner added uevent can arrive as soon as it is done. The
+     * event loop defers an outcome reported before the write returns rather than waiting for it.
+     */
+    usb->mRoleSwitch.pending = true;
+    usb->mRoleSwitch.writing = true;
+    usb->mRoleSwitch.deferredOutcome = NULL;
+    usb->mRoleSwitch.portName = portName;
+    usb->mRoleSwitch.role = in_role;
+    usb->mRoleSwitch.transactionId = transactionId;
+    usb->mRoleSwitch.start = std::chrono::steady_clock::now();
+    pthread_mutex_unlock(&usb->mRoleSwitchStateLock);
+
+    if (superseded.pending)
+        completeRoleSwitch(usb, superseded, latencyMs, Status::ERROR, "superseded", false);
 
     fp = fopen(filename.c_str(), "w");
     if (fp != NULL) {
-        // Hold the lock here to prevent loosing connected signals
-        // as once the file is written the partner added signal
-        // can arrive anytime.
-        pthread_mutex_lock(&usb->mPartnerLock);
-        usb->mPartnerUp = false;
         int ret = fputs(convertRoletoString(in_role).c_str(), fp);
         fclose(fp);
 
-        if (ret != EOF) {
-            struct timespec to;
-            struct timespec now;
-
-        wait_again:
-            clock_gettime(CLOCK_MONOTONIC, &now);
-            to.tv_sec = now.tv_sec + PORT_TYPE_TIMEOUT;
-            to.tv_nsec = now.tv_nsec;
-
-            int err = pthread_cond_timedwait(&usb->mPartnerCV, &usb->mPartnerLock, &to);
-            // There are no uevent signals which implies role swap timed out.
-            if (err == ETIMEDOUT) {
-                ALOGI("uevents wait timedout");
-                // Validity check.
-            } else if (!usb->mPartnerUp) {
-                goto wait_again;
-                // Role switch succeeded since usb->mPartnerUp is true.
-            } else {
-                roleSwitch = true;
-            }
-        } else {
+        written = ret != EOF;
+        if (!written)
             ALOGI("Role switch failed while wrting to file");
-        }
-        pthread_mutex_unlock(&usb->mPartnerLock);
     }
 
-    if (!roleSwitch)
-        switchToDrp(string(portName.c_str()));
+    pthread_mutex_lock(&usb->mRoleSwitchStateLock);
+    usb->mRoleSwitch.writing = false;
+    if (written && usb->mRoleSwitch.deferredOutcome == NULL) {
+        usb->mEventLoop.armTimer(usb->mRoleSwitchTimer, PORT_TYPE_TIMEOUT * 1000);
+        pthread_mutex_unlock(&usb->mRoleSwitchStateLock);
+        return;
+    }
+    if (written) {
+        status = usb->mRoleSwitch.deferredStatus;
+        outcome = usb->mRoleSwitch.deferredOutcome;
+    }
+    RoleSwitchRequest request = takeRoleSwitchLocked(usb);
+    latencyMs = usb->mLastRoleSwitchLatencyMs;
+    pthread_mutex_unlock(&usb->mRoleSwitchStateLock);
 
-    return roleSwitch;
+    completeRoleSwitch(usb, request, latencyMs, status, outcome, true);
 }
 
 void updatePortStatus(android::hardware::usb::Usb *usb) {
     std::vector<PortStatus> currentPortStatus;
 
-    queryVersionHelper(usb, &currentPortStatus);
+    // Only the data session compliance warnings changed, which are not read from sysfs
+    queryVersionHelper(usb, 0, false, &currentPortStatus);
 }
 
 Usb::Usb()
     : mLock(PTHREAD_MUTEX_INITIALIZER),
       mRoleSwitchLock(PTHREAD_MUTEX_INITIALIZER),
-      mPartnerLock(PTHREAD_MUTEX_INITIALIZER),
-      mPartnerUp(false),
-      mUsbDataSessionMonitor(kUdcUeventRegex, kUdcStatePath, kHost1UeventRegex, kHost1StatePath,
-                             kHost2UeventRegex, kHost2StatePath, kDataRolePath,
+      mRoleSwitchStateLock(PTHREAD_MUTEX_INITIALIZER),
+      mRoleSwitch(),
+      mLastRoleSwitchLatencyMs(-1),
+      mPortStatusStale(PORT_STATUS_ALL),
+      mPortsResult(Status::ERROR),
+      mPowerTransferLimited(false),
+      mNotifiedResult(Status::ERROR),
+      mPendingPortChange(0),
+      mPortStatusMerged(0),
+      mPortStatusSuppressed(0),
+      mUeventSubscription(-1),
+      mUsbDataSessionMonitor(&mEventLoop, kUdcUeventRegex, kUdcStatePath, kHost1UeventRegex,
+                             kHost1StatePath, kHost2UeventRegex, kHost2StatePath, kDataRolePath,
                              std::bind(&updatePortStatus, this)),
       mOverheat(ZoneInfo(TemperatureType::USB_PORT, kThermalZoneForTrip,
                          ThrottlingSeverity::CRITICAL),
@@ -535,44 +625,45 @@ Usb::Usb()
                  ZoneInfo(TemperatureType::UNKNOWN, kThermalZoneForTempReadSecondary2,
                           ThrottlingSeverity::NONE)}, kSamplingIntervalSec),
       mUsbDataEnabled(true),
-      mDisplayPortPollRunning(false),
-      mDisplayPortPollStarting(false),
-      mDisplayPortCVLock(PTHREAD_MUTEX_INITIALIZER),
+      mDisplayPort(
+          [this](DisplayPortAttribute attribute, string *value) {
+              return readDisplayPortWatched(attribute, value);
+          },
+          [](const string &attribute, const string &value) {
+              return WriteStringToFile(value, string(kDisplayPortDrmPath) + attribute);
+          }),
+      mDisplayPortFirstSetupDone(false),
       mDisplayPortLock(PTHREAD_MUTEX_INITIALIZER) {
-    pthread_condattr_t attr;
-    if (pthread_condattr_init(&attr)) {
-        ALOGE("pthread_condattr_init failed: %s", strerror(errno));
-        abort();
-    }
-    if (pthread_condattr_setclock(&attr, CLOCK_MONOTONIC)) {
-        ALOGE("pthread_condattr_setclock failed: %s", strerror(errno));
-        abort();
-    }
-    if (pthread_cond_init(&mPartnerCV, &attr)) {
-        ALOGE("pthread_cond_init failed: %s", strerror(errno));
-        abort();
-    }
-    if (pthread_cond_init(&mDisplayPortCV, &attr)) {
-        ALOGE("usbdp: pthread_cond_init failed: %s", strerror(errno));
-        abort();
-    }
-    if (pthread_condattr_destroy(&attr)) {
-        ALOGE("pthread_condattr_destroy failed: %s", strerror(errno));
+    mDisplayPortDebounceTimer = mEventLoop.createTimer([this]() {
+        std::vector<PortStatus> currentPortStatus;
+
+        ALOGI("usbdp: dp debounce triggered");
+        // An unchanged status is not a notification, so it is not timed as one
+        if (!queryVersionHelper(this, PORT_STATUS_DISPLAYPORT, false, &currentPortStatus)) {
+            return;
+        }
+        pthread_mutex_lock(&mDisplayPortLock);
+        mDisplayPort.recordStage(DISPLAYPORT_STAGE_NOTIFY, mDisplayPort.changeTime());
+        pthread_mutex_unlock(&mDisplayPortLock);
+    });
+    if (mDisplayPortDebounceTimer == -1) {
+        ALOGE("mDisplayPortDebounceTimer setup failed");
         abort();
     }
-    mDisplayPortEventPipe = eventfd(0, EFD_NONBLOCK);
-    if (mDisplayPortEventPipe == -1) {
-        ALOGE("mDisplayPortEventPipe eventfd failed: %s", strerror(errno));
+    mDisplayPortActivateTimer =
+            mEventLoop.createTimer([this]() { displayPortActivateCheck(this); });
+    if (mDisplayPortActivateTimer == -1) {
+        ALOGE("mDisplayPortActivateTimer setup failed");
         abort();
     }
-    mDisplayPortDebounceTimer = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
-    if (mDisplayPortDebounceTimer == -1) {
-        ALOGE("mDisplayPortDebounceTimer timerfd failed: %s", strerror(errno));
+    mPortChangeTimer = mEventLoop.createTimer([this]() { handlePendingPortChange(this); });
+    if (mPortChangeTimer == -1) {
+        ALOGE("mPortChangeTimer setup failed");
         abort();
     }
-    mDisplayPortActivateTimer = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
-    if (mDisplayPortActivateTimer == -1) {
-        ALOGE("mDisplayPortActivateTimer timerfd failed: %s", strerror(errno));
+    mRoleSwitchTimer = mEventLoop.createTimer([this]() { expireRoleSwitch(this); });
+    if (mRoleSwitchTimer == -1) {
+        ALOGE("mRoleSwitchTimer setup failed");
         abort();
     }
 }
@@ -593,40 +684,42 @@ ScopedAStatus Usb::switchRole(const string& in_portName, const PortRole& in_role
 
     ALOGI("filename write: %s role:%s", filename.c_str(), convertRoletoString(in_role).c_str());
 
+    // Completes asynchronously through notifyRoleSwitchStatus()
     if (in_role.getTag() == PortRole::mode) {
-        roleSwitch = switchMode(in_portName, in_role, this);
-    } else {
-        fp = fopen(filename.c_str(), "w");
-        if (fp != NULL) {
-            int ret = fputs(convertRoletoString(in_role).c_str(), fp);
-            fclose(fp);
-            if ((ret != EOF) && ReadFileToString(filename, &written)) {
-                written = Trim(written);
-                extractRole(&written);
-                ALOGI("written: %s", written.c_str());
-                if (written == convertRoletoString(in_role)) {
-                    roleSwitch = true;
-                } else {
-                    ALOGE("Role switch failed");
-                }
+        startSwitchMode(this, in_portName, in_role, in_transactionId);
+        pthread_mutex_unlock(&mRoleSwitchLock);
+        return ScopedAStatus::ok();
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    fp = fopen(filename.c_str(), "w");
+    if (fp != NULL) {
+        int ret = fputs(convertRoletoString(in_role).c_str(), fp);
+        fclose(fp);
+        if ((ret != EOF) && ReadFileToString(filename, &written)) {
+            written = Trim(written);
+            extractRole(&written);
+            ALOGI("written: %s", written.c_str());
+            if (written == convertRoletoString(in_role)) {
+                roleSwitch = true;
             } else {
-                ALOGE("failed to update the new role");
+                ALOGE("Role switch failed");
             }
         } else {
-            ALOGE("fopen failed");
+            ALOGE("failed to update the new role");
         }
-    }
-
-    pthread_mutex_lock(&mLock);
-    if (mCallback != NULL) {
-         ScopedAStatus ret = mCallback->notifyRoleSwitchStatus(
-            in_portName, in_role, roleSwitch ? Status::SUCCESS : Status::ERROR, in_transactionId);
-        if (!ret.isOk())
-            ALOGE("RoleSwitchStatus error %s", ret.getDescription().c_str());
     } else {
-        ALOGE("Not notifying the userspace. Callback is not set");
+        ALOGE("fopen failed");
     }
-    pthread_mutex_unlock(&mLock);
+    int64_t latencyMs = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - start).count();
+    ALOGI("role switch took %" PRId64 "ms", latencyMs);
+    pthread_mutex_lock(&mRoleSwitchStateLock);
+    mLastRoleSwitchLatencyMs = latencyMs;
+    pthread_mutex_unlock(&mRoleSwitchStateLock);
+
+    notifyRoleSwitch(this, in_portName, in_role, roleSwitch ? Status::SUCCESS : Status::ERROR,
+                     in_transactionId);
     pthread_mutex_unlock(&mRoleSwitchLock);
 
     return ScopedAStatus::ok();
@@ -636,31 +729,23 @@ ScopedAStatus Usb::limitPowerTransfer(const string& in_portName, bool in_limit,
         int64_t in_transactionId) {
     bool sessionFail = false, success;
     std::vector<PortStatus> currentPortStatus;
-    string path, sinkLimitEnablePath, currentLimitPath, sourceLimitEnablePath;
-
-    getI2cBusHelper(&path);
-    sinkLimitEnablePath = kI2CPath + path + "/" + path + kSinkLimitEnable;
-    currentLimitPath = kI2CPath + path + "/" + path + kSinkLimitCurrent;
-    sourceLimitEnablePath = kI2CPath + path + "/" + path + kSourceLimitEnable;
 
     pthread_mutex_lock(&mLock);
     if (in_limit) {
-        success = WriteStringToFile("0", currentLimitPath);
+        success = tcpcNode.writeAttribute(kSinkLimitCurrent, "0");
         if (!success) {
             ALOGE("Failed to set sink current limit");
             sessionFail = true;
         }
     }
-    success = WriteStringToFile(in_limit ? "1" : "0", sinkLimitEnablePath);
+    success = tcpcNode.writeAttribute(kSinkLimitEnable, in_limit ? "1" : "0");
     if (!success) {
-        ALOGE("Failed to %s sink current limit: %s", in_limit ? "enable" : "disable",
-              sinkLimitEnablePath.c_str());
+        ALOGE("Failed to %s sink current limit", in_limit ? "enable" : "disable");
         sessionFail = true;
     }
-    success = WriteStringToFile(in_limit ? "1" : "0", sourceLimitEnablePath);
+    success = tcpcNode.writeAttribute(kSourceLimitEnable, in_limit ? "1" : "0");
     if (!success) {
-        ALOGE("Failed to %s source current limit: %s", in_limit ? "enable" : "disable",
-              sourceLimitEnablePath.c_str());
+        ALOGE("Failed to %s source current limit", in_limit ? "enable" : "disable");
         sessionFail = true;
     }
 
@@ -676,25 +761,23 @@ ScopedAStatus Usb::limitPowerTransfer(const string& in_portName, bool in_limit,
     }
 
     pthread_mutex_unlock(&mLock);
-    queryVersionHelper(this, &currentPortStatus);
+    queryVersionHelper(this, PORT_STATUS_POWER_TRANSFER, false, &currentPortStatus);
 
     return ScopedAStatus::ok();
 }
 
-Status queryPowerTransferStatus(std::vector<PortStatus> *currentPortStatus) {
-    string limitedPath, enabled, path;
+Status queryPowerTransferStatus(bool *limited) {
+    string enabled;
 
-    getI2cBusHelper(&path);
-    limitedPath = kI2CPath + path + "/" + path + kSinkLimitEnable;
-    if (!ReadFileToString(limitedPath, &enabled)) {
+    if (!tcpcNode.readAttribute(kSinkLimitEnable, &enabled)) {
         ALOGE("Failed to open limit_sink_enable");
         return Status::ERROR;
     }
 
     enabled = Trim(enabled);
-    (*currentPortStatus)[0].powerTransferLimited = enabled == "1";
+    *limited = enabled == "1";
 
-    ALOGI("powerTransferLimited:%d", (*currentPortStatus)[0].powerTransferLimited ? 1 : 0);
+    ALOGI("powerTransferLimited:%d", *limited ? 1 : 0);
     return Status::SUCCESS;
 }
 
@@ -1027,10 +1110,9 @@ Status queryPartnerSvids(std::vector<string> *svids) {
 
 // Only care about first port which must support DisplayPortAltMode
 Status queryDisplayPortStatus(android::hardware::usb::Usb *usb,
-                              std::vector<PortStatus> *currentPortStatus) {
+                              AltModeData::DisplayPortAltModeData *dpData) {
     string hpd, pinAssign, linkStatus, vdo;
     string path;
-    AltModeData::DisplayPortAltModeData dpData;
 
     /*
     * We check if the DisplayPort Alt Mode sysfs nodes exist. If they don't, then it means that the
@@ -1046,7 +1128,7 @@ Status queryDisplayPortStatus(android::hardware::usb::Usb *usb,
         if (queryPartnerSvids(&svids) == Status::SUCCESS) {
             if (std::count(svids.begin(), svids.end(), SVID_THUNDERBOLT) &&
                 !std::count(svids.begin(), svids.end(), SVID_DISPLAYPORT)) {
-                dpData.cableStatus = DisplayPortAltModeStatus::NOT_CAPABLE;
+                dpData->cableStatus = DisplayPortAltModeStatus::NOT_CAPABLE;
             }
         }
     } else {
@@ -1055,11 +1137,9 @@ Status queryDisplayPortStatus(android::hardware::usb::Usb *usb,
         usb->readDisplayPortAttribute("vdo", path, &vdo);
         usb->readDisplayPortAttribute("link_status", path, &linkStatus);
 
-        dpData = constructAltModeData(hpd, pinAssign, linkStatus, vdo);
+        *dpData = constructAltModeData(hpd, pinAssign, linkStatus, vdo);
     }
 
-    (*currentPortStatus)[0].supportedAltModes.push_back(dpData);
-
     return Status::SUCCESS;
 }
 
@@ -1075,41 +1155,114 @@ void queryUsbDataSession(android::hardware::usb::Usb *usb,
         warnings.end());
 }
 
-void queryVersionHelper(android::hardware::usb::Usb *usb,
+// Builds the port status from the cached parts. Only touches memory. Called with mLock held.
+static void buildPortStatus(android::hardware::usb::Usb *usb,
+                            std::vector<PortStatus> *currentPortStatus) {
+    *currentPortStatus = usb->mPorts;
+    for (PortStatus &port : *currentPortStatus) {
+        port.supportsComplianceWarnings = true;
+        auto warnings = usb->mChargerWarnings.find(port.portName);
+        if (warnings == usb->mChargerWarnings.end() || warnings->second.empty())
+            continue;
+
+        port.complianceWarnings = warnings->second;
+        if (port.currentPowerRole == PortPowerRole::NONE) {
+            port.currentMode = PortMode::UFP;
+            port.currentPowerRole = PortPowerRole::SINK;
+            port.currentDataRole = PortDataRole::NONE;
+            port.powerBrickStatus = PowerBrickStatus::CONNECTED;
+        }
+    }
+    if (currentPortStatus->empty())
+        return;
+
+    PortStatus &port0 = (*currentPortStatus)[0];
+    port0.supportedContaminantProtectionModes =
+        usb->mContaminantStatus.supportedContaminantProtectionModes;
+    port0.contaminantProtectionStatus = usb->mContaminantStatus.contaminantProtectionStatus;
+    port0.contaminantDetectionStatus = usb->mContaminantStatus.contaminantDetectionStatus;
+    port0.supportsEnableContaminantPresenceDetection =
+        usb->mContaminantStatus.supportsEnableContaminantPresenceDetection;
+    port0.supportsEnableContaminantPresenceProtection =
+        usb->mContaminantStatus.supportsEnableContaminantPresenceProtection;
+    port0.powerTransferLimited = usb->mPowerTransferLimited;
+    queryUsbDataSession(usb, currentPortStatus);
+    port0.supportedAltModes.push_back(usb->mDisplayPortAltMode);
+}
+
+/*
+ * Re-reads the parts of the cached port status in changed, along with any part that went stale
+ * while no callback was registered, and rebuilds currentPortStatus from the cache. The framework
+ * is only notified when the status differs from the last notification, unless force is set.
+ * Returns true if the framework was notified.
+ */
+bool queryVersionHelper(android::hardware::usb::Usb *usb, uint32_t changed, bool force,
                         std::vector<PortStatus> *currentPortStatus) {
-    Status status;
     string displayPortUsbPath;
+    bool notified = false;
 
     pthread_mutex_lock(&usb->mLock);
-    status = getPortStatusHelper(usb, currentPortStatus);
-    queryMoistureDetectionStatus(currentPortStatus);
-    queryPowerTransferStatus(currentPortStatus);
-    queryNonCompliantChargerStatus(currentPortStatus);
-    queryUsbDataSession(usb, currentPortStatus);
+    changed |= usb->mPortStatusStale;
+    usb->mPortStatusStale = 0;
+    if (changed & PORT_STATUS_PORTS) {
+        usb->mPorts.clear();
+        usb->mPortsResult = getPortStatusHelper(usb, &usb->mPorts);
+        // Ports may have come or gone
+        changed |= PORT_STATUS_COMPLIANCE;
+    }
+    if (changed & PORT_STATUS_CONTAMINANT) {
+        usb->mContaminantStatus = PortStatus();
+        queryMoistureDetectionStatus(&usb->mContaminantStatus);
+    }
+    if (changed & PORT_STATUS_POWER_TRANSFER) {
+        queryPowerTransferStatus(&usb->mPowerTransferLimited);
+    }
+    if (changed & PORT_STATUS_COMPLIANCE) {
+        usb->mChargerWarnings.clear();
+        for (const PortStatus &port : usb->mPorts) {
+            queryNonCompliantChargerStatus(port.portName, &usb->mChargerWarnings[port.portName]);
+        }
+    }
     pthread_mutex_lock(&usb->mDisplayPortLock);
     if (!usb->mDisplayPortFirstSetupDone &&
         usb->getDisplayPortUsbPathHelper(&displayPortUsbPath) == Status::SUCCESS) {
 
         ALOGI("usbdp: boot with display connected or usb hal restarted");
-        usb->setupDisplayPortPoll();
+        usb->armDisplayPort();
     }
     pthread_mutex_unlock(&usb->mDisplayPortLock);
-    queryDisplayPortStatus(usb, currentPortStatus);
-    if (usb->mCallback != NULL) {
+    if (changed & PORT_STATUS_DISPLAYPORT) {
+        usb->mDisplayPortAltMode = AltModeData::DisplayPortAltModeData();
+        queryDisplayPortStatus(usb, &usb->mDisplayPortAltMode);
+    }
+
+    buildPortStatus(usb, currentPortStatus);
+    if (usb->mCallback == NULL) {
+        // Uevents are not handled without a callback, so the cache cannot be trusted later
+        usb->mPortStatusStale = PORT_STATUS_ALL;
+        ALOGI("Notifying userspace skipped. Callback is NULL");
+    } else if (!force && *currentPortStatus == usb->mNotifiedPortStatus &&
+               usb->mPortsResult == usb->mNotifiedResult) {
+        usb->mPortStatusSuppressed++;
+        ALOGV("Notifying userspace skipped. Port status unchanged");
+    } else {
         ScopedAStatus ret = usb->mCallback->notifyPortStatusChange(*currentPortStatus,
-            status);
+            usb->mPortsResult);
         if (!ret.isOk())
             ALOGE("queryPortStatus error %s", ret.getDescription().c_str());
-    } else {
-        ALOGI("Notifying userspace skipped. Callback is NULL");
+        usb->mNotifiedPortStatus = *currentPortStatus;
+        usb->mNotifiedResult = usb->mPortsResult;
+        notified = true;
     }
     pthread_mutex_unlock(&usb->mLock);
+    return notified;
 }
 
 ScopedAStatus Usb::queryPortStatus(int64_t in_transactionId) {
     std::vector<PortStatus> currentPortStatus;
 
-    queryVersionHelper(this, &currentPortStatus);
+    // Served from the uevent driven cache, but always reported to the framework
+    queryVersionHelper(this, 0, true, &currentPortStatus);
     pthread_mutex_lock(&mLock);
     if (mCallback != NULL) {
         ScopedAStatus ret = mCallback->notifyQueryPortStatus(
@@ -1131,7 +1284,7 @@ ScopedAStatus Usb::enableContaminantPresenceDetection(const string& in_portName,
     bool success = true;
 
     if (disable != "true")
-        success = WriteStringToFile(in_enable ? "1" : "0", enabledPath);
+        success = tcpcNode.writeAttribute(kContaminantDetectionPath, in_enable ? "1" : "0");
 
     pthread_mutex_lock(&mLock);
     if (mCallback != NULL) {
@@ -1144,7 +1297,7 @@ ScopedAStatus Usb::enableContaminantPresenceDetection(const string& in_portName,
     }
     pthread_mutex_unlock(&mLock);
 
-    queryVersionHelper(this, &currentPortStatus);
+    queryVersionHelper(this, PORT_STATUS_CONTAMINANT, false, &currentPortStatus);
     return ScopedAStatus::ok();
 }
 
@@ -1181,172 +1334,113 @@ void report_overheat_event(android::hardware::usb::Usb *usb) {
     }
 }
 
-struct data {
-    int uevent_fd;
-    ::aidl::android::hardware::usb::Usb *usb;
-};
-
-enum UeventType { UNKNOWN, BIND, CHANGE };
-
-enum UeventType matchUeventType(char* str) {
-    if (!strncmp(str, "ACTION=bind", strlen("ACTION=bind"))) {
-        return UeventType::BIND;
-    } else if (!strncmp(str, "ACTION=change", strlen("ACTION=change"))) {
-        return UeventType::CHANGE;
+/*
+ * Queues a port status refresh of the changed parts. The refresh runs once the coalescing window
+ * that the first queued change opened closes, so a burst of uevents costs one sysfs read and at
+ * most one notification. Runs on the event loop thread.
+ */
+static void queuePortChange(android::hardware::usb::Usb *usb, uint32_t changed) {
+    if (usb->mPendingPortChange != 0) {
+        usb->mPortStatusMerged++;
+    } else {
+        usb->mEventLoop.armTimer(usb->mPortChangeTimer, kPortStatusCoalesceMs);
     }
-    return UeventType::UNKNOWN;
+    usb->mPendingPortChange |= changed;
 }
 
-static void uevent_event(uint32_t /*epevents*/, struct data *payload) {
-    char msg[UEVENT_MSG_LEN + 2];
-    char *cp;
-    int n;
-    enum UeventType uevent_type = UeventType::UNKNOWN;
-
-    n = uevent_kernel_multicast_recv(payload->uevent_fd, msg, UEVENT_MSG_LEN);
-    if (n <= 0)
-        return;
-    if (n >= UEVENT_MSG_LEN) /* overflow -- discard */
-        return;
-
-    msg[n] = '\0';
-    msg[n + 1] = '\0';
-    cp = msg;
-
-    while (*cp) {
-        if (std::regex_match(cp, std::regex("(add)(.*)(-partner)"))) {
-            ALOGI("partner added");
-            pthread_mutex_lock(&payload->usb->mPartnerLock);
-            payload->usb->mPartnerUp = true;
-            pthread_cond_signal(&payload->usb->mPartnerCV);
-            pthread_mutex_unlock(&payload->usb->mPartnerLock);
-        } else if (!strncmp(cp, "DEVTYPE=typec_", strlen("DEVTYPE=typec_")) ||
-                   !strncmp(cp, "DRIVER=max77759tcpc",
-                            strlen("DRIVER=max77759tcpc")) ||
-                   !strncmp(cp, "DRIVER=pogo-transport",
-                            strlen("DRIVER=pogo-transport")) ||
-                   !strncmp(cp, "POWER_SUPPLY_NAME=usb",
-                            strlen("POWER_SUPPLY_NAME=usb"))) {
-            std::vector<PortStatus> currentPortStatus;
-            queryVersionHelper(payload->usb, &currentPortStatus);
-
-            // Role switch is not in progress and port is in disconnected state
-            if (!pthread_mutex_trylock(&payload->usb->mRoleSwitchLock)) {
-                for (unsigned long i = 0; i < currentPortStatus.size(); i++) {
-                    DIR *dp =
-                        opendir(string("/sys/class/typec/" +
-                                            string(currentPortStatus[i].portName.c_str()) +
-                                            "-partner").c_str());
-                    if (dp == NULL) {
-                        switchToDrp(currentPortStatus[i].portName);
-                    } else {
-                        closedir(dp);
-                    }
-                }
-                pthread_mutex_unlock(&payload->usb->mRoleSwitchLock);
-            }
-            if (!strncmp(cp, "DRIVER=max77759tcpc", strlen("DRIVER=max77759tcpc"))
-                       && payload->usb->mDisplayPortPollRunning) {
-                uint64_t flag = DISPLAYPORT_IRQ_HPD_COUNT_CHECK;
-
-                ALOGI("usbdp: DISPLAYPORT_IRQ_HPD_COUNT_CHECK sent");
-                write(payload->usb->mDisplayPortEventPipe, &flag, sizeof(flag));
-            }
-            /*if (!!strncmp(cp, "DEVTYPE=typec_alternate_mode", strlen("DEVTYPE=typec_alternate_mode"))) {
-                break;
-            }*/
-        } else if (!strncmp(cp, kOverheatStatsDev, strlen(kOverheatStatsDev))) {
-            ALOGV("Overheat Cooling device suez update");
-            report_overheat_event(payload->usb);
-        } else if (!(strncmp(cp, "ACTION=", strlen("ACTION=")))) {
-            uevent_type = matchUeventType(cp);
-        } else if (!strncmp(cp, "DRIVER=typec_displayport", strlen("DRIVER=typec_displayport"))) {
-            if (uevent_type == UeventType::BIND) {
-                pthread_mutex_lock(&payload->usb->mDisplayPortLock);
-                payload->usb->setupDisplayPortPoll();
-                pthread_mutex_unlock(&payload->usb->mDisplayPortLock);
-            } else if (uevent_type == UeventType::CHANGE) {
-                pthread_mutex_lock(&payload->usb->mDisplayPortLock);
-                payload->usb->shutdownDisplayPortPoll(false);
-                pthread_mutex_unlock(&payload->usb->mDisplayPortLock);
+void handlePendingPortChange(android::hardware::usb::Usb *usb) {
+    std::vector<PortStatus> currentPortStatus;
+    uint32_t changed = usb->mPendingPortChange;
+
+    usb->mPendingPortChange = 0;
+    queryVersionHelper(usb, changed, false, &currentPortStatus);
+    ALOGV("port status refreshed: merged:%" PRIu64 " suppressed:%" PRIu64,
+          usb->mPortStatusMerged.load(), usb->mPortStatusSuppressed.load());
+
+    // Role switch is not in progress and port is in disconnected state
+    if (!pthread_mutex_trylock(&usb->mRoleSwitchLock)) {
+        pthread_mutex_lock(&usb->mRoleSwitchStateLock);
+        bool pending = usb->mRoleSwitch.pending;
+        pthread_mutex_unlock(&usb->mRoleSwitchStateLock);
+
+        for (unsigned long i = 0; i < currentPortStatus.size() && !pending; i++) {
+            DIR *dp =
+                opendir(string("/sys/class/typec/" +
+                                    string(currentPortStatus[i].portName.c_str()) +
+                                    "-partner").c_str());
+            if (dp == NULL) {
+                switchToDrp(currentPortStatus[i].portName);
+            } else {
+                closedir(dp);
             }
-            break;
-        }
-        /* advance to after the next \0 */
-        while (*cp++) {
         }
+        pthread_mutex_unlock(&usb->mRoleSwitchLock);
     }
 }
 
-void *work(void *param) {
-    int epoll_fd, uevent_fd;
-    struct epoll_event ev;
-    int nevents = 0;
-    struct data payload;
-
-    ALOGE("creating thread");
-
-    uevent_fd = uevent_open_socket(64 * 1024, true);
-
-    if (uevent_fd < 0) {
-        ALOGE("uevent_init: uevent_open_socket failed\n");
-        return NULL;
-    }
-
-    payload.uevent_fd = uevent_fd;
-    payload.usb = (::aidl::android::hardware::usb::Usb *)param;
-
-    fcntl(uevent_fd, F_SETFL, O_NONBLOCK);
-
-    ev.events = EPOLLIN;
-    ev.data.ptr = (void *)uevent_event;
-
-    epoll_fd = epoll_create(64);
-    if (epoll_fd == -1) {
-        ALOGE("epoll_create failed; errno=%d", errno);
-        goto error;
-    }
-
-    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, uevent_fd, &ev) == -1) {
-        ALOGE("epoll_ctl failed; errno=%d", errno);
-        goto error;
-    }
-
-    while (!destroyThread) {
-        struct epoll_event events[64];
-
-        nevents = epoll_wait(epoll_fd, events, 64, -1);
-        if (nevents == -1) {
-            if (errno == EINTR)
-                continue;
-            ALOGE("usb epoll_wait failed; errno=%d", errno);
-            break;
-        }
+static void uevent_event(android::hardware::usb::Usb *usb, const char *msg) {
+    enum UeventType uevent_type = UeventType::UNKNOWN;
 
-        for (int n = 0; n < nevents; ++n) {
-            if (events[n].data.ptr)
-                (*(void (*)(int, struct data *payload))events[n].data.ptr)(events[n].events,
-                                                                           &payload);
+    forEachUeventLine(msg, [usb, &uevent_type](UeventLine line, std::string_view value) {
+        switch (line) {
+            case UeventLine::PARTNER_ADDED:
+                ALOGI("partner added");
+                finishRoleSwitch(usb, Status::SUCCESS, "succeeded");
+                break;
+            case UeventLine::TYPEC_CHANGED:
+                queuePortChange(usb, PORT_STATUS_PORTS | PORT_STATUS_DISPLAYPORT);
+                break;
+            case UeventLine::TCPC_CHANGED:
+                queuePortChange(usb, PORT_STATUS_CONTAMINANT | PORT_STATUS_POWER_TRANSFER |
+                                         PORT_STATUS_COMPLIANCE);
+                // irq_hpd is not coalesced, the DisplayPort worker has to see every one
+                displayPortIrqHpd(usb);
+                break;
+            case UeventLine::PORT_CHANGED:
+                queuePortChange(usb, PORT_STATUS_PORTS);
+                break;
+            case UeventLine::OVERHEAT:
+                ALOGV("Overheat Cooling device suez update");
+                report_overheat_event(usb);
+                break;
+            case UeventLine::ACTION:
+                uevent_type = matchUeventType(value);
+                break;
+            case UeventLine::DEVPATH:
+                // Unbind uevents carry no DRIVER line, so the TCPC is recognized by its devpath
+                if ((uevent_type == UeventType::BIND || uevent_type == UeventType::UNBIND) &&
+                    tcpcNode.isDevpath(value)) {
+                    ALOGI("tcpc driver %s", uevent_type == UeventType::BIND ? "bound" : "unbound");
+                    tcpcNode.invalidate();
+                }
+                break;
+            case UeventLine::DISPLAYPORT_DRIVER:
+                if (uevent_type == UeventType::BIND) {
+                    pthread_mutex_lock(&usb->mDisplayPortLock);
+                    usb->armDisplayPort();
+                    pthread_mutex_unlock(&usb->mDisplayPortLock);
+                } else if (uevent_type == UeventType::CHANGE) {
+                    pthread_mutex_lock(&usb->mDisplayPortLock);
+                    usb->disarmDisplayPort(false);
+                    pthread_mutex_unlock(&usb->mDisplayPortLock);
+                }
+                return false;
+            case UeventLine::IGNORED:
+                break;
         }
-    }
-
-    ALOGI("exiting worker thread");
-error:
-    close(uevent_fd);
-
-    if (epoll_fd >= 0)
-        close(epoll_fd);
-
-    return NULL;
+        return true;
+    });
 }
 
-void sighandler(int sig) {
-    if (sig == SIGUSR1) {
-        destroyThread = true;
-        ALOGI("destroy set");
-        return;
-    }
-    signal(SIGUSR1, sighandler);
+/*
+ * Any part of the port status may have changed in the uevents that were dropped, so none of the
+ * cache can be trusted until it is re-read.
+ */
+static void uevents_lost(android::hardware::usb::Usb *usb) {
+    pthread_mutex_lock(&usb->mLock);
+    usb->mPortStatusStale = PORT_STATUS_ALL;
+    pthread_mutex_unlock(&usb->mLock);
+    queuePortChange(usb, PORT_STATUS_ALL);
 }
 
 ScopedAStatus Usb::setCallback(const shared_ptr<IUsbCallback>& in_callback) {
@@ -1362,23 +1456,27 @@ ScopedAStatus Usb::setCallback(const shared_ptr<IUsbCallback>& in_callback) {
     ALOGI("registering callback");
 
     if (mCallback == NULL) {
-        if  (!pthread_kill(mPoll, SIGUSR1)) {
-            pthread_join(mPoll, NULL);
-            ALOGI("pthread destroyed");
-        }
+        mEventLoop.unsubscribeUevents(mUeventSubscription);
+        mUeventSubscription = -1;
+        // Nothing keeps the cached port status up to date until the next callback
+        mPortStatusStale = PORT_STATUS_ALL;
+        mNotifiedPortStatus.clear();
+        ALOGI("uevent handler unsubscribed");
         pthread_mutex_unlock(&mLock);
+        // Without uevents a pending mode switch can only time out
+        finishRoleSwitch(this, Status::ERROR, "cancelled");
         return ScopedAStatus::ok();
     }
 
-    destroyThread = false;
-    signal(SIGUSR1, sighandler);
-
     /*
-     * Create a background thread if the old callback value is NULL
+     * Start handling uevents on the shared event loop if the old callback value is NULL
      * and being updated with a new value.
      */
-    if (pthread_create(&mPoll, NULL, work, this)) {
-        ALOGE("pthread creation failed %d", errno);
+    mUeventSubscription = mEventLoop.subscribeUevents(
+        kUeventDevpathPrefixes, [this](const char *msg) { uevent_event(this, msg); },
+        [this]() { uevents_lost(this); });
+    if (mUeventSubscription == -1) {
+        ALOGE("uevent subscription failed");
         mCallback = NULL;
     }
 
@@ -1437,82 +1535,6 @@ error:
     return Status::ERROR;
 }
 
-Status Usb::writeDisplayPortAttributeOverride(string attribute, string value) {
-    string attrDrmPath;
-
-    // Get Drm Path
-    attrDrmPath = string(kDisplayPortDrmPath) + attribute;
-
-    // Write to drm
-    if(!WriteStringToFile(value, attrDrmPath)) {
-        ALOGE("usbdp: Failed to write attribute %s to drm: %s", attribute.c_str(), value.c_str());
-        return Status::ERROR;
-    }
-    ALOGI("usbdp: Successfully wrote attribute %s: %s to drm.", attribute.c_str(), value.c_str());
-    return Status::SUCCESS;
-}
-
-Status Usb::writeDisplayPortAttribute(string attribute, string usb_path) {
-    string attrUsb, attrDrm, attrDrmPath;
-
-    // Get Drm Path
-    attrDrmPath = string(kDisplayPortDrmPath) + attribute;
-
-    // Read Attribute
-    if(!ReadFileToString(usb_path, &attrUsb)) {
-        ALOGE("usbdp: Failed to open or read Type-C attribute %s", attribute.c_str());
-        return Status::ERROR;
-    }
-
-    // Separate Logic for hpd and pin_assignment
-    if (!strncmp(attribute.c_str(), "hpd", strlen("hpd"))) {
-        if (!strncmp(attrUsb.c_str(), "0", strlen("0"))) {
-            // Read DRM attribute to compare
-            if(!ReadFileToString(attrDrmPath, &attrDrm)) {
-                ALOGE("usbdp: Failed to open or read hpd from drm");
-                return Status::ERROR;
-            }
-            if (!strncmp(attrDrm.c_str(), "0", strlen("0"))) {
-                ALOGI("usbdp: Skipping hpd write when drm and usb both equal 0");
-                return Status::SUCCESS;
-            }
-        }
-    } else if (!strncmp(attribute.c_str(), "irq_hpd_count", strlen("irq_hpd_count"))) {
-        uint32_t temp;
-        if (!::android::base::ParseUint(Trim(attrUsb), &temp)) {
-            ALOGE("usbdp: failed parsing irq_hpd_count:%s", attrUsb.c_str());
-            return Status::ERROR;
-        }
-        // Used to cache the values read from tcpci's irq_hpd_count.
-        // Update drm driver when cached value is not the same as the read value.
-        ALOGI("usbdp: mIrqHpdCountCache:%u irq_hpd_count:%u", mIrqHpdCountCache, temp);
-        if (mIrqHpdCountCache == temp) {
-            return Status::SUCCESS;
-        } else {
-            mIrqHpdCountCache = temp;
-        }
-        attrDrmPath = string(kDisplayPortDrmPath) + "irq_hpd";
-    } else if (!strncmp(attribute.c_str(), "pin_assignment", strlen("pin_assignment"))) {
-        size_t pos = attrUsb.find("[");
-        if (pos != string::npos) {
-            ALOGI("usbdp: Modifying Pin Config from %s", attrUsb.c_str());
-            attrUsb = attrUsb.substr(pos+1, 1);
-        } else {
-            // Don't write anything
-            ALOGI("usbdp: Pin config not yet chosen, nothing written.");
-            return Status::ERROR;
-        }
-    }
-
-    // Write to drm
-    if(!WriteStringToFile(attrUsb, attrDrmPath)) {
-        ALOGE("usbdp: Failed to write attribute %s to drm: %s", attribute.c_str(), attrUsb.c_str());
-        return Status::ERROR;
-    }
-    ALOGI("usbdp: Successfully wrote attribute %s: %s to drm.", attribute.c_str(), attrUsb.c_str());
-    return Status::SUCCESS;
-}
-
 bool Usb::determineDisplayPortRetry(string linkPath, string hpdPath) {
     string linkStatus, hpd;
 
@@ -1526,424 +1548,248 @@ bool Usb::determineDisplayPortRetry(string linkPath, string hpdPath) {
     return false;
 }
 
-static int displayPortPollOpenFileHelper(const char *file, int flags) {
-    int fd = open(file, flags);
-    if (fd == -1) {
-        ALOGE("usbdp: worker: open at %s failed; errno=%d", file, errno);
-    }
-    return fd;
-}
-
 /*
- * armTimerFdHelper - Sets timerfd (fd) to trigger after (ms) milliseconds.
- * Setting ms to 0 disarms the timer.
+ * Reads a watched DisplayPort sysfs node through the fd held for epoll. Reading also acknowledges
+ * its sysfs_notify(). Called with mDisplayPortLock held.
  */
-static int armTimerFdHelper(int fd, int ms) {
-    struct itimerspec ts;
-
-    ts.it_interval.tv_sec = 0;
-    ts.it_interval.tv_nsec = 0;
-    ts.it_value.tv_sec = ms / 1000;
-    ts.it_value.tv_nsec = (ms % 1000) * 1000000;
+static bool readDisplayPortFd(const unique_fd &fd, string *value) {
+    char buf[kMaxDisplayPortAttributeSize];
 
-    return timerfd_settime(fd, 0, &ts, NULL);
-}
-
-void *displayPortPollWork(void *param) {
-    /* USB Payload */
-    ::aidl::android::hardware::usb::Usb *usb = (::aidl::android::hardware::usb::Usb *)param;
-    /* Epoll fields */
-    int epoll_fd;
-    struct epoll_event ev_hpd, ev_pin, ev_orientation, ev_eventfd, ev_link, ev_debounce;
-    struct epoll_event ev_activate;
-    int nevents = 0;
-    int hpd_fd, pin_fd, orientation_fd, link_training_status_fd;
-    int file_flags = O_RDONLY;
-    int epoll_flags;
-    /* DisplayPort link statuses */
-    bool orientationSet = false;
-    bool pinSet = false;
-    int activateRetryCount = 0;
-    unsigned long res;
-    int ret = 0;
-    /* File paths */
-    string displayPortUsbPath, irqHpdCountPath, hpdPath, pinAssignmentPath, orientationPath;
-    string tcpcI2cBus, linkPath, partnerActivePath, portActivePath;
-
-    usb->mDisplayPortPollRunning = true;
-    usb->mDisplayPortPollStarting = false;
-
-    /*---------- Setup ----------*/
-
-    if (usb->getDisplayPortUsbPathHelper(&displayPortUsbPath) == Status::ERROR) {
-        ALOGE("usbdp: worker: could not locate usb displayport directory");
-        goto usb_path_error;
+    ssize_t n = TEMP_FAILURE_RETRY(pread(fd.get(), buf, sizeof(buf), 0));
+    if (n < 0) {
+        ALOGE("usbdp: worker: pread failed; errno=%d", errno);
+        return false;
     }
+    value->assign(buf, n);
+    return true;
+}
 
-    ALOGI("usbdp: worker: displayport usb path located at %s", displayPortUsbPath.c_str());
-    hpdPath = displayPortUsbPath + "hpd";
-    pinAssignmentPath = displayPortUsbPath + "pin_assignment";
-    orientationPath = "/sys/class/typec/port0/orientation";
-    linkPath = string(kDisplayPortDrmPath) + "link_status";
-
-    partnerActivePath = displayPortUsbPath + "../mode1/active";
-    portActivePath = "/sys/class/typec/port0/port0.0/mode1/active";
-
-    getI2cBusHelper(&tcpcI2cBus);
-    irqHpdCountPath = kI2CPath + tcpcI2cBus + "/" + tcpcI2cBus + kIrqHpdCounPath;
-    ALOGI("usbdp: worker: irqHpdCountPath:%s", irqHpdCountPath.c_str());
-
-    epoll_fd = epoll_create(64);
-    if (epoll_fd == -1) {
-        ALOGE("usbdp: worker: epoll_create failed; errno=%d", errno);
-        goto epoll_fd_error;
+bool Usb::readDisplayPortWatched(DisplayPortAttribute attribute, string *value) {
+    switch (attribute) {
+        case DisplayPortAttribute::HPD:
+            return readDisplayPortFd(mDisplayPortHpdFd, value);
+        case DisplayPortAttribute::PIN_ASSIGNMENT:
+            return readDisplayPortFd(mDisplayPortPinFd, value);
+        case DisplayPortAttribute::ORIENTATION:
+            return readDisplayPortFd(mDisplayPortOrientationFd, value);
+        case DisplayPortAttribute::LINK_STATUS:
+            return readDisplayPortFd(mDisplayPortLinkFd, value);
     }
+    return false;
+}
 
-    if ((hpd_fd = displayPortPollOpenFileHelper(hpdPath.c_str(), file_flags)) == -1){
-        goto hpd_fd_error;
-    }
-    if ((pin_fd = displayPortPollOpenFileHelper(pinAssignmentPath.c_str(), file_flags)) == -1){
-        goto pin_fd_error;
-    }
-    if ((orientation_fd = displayPortPollOpenFileHelper(orientationPath.c_str(), file_flags))
-            == -1){
-        goto orientation_fd_error;
-    }
-    if ((link_training_status_fd = displayPortPollOpenFileHelper(linkPath.c_str(), file_flags)) == -1){
-        goto link_training_status_fd_error;
+/*
+ * Forwards a changed DisplayPort sysfs attribute to the drm driver and advances the state machine.
+ * Runs on the event loop.
+ */
+static void displayPortAttributeChanged(android::hardware::usb::Usb *usb,
+                                        DisplayPortAttribute attribute) {
+    pthread_mutex_lock(&usb->mDisplayPortLock);
+    if (usb->mDisplayPort.attributeChanged(attribute)) {
+        usb->mEventLoop.armTimer(usb->mDisplayPortDebounceTimer, DISPLAYPORT_STATUS_DEBOUNCE_MS);
     }
+    pthread_mutex_unlock(&usb->mDisplayPortLock);
+}
 
-    // Set epoll_event events and flags
-    epoll_flags = EPOLLIN | EPOLLET;
-    ev_hpd.events = epoll_flags;
-    ev_pin.events = epoll_flags;
-    ev_orientation.events = epoll_flags;
-    ev_eventfd.events = epoll_flags;
-    ev_link.events = epoll_flags;
-    ev_debounce.events = epoll_flags;
-    ev_activate.events = epoll_flags;
-
-    ev_hpd.data.fd = hpd_fd;
-    ev_pin.data.fd = pin_fd;
-    ev_orientation.data.fd = orientation_fd;
-    ev_eventfd.data.fd = usb->mDisplayPortEventPipe;
-    ev_link.data.fd = link_training_status_fd;
-    ev_debounce.data.fd = usb->mDisplayPortDebounceTimer;
-    ev_activate.data.fd = usb->mDisplayPortActivateTimer;
+// Retries the partner activate signal while Alt Mode is active on the port only
+void displayPortActivateCheck(android::hardware::usb::Usb *usb) {
+    string activePartner, activePort;
 
-    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, hpd_fd, &ev_hpd) == -1) {
-        ALOGE("usbdp: worker: epoll_ctl failed to add hpd; errno=%d", errno);
-        goto error;
-    }
-    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, pin_fd, &ev_pin) == -1) {
-        ALOGE("usbdp: worker: epoll_ctl failed to add pin; errno=%d", errno);
-        goto error;
-    }
-    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, orientation_fd, &ev_orientation) == -1) {
-        ALOGE("usbdp: worker: epoll_ctl failed to add orientation; errno=%d", errno);
-        goto error;
-    }
-    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, link_training_status_fd, &ev_link) == -1) {
-        ALOGE("usbdp: worker: epoll_ctl failed to add link status; errno=%d", errno);
-        goto error;
-    }
-    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, usb->mDisplayPortDebounceTimer, &ev_debounce) == -1) {
-        ALOGE("usbdp: worker: epoll_ctl failed to add framework update debounce; errno=%d", errno);
-        goto error;
-    }
-     if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, usb->mDisplayPortActivateTimer, &ev_activate) == -1) {
-        ALOGE("usbdp: worker: epoll_ctl failed to add activate debounce; errno=%d", errno);
-        goto error;
-    }
-    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, usb->mDisplayPortEventPipe, &ev_eventfd) == -1) {
-        ALOGE("usbdp: worker: epoll_ctl failed to add orientation; errno=%d", errno);
-        goto error;
+    pthread_mutex_lock(&usb->mDisplayPortLock);
+    if (usb->mDisplayPort.state() == DisplayPortState::IDLE) {
+        pthread_mutex_unlock(&usb->mDisplayPortLock);
+        return;
     }
-
-    /* Arm timer to see if DisplayPort Alt Mode Activates */
-    armTimerFdHelper(usb->mDisplayPortActivateTimer, DISPLAYPORT_ACTIVATE_DEBOUNCE_MS);
-
-    while (!destroyDisplayPortThread) {
-        struct epoll_event events[64];
-
-        nevents = epoll_wait(epoll_fd, events, 64, -1);
-        if (nevents == -1) {
-            if (errno == EINTR)
-                continue;
-            ALOGE("usbdp: worker: epoll_wait failed; errno=%d", errno);
-            break;
-        }
-
-        for (int n = 0; n < nevents; n++) {
-            if (events[n].data.fd == hpd_fd) {
-                if (!pinSet || !orientationSet) {
-                    ALOGW("usbdp: worker: HPD may be set before pin_assignment and orientation");
-                    if (!pinSet &&
-                        usb->writeDisplayPortAttribute("pin_assignment", pinAssignmentPath) ==
-                        Status::SUCCESS) {
-                        pinSet = true;
-                    }
-                    if (!orientationSet &&
-                        usb->writeDisplayPortAttribute("orientation", orientationPath) ==
-                        Status::SUCCESS) {
-                        orientationSet = true;
-                    }
-                }
-                usb->writeDisplayPortAttribute("hpd", hpdPath);
-                armTimerFdHelper(usb->mDisplayPortDebounceTimer, DISPLAYPORT_STATUS_DEBOUNCE_MS);
-            } else if (events[n].data.fd == pin_fd) {
-                if (usb->writeDisplayPortAttribute("pin_assignment", pinAssignmentPath) ==
-                    Status::SUCCESS) {
-                    pinSet = true;
-                    armTimerFdHelper(usb->mDisplayPortDebounceTimer, DISPLAYPORT_STATUS_DEBOUNCE_MS);
-                }
-            } else if (events[n].data.fd == orientation_fd) {
-                if (usb->writeDisplayPortAttribute("orientation", orientationPath) ==
-                    Status::SUCCESS) {
-                    orientationSet = true;
-                    armTimerFdHelper(usb->mDisplayPortDebounceTimer, DISPLAYPORT_STATUS_DEBOUNCE_MS);
-                }
-            } else if (events[n].data.fd == link_training_status_fd) {
-                armTimerFdHelper(usb->mDisplayPortDebounceTimer, DISPLAYPORT_STATUS_DEBOUNCE_MS);
-            } else if (events[n].data.fd == usb->mDisplayPortDebounceTimer) {
-                std::vector<PortStatus> currentPortStatus;
-                ret = read(usb->mDisplayPortDebounceTimer, &res, sizeof(res));
-                ALOGI("usbdp: dp debounce triggered, val:%lu ret:%d", res, ret);
-                if (ret < 0)
-                    ALOGE("usbdp: debounce read errno:%d", errno);
-                queryVersionHelper(usb, &currentPortStatus);
-            } else if (events[n].data.fd == usb->mDisplayPortActivateTimer) {
-                string activePartner, activePort;
-
-                if (ReadFileToString(partnerActivePath.c_str(), &activePartner) &&
-                    ReadFileToString(portActivePath.c_str(), &activePort)) {
-                    // Retry activate signal when DisplayPort Alt Mode is active on port but not
-                    // partner.
-                    if (!strncmp(activePartner.c_str(), "no", strlen("no")) &&
-                        !strncmp(activePort.c_str(), "yes", strlen("yes")) &&
-                        activateRetryCount < DISPLAYPORT_ACTIVATE_MAX_RETRIES) {
-                        if (!WriteStringToFile("1", partnerActivePath)) {
-                            ALOGE("usbdp: Failed to activate port partner Alt Mode");
-                        } else {
-                            ALOGI("usbdp: Attempting to activate port partner Alt Mode");
-                        }
-                        activateRetryCount++;
-                        armTimerFdHelper(usb->mDisplayPortActivateTimer,
-                                         DISPLAYPORT_ACTIVATE_DEBOUNCE_MS);
-                    } else {
-                        ALOGI("usbdp: DisplayPort Alt Mode is active, or disabled on port");
-                    }
-                } else {
-                    activateRetryCount++;
-                    armTimerFdHelper(usb->mDisplayPortActivateTimer,
-                                     DISPLAYPORT_ACTIVATE_DEBOUNCE_MS);
-                    ALOGE("usbdp: Failed to read active state from port or partner");
-                }
-            } else if (events[n].data.fd == usb->mDisplayPortEventPipe) {
-                uint64_t flag = 0;
-                if (!read(usb->mDisplayPortEventPipe, &flag, sizeof(flag))) {
-                    if (errno == EAGAIN)
-                        continue;
-                    ALOGI("usbdp: worker: Shutdown eventfd read error");
-                    goto error;
-                }
-                if (flag == DISPLAYPORT_SHUTDOWN_SET) {
-                    ALOGI("usbdp: worker: Shutdown eventfd triggered");
-                    destroyDisplayPortThread = true;
-                    break;
-                } else if (flag == DISPLAYPORT_IRQ_HPD_COUNT_CHECK) {
-                    ALOGI("usbdp: worker: IRQ_HPD event through DISPLAYPORT_IRQ_HPD_COUNT_CHECK");
-                    usb->writeDisplayPortAttribute("irq_hpd_count", irqHpdCountPath);
-                }
+    const string partnerActivePath = usb->mDisplayPortUsbPath + "../mode1/active";
+    usb->mDisplayPort.recordStage(DISPLAYPORT_STAGE_ACTIVATE_CHECK, usb->mDisplayPort.bindTime());
+    if (ReadFileToString(partnerActivePath.c_str(), &activePartner) &&
+        ReadFileToString(DISPLAYPORT_ACTIVE_PATH, &activePort)) {
+        // Retry activate signal when DisplayPort Alt Mode is active on port but not
+        // partner.
+        if (!strncmp(activePartner.c_str(), "no", strlen("no")) &&
+            !strncmp(activePort.c_str(), "yes", strlen("yes")) &&
+            usb->mDisplayPortActivateRetries < DISPLAYPORT_ACTIVATE_MAX_RETRIES) {
+            if (!WriteStringToFile("1", partnerActivePath)) {
+                ALOGE("usbdp: Failed to activate port partner Alt Mode");
+            } else {
+                ALOGI("usbdp: Attempting to activate port partner Alt Mode");
             }
+            usb->mDisplayPortActivateRetries++;
+            usb->mEventLoop.armTimer(usb->mDisplayPortActivateTimer,
+                                     DISPLAYPORT_ACTIVATE_DEBOUNCE_MS);
+        } else {
+            ALOGI("usbdp: DisplayPort Alt Mode is active, or disabled on port");
         }
+    } else {
+        usb->mDisplayPortActivateRetries++;
+        usb->mEventLoop.armTimer(usb->mDisplayPortActivateTimer, DISPLAYPORT_ACTIVATE_DEBOUNCE_MS);
+        ALOGE("usbdp: Failed to read active state from port or partner");
     }
-
-error:
-    /* Need to disarm so new threads don't get old event */
-    armTimerFdHelper(usb->mDisplayPortActivateTimer, 0);
-    close(link_training_status_fd);
-link_training_status_fd_error:
-    close(orientation_fd);
-orientation_fd_error:
-    close(pin_fd);
-pin_fd_error:
-    close(hpd_fd);
-hpd_fd_error:
-    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, usb->mDisplayPortDebounceTimer, &ev_debounce);
-    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, usb->mDisplayPortActivateTimer, &ev_activate);
-    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, usb->mDisplayPortEventPipe, &ev_eventfd);
-    close(epoll_fd);
-epoll_fd_error:
-usb_path_error:
-    usb->mDisplayPortPollRunning = false;
-    ALOGI("usbdp: worker: exiting worker thread");
-    return NULL;
+    pthread_mutex_unlock(&usb->mDisplayPortLock);
 }
 
-static struct timespec setTimespecTimer(int debounceMs) {
-    struct timespec to;
-    struct timespec now;
+// Forwards a new irq_hpd count to the drm driver. Runs on the event loop.
+void displayPortIrqHpd(android::hardware::usb::Usb *usb) {
+    const auto start = std::chrono::steady_clock::now();
+    string irqHpdCount;
 
-    clock_gettime(CLOCK_MONOTONIC, &now);
-    to.tv_nsec = now.tv_nsec + ((debounceMs % 1000) * 1000000);
-    to.tv_sec = now.tv_sec + (debounceMs / 1000);
-    if (to.tv_nsec >= 1000000000) {
-        to.tv_nsec -= 1000000000;
-        to.tv_sec += 1;
+    pthread_mutex_lock(&usb->mDisplayPortLock);
+    if (usb->mDisplayPort.state() != DisplayPortState::IDLE &&
+        tcpcNode.readAttribute(kIrqHpdCounPath, &irqHpdCount)) {
+        ALOGI("usbdp: worker: IRQ_HPD event");
+        usb->mDisplayPort.irqHpd(irqHpdCount, start);
     }
-
-    return to;
+    pthread_mutex_unlock(&usb->mDisplayPortLock);
 }
 
-void Usb::setupDisplayPortPoll() {
-    uint64_t flag = DISPLAYPORT_SHUTDOWN_CLEAR;
-    mDisplayPortFirstSetupDone = true;
-    int ret;
-
-    ALOGI("usbdp: setup: beginning setup for displayport poll thread");
-
-    /*
-     * If thread is currently starting, then it hasn't setup DisplayPort fd's, and we can abandon
-     * this process.
-     */
-    if (mDisplayPortPollStarting) {
-        ALOGI("usbdp: setup: abandoning poll thread because another startup is in progress");
-        return;
+bool Usb::watchDisplayPortAttribute(const string &path, DisplayPortAttribute attribute,
+                                    unique_fd *fd) {
+    fd->reset(open(path.c_str(), O_RDONLY | O_CLOEXEC));
+    if (fd->get() == -1) {
+        ALOGE("usbdp: worker: open at %s failed; errno=%d", path.c_str(), errno);
+        return false;
     }
-
-    /*
-     * Check to see if thread is currently running. If it is, then we assume that it must have
-     * invalid DisplayPort fd's and the new thread takes over.
-     */
-    if (mDisplayPortPollRunning) {
-        shutdownDisplayPortPoll(true);
-        pthread_mutex_lock(&mDisplayPortCVLock);
-        struct timespec to = setTimespecTimer(DISPLAYPORT_POLL_WAIT_MS);
-        ret = pthread_cond_timedwait(&mDisplayPortCV, &mDisplayPortCVLock, &to);
-        if (ret == ETIMEDOUT) {
-            ALOGI("usbdp: setup: Wait for poll to shutdown timed out, starting new poll anyways.");
-        }
-        pthread_mutex_unlock(&mDisplayPortCVLock);
+    // sysfs_notify() wakes pollers without new data to read, so only the edge is useful
+    if (!mEventLoop.addFd(fd->get(), EPOLLIN | EPOLLET, [this, attribute](uint32_t) {
+            displayPortAttributeChanged(this, attribute);
+        })) {
+        fd->reset();
+        return false;
     }
+    return true;
+}
 
-    // Indicate that startup procedure is initiated (mutex protects two threads running setup at
-    // once)
-    mDisplayPortPollStarting = true;
-
-    // Reset shutdown signals because shutdown() does not perform self clean-up
-    write(mDisplayPortEventPipe, &flag, sizeof(flag));
-    destroyDisplayPortThread = false;
-
-    /*
-     * Create a background thread to poll DisplayPort system files
-     */
-    if (pthread_create(&mDisplayPortPoll, NULL, displayPortPollWork, this)) {
-        ALOGE("usbdp: setup: failed to create displayport poll thread %d", errno);
-        goto error;
+void Usb::unwatchDisplayPortAttribute(unique_fd *fd) {
+    if (fd->get() != -1) {
+        mEventLoop.removeFd(fd->get());
+        fd->reset();
     }
-    ALOGI("usbdp: setup: successfully started displayport poll thread");
-    return;
-
-error:
-    mDisplayPortPollStarting = false;
-    return;
 }
 
-void Usb::shutdownDisplayPortPollHelper() {
-    uint64_t flag = DISPLAYPORT_SHUTDOWN_SET;
+void Usb::armDisplayPort() {
+    const auto bindTime = std::chrono::steady_clock::now();
 
-    // Write shutdown signal to child thread.
-    write(mDisplayPortEventPipe, &flag, sizeof(flag));
-    pthread_join(mDisplayPortPoll, NULL);
-    writeDisplayPortAttributeOverride("hpd", "0");
-    pthread_mutex_lock(&mDisplayPortCVLock);
-    pthread_cond_signal(&mDisplayPortCV);
-    pthread_mutex_unlock(&mDisplayPortCVLock);
-}
+    mDisplayPortFirstSetupDone = true;
 
-void *shutdownDisplayPortPollWork(void *param) {
-    ::aidl::android::hardware::usb::Usb *usb = (::aidl::android::hardware::usb::Usb *)param;
+    // Back to back binds leave fds on the previous partner's nodes behind
+    disarmDisplayPort(true);
 
-    usb->shutdownDisplayPortPollHelper();
-    ALOGI("usbdp: shutdown: displayport thread shutdown complete.");
-    return NULL;
+    if (getDisplayPortUsbPathHelper(&mDisplayPortUsbPath) == Status::ERROR) {
+        ALOGE("usbdp: worker: could not locate usb displayport directory");
+        return;
+    }
+    ALOGI("usbdp: worker: displayport usb path located at %s", mDisplayPortUsbPath.c_str());
+
+    if (!watchDisplayPortAttribute(mDisplayPortUsbPath + "hpd", DisplayPortAttribute::HPD,
+                                   &mDisplayPortHpdFd) ||
+        !watchDisplayPortAttribute(mDisplayPortUsbPath + "pin_assignment",
+                                   DisplayPortAttribute::PIN_ASSIGNMENT, &mDisplayPortPinFd) ||
+        !watchDisplayPortAttribute(kDisplayPortOrientationPath, DisplayPortAttribute::ORIENTATION,
+                                   &mDisplayPortOrientationFd) ||
+        !watchDisplayPortAttribute(string(kDisplayPortDrmPath) + "link_status",
+                                   DisplayPortAttribute::LINK_STATUS, &mDisplayPortLinkFd)) {
+        unwatchDisplayPortAttribute(&mDisplayPortHpdFd);
+        unwatchDisplayPortAttribute(&mDisplayPortPinFd);
+        unwatchDisplayPortAttribute(&mDisplayPortOrientationFd);
+        unwatchDisplayPortAttribute(&mDisplayPortLinkFd);
+        return;
+    }
+
+    mDisplayPortActivateRetries = 0;
+    mDisplayPort.bind(bindTime);
+    /* Arm timer to see if DisplayPort Alt Mode Activates */
+    mEventLoop.armTimer(mDisplayPortActivateTimer, DISPLAYPORT_ACTIVATE_DEBOUNCE_MS);
 }
 
-void Usb::shutdownDisplayPortPoll(bool force) {
+void Usb::disarmDisplayPort(bool force) {
     string displayPortUsbPath;
 
-    ALOGI("usbdp: shutdown: beginning shutdown for displayport poll thread");
-
     /*
-     * Determine if should shutdown thread
-     *
      * getDisplayPortUsbPathHelper locates a DisplayPort directory, no need to double check
      * directory.
      *
-     * Force is put in place to shutdown even when displayPortUsbPath is still present.
+     * Force is put in place to disarm even when displayPortUsbPath is still present.
      * Happens when back to back BIND events are sent and fds are no longer current.
      */
-    if (!mDisplayPortPollRunning ||
+    if (mDisplayPort.state() == DisplayPortState::IDLE ||
         (!force && getDisplayPortUsbPathHelper(&displayPortUsbPath) == Status::SUCCESS)) {
         return;
     }
 
-    // Shutdown is nonblocking to let other usb operations continue
-    if (pthread_create(&mDisplayPortShutdownHelper, NULL, shutdownDisplayPortPollWork, this)) {
-        ALOGE("usbdp: shutdown: shutdown worker pthread creation failed %d", errno);
+    unwatchDisplayPortAttribute(&mDisplayPortHpdFd);
+    unwatchDisplayPortAttribute(&mDisplayPortPinFd);
+    unwatchDisplayPortAttribute(&mDisplayPortOrientationFd);
+    unwatchDisplayPortAttribute(&mDisplayPortLinkFd);
+    // Need to disarm so the next partner doesn't get the old event
+    mEventLoop.armTimer(mDisplayPortActivateTimer, 0);
+    mDisplayPort.unbind();
+}
+
+binder_status_t Usb::dump(int fd, const char ** /* args */, uint32_t /* numArgs */) {
+    string out;
+
+    pthread_mutex_lock(&mRoleSwitchStateLock);
+    StringAppendF(&out, "Last role switch latency: %" PRId64 " ms\n", mLastRoleSwitchLatencyMs);
+    pthread_mutex_unlock(&mRoleSwitchStateLock);
+    StringAppendF(&out, "Port status uevents merged: %" PRIu64 " notifications suppressed: %" PRIu64
+                  "\n", mPortStatusMerged.load(), mPortStatusSuppressed.load());
+
+    pthread_mutex_lock(&mDisplayPortLock);
+    StringAppendF(&out, "DisplayPort state: %s\n", displayPortStateName(mDisplayPort.state()));
+    out += "DisplayPort stage latency:\n";
+    out += mDisplayPort.dumpLatency();
+    pthread_mutex_unlock(&mDisplayPortLock);
+
+    if (!::android::base::WriteStringToFd(out, fd)) {
+        return STATUS_UNKNOWN_ERROR;
     }
+    return STATUS_OK;
 }
 
 using ext::PortSecurityState;
 using ext::IUsbExt;
 
-static int WriteStringToFileOrLog(string val, string path) {
-    if (WriteStringToFile(val, path)) {
-        ALOGD("written %s to %s", val.c_str(), path.c_str());
+static int WriteTcpcAttributeOrLog(string val, const char *attribute) {
+    if (tcpcNode.writeAttribute(attribute, val)) {
+        ALOGD("written %s to %s", val.c_str(), attribute);
         return 1;
     }
-    ALOGE("unable to write %s to %s", val.c_str(), path.c_str());
+    ALOGE("unable to write %s to %s", val.c_str(), attribute);
     return 0;
 }
 
 static ScopedAStatus setPortSecurityStateInner(PortSecurityState in_state) {
-    string path;
-
-    if (Status ret = getI2cBusHelper(&path); ret != Status::SUCCESS) {
+    if (!tcpcNode.resolve()) {
         return ScopedAStatus::fromServiceSpecificError(IUsbExt::ERROR_NO_I2C_PATH);
     }
 
-    string ccToggleEnablePath = kI2CPath + path + "/" + path + kCcToggleEnable;
-    string dataPathEnablePath = kI2CPath + path + "/" + path + kDataPathEnable;
-
     // '&' is used instead of '&&' intentionally to disable short-circuit evaluation
 
     switch (in_state) {
         case PortSecurityState::DISABLED: {
-            if (WriteStringToFileOrLog("0", ccToggleEnablePath)
-                    & WriteStringToFileOrLog("0", dataPathEnablePath)) {
+            if (WriteTcpcAttributeOrLog("0", kCcToggleEnable)
+                    & WriteTcpcAttributeOrLog("0", kDataPathEnable)) {
                 return ScopedAStatus::ok();
             }
             return ScopedAStatus::fromServiceSpecificError(IUsbExt::ERROR_FILE_WRITE);
         }
         case PortSecurityState::CHARGING_ONLY_IMMEDIATE: {
-            if (WriteStringToFileOrLog("0", dataPathEnablePath)
-                    & WriteStringToFileOrLog("1", ccToggleEnablePath)) {
+            if (WriteTcpcAttributeOrLog("0", kDataPathEnable)
+                    & WriteTcpcAttributeOrLog("1", kCcToggleEnable)) {
                 return ScopedAStatus::ok();
             }
             return ScopedAStatus::fromServiceSpecificError(IUsbExt::ERROR_FILE_WRITE);
         }
         case PortSecurityState::CHARGING_ONLY: {
-            if (WriteStringToFileOrLog("-1", dataPathEnablePath)
-                    & WriteStringToFileOrLog("1", ccToggleEnablePath)) {
+            if (WriteTcpcAttributeOrLog("-1", kDataPathEnable)
+                    & WriteTcpcAttributeOrLog("1", kCcToggleEnable)) {
                 return ScopedAStatus::ok();
             }
             return ScopedAStatus::fromServiceSpecificError(IUsbExt::ERROR_FILE_WRITE);
         }
         case PortSecurityState::ENABLED: {
-            if (WriteStringToFileOrLog("1", dataPathEnablePath)
-                    & WriteStringToFileOrLog("1", ccToggleEnablePath)) {
+            if (WriteTcpcAttributeOrLog("1", kDataPathEnable)
+                    & WriteTcpcAttributeOrLog("1", kCcToggleEnable)) {
                 return ScopedAStatus::ok();
             }
             return ScopedAStatus::fromServiceSpecificError(IUsbExt::ERROR_FILE_WRITE);
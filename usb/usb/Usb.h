@@ -23,9 +23,15 @@
 #include <pixelusb/UsbOverheatEvent.h>
 #include <sys/eventfd.h>
 #include <utils/Log.h>
+#include <DisplayPortStateMachine.h>
+#include <EventLoop.h>
 #include <UsbDataSessionMonitor.h>
 
-#define UEVENT_MSG_LEN 2048
+#include <atomic>
+#include <chrono>
+#include <unordered_map>
+#include <vector>
+
 // The type-c stack waits for 4.5 - 5.5 secs before declaring a port non-pd.
 // The -partner directory would not be created until this is done.
 // Having a margin of ~3 secs for the directory and other related bookeeping
@@ -70,20 +76,34 @@ constexpr char kGadgetName[] = "11210000.dwc3";
 
 #define DISPLAYPORT_ACTIVE_PATH "/sys/class/typec/port0/port0.0/mode1/active"
 
-#define LINK_TRAINING_STATUS_UNKNOWN "0"
-#define LINK_TRAINING_STATUS_SUCCESS "1"
-#define LINK_TRAINING_STATUS_FAILURE "2"
-#define LINK_TRAINING_STATUS_FAILURE_SINK "3"
-
-#define DISPLAYPORT_SHUTDOWN_CLEAR 0
-#define DISPLAYPORT_SHUTDOWN_SET 1
-#define DISPLAYPORT_IRQ_HPD_COUNT_CHECK 3
-
-#define DISPLAYPORT_POLL_WAIT_MS 100
-
 #define SVID_DISPLAYPORT "ff01"
 #define SVID_THUNDERBOLT "8087"
 
+// Parts of the cached port status, each re-read from its own sysfs attributes
+enum PortStatusPart : uint32_t {
+    // typec ports, roles, usb_type and usb data status
+    PORT_STATUS_PORTS = 1 << 0,
+    PORT_STATUS_CONTAMINANT = 1 << 1,
+    PORT_STATUS_POWER_TRANSFER = 1 << 2,
+    // Non compliant charger reasons
+    PORT_STATUS_COMPLIANCE = 1 << 3,
+    PORT_STATUS_DISPLAYPORT = 1 << 4,
+    PORT_STATUS_ALL = (1 << 5) - 1,
+};
+
+struct RoleSwitchRequest {
+    bool pending;
+    // The new mode is still being written. An outcome reported meanwhile is deferred until the
+    // write returns, deferredOutcome being null if there was none.
+    bool writing;
+    Status deferredStatus;
+    const char *deferredOutcome;
+    string portName;
+    PortRole role;
+    int64_t transactionId;
+    std::chrono::steady_clock::time_point start;
+};
+
 struct Usb : public BnUsb {
     Usb();
 
@@ -100,28 +120,62 @@ struct Usb : public BnUsb {
     ScopedAStatus limitPowerTransfer(const string& in_portName, bool in_limit,
         int64_t in_transactionId) override;
     ScopedAStatus resetUsbPort(const string& in_portName, int64_t in_transactionId) override;
+    binder_status_t dump(int fd, const char **args, uint32_t numArgs) override;
 
     Status getDisplayPortUsbPathHelper(string *path);
     Status readDisplayPortAttribute(string attribute, string usb_path, string* value);
-    Status writeDisplayPortAttributeOverride(string attribute, string value);
-    Status writeDisplayPortAttribute(string attribute, string usb_path);
     bool determineDisplayPortRetry(string linkPath, string hpdPath);
-    void setupDisplayPortPoll();
-    void shutdownDisplayPortPollHelper();
-    void shutdownDisplayPortPoll(bool force);
+    // Both called with mDisplayPortLock held
+    void armDisplayPort();
+    void disarmDisplayPort(bool force);
 
     std::shared_ptr<::aidl::android::hardware::usb::IUsbCallback> mCallback;
     // Protects mCallback variable
     pthread_mutex_t mLock;
-    // Protects roleSwitch operation
+    // Serializes the role writes of switchRole(). The event loop only ever trylocks it.
     pthread_mutex_t mRoleSwitchLock;
-    // Threads waiting for the partner to come back wait here
-    pthread_cond_t mPartnerCV;
-    // lock protecting mPartnerCV
-    pthread_mutex_t mPartnerLock;
-    // Variable to signal partner coming back online after type switch
-    bool mPartnerUp;
+    /*
+     * Protects mRoleSwitch and mLastRoleSwitchLatencyMs. Never held across a sysfs write or a
+     * callback, so the event loop can complete a mode switch while a role is being written.
+     */
+    pthread_mutex_t mRoleSwitchStateLock;
+    // Port mode switch waiting for the partner to come back
+    RoleSwitchRequest mRoleSwitch;
+    // Fails mRoleSwitch after PORT_TYPE_TIMEOUT
+    int mRoleSwitchTimer;
+    // Duration of the last completed role switch, -1 if there was none
+    int64_t mLastRoleSwitchLatencyMs;
 
+    /*
+     * Cached port status, protected by mLock. Uevents and requests only re-read the parts they
+     * change, and lost uevents re-read all of it. queryPortStatus() reports the cache as is.
+     */
+    // PortStatusPart bits to re-read before the cache is used again
+    uint32_t mPortStatusStale;
+    Status mPortsResult;
+    std::vector<PortStatus> mPorts;
+    // Only the contaminant fields are used
+    PortStatus mContaminantStatus;
+    bool mPowerTransferLimited;
+    // Non compliant charger warnings indexed by port name
+    std::unordered_map<string, std::vector<ComplianceWarning>> mChargerWarnings;
+    AltModeData::DisplayPortAltModeData mDisplayPortAltMode;
+    // Last status sent through notifyPortStatusChange()
+    std::vector<PortStatus> mNotifiedPortStatus;
+    Status mNotifiedResult;
+    // PortStatusPart bits queued by uevents, refreshed when mPortChangeTimer fires. Only used on
+    // the event loop thread.
+    uint32_t mPendingPortChange;
+    int mPortChangeTimer;
+    // Uevents folded into an already pending refresh
+    std::atomic<uint64_t> mPortStatusMerged;
+    // Notifications skipped because the port status was unchanged
+    std::atomic<uint64_t> mPortStatusSuppressed;
+
+    // Runs the uevent handler and the data session monitor on one thread
+    EventLoop mEventLoop;
+    // Uevent subscription on mEventLoop while a callback is registered, -1 otherwise
+    int mUeventSubscription;
     // Report usb data session event and data incompliance warnings
     UsbDataSessionMonitor mUsbDataSessionMonitor;
     // Usb Overheat object for push suez event
@@ -130,38 +184,41 @@ struct Usb : public BnUsb {
     float mPluggedTemperatureCelsius;
     // Usb Data status
     bool mUsbDataEnabled;
-    // True when mDisplayPortPoll pthread is running
-    volatile bool mDisplayPortPollRunning;
-    volatile bool mDisplayPortPollStarting;
-    pthread_cond_t mDisplayPortCV;
-    pthread_mutex_t mDisplayPortCVLock;
-    volatile bool mDisplayPortFirstSetupDone;
-    // Used to cache the values read from tcpci's irq_hpd_count.
-    // Update drm driver when cached value is not the same as the read value.
-    uint32_t mIrqHpdCountCache;
-
-    // Protects writeDisplayPortToExynos(), setupDisplayPortPoll(), and
-    // shutdownDisplayPortPoll()
+
+    /*
+     * DisplayPort worker, runs on mEventLoop. The fields below up to mDisplayPortLock are
+     * protected by it.
+     */
+    DisplayPortStateMachine mDisplayPort;
+    int mDisplayPortActivateRetries;
+    bool mDisplayPortFirstSetupDone;
+    // Partner displayport directory while armed
+    string mDisplayPortUsbPath;
+    unique_fd mDisplayPortHpdFd;
+    unique_fd mDisplayPortPinFd;
+    unique_fd mDisplayPortOrientationFd;
+    unique_fd mDisplayPortLinkFd;
+    // Protects the DisplayPort worker
     pthread_mutex_t mDisplayPortLock;
-    // eventfd to signal DisplayPort thread
-    int mDisplayPortEventPipe;
 
     /*
-     * eventfd to set DisplayPort framework update debounce timer. Debounce timer is necessary for
+     * Timer for the DisplayPort framework update debounce. Debounce timer is necessary for
      *     1) allowing enough time for each sysfs node needed to set HPD high in the drm to populate
      *     2) preventing multiple IRQs that trigger link training failures from continuously
      *        sending notifications to the frameworks layer.
      */
     int mDisplayPortDebounceTimer;
     /*
-     * eventfd to monitor whether a connection results in DisplayPort Alt Mode activating.
+     * Timer to monitor whether a connection results in DisplayPort Alt Mode activating.
      */
     int mDisplayPortActivateTimer;
 
   private:
-    pthread_t mPoll;
-    pthread_t mDisplayPortPoll;
-    pthread_t mDisplayPortShutdownHelper;
+    // Reads a watched attribute through the fd held for epoll
+    bool readDisplayPortWatched(DisplayPortAttribute attribute, string *value);
+    bool watchDisplayPortAttribute(const string &path, DisplayPortAttribute attribute,
+                                   unique_fd *fd);
+    void unwatchDisplayPortAttribute(unique_fd *fd);
 };
 
 using ext::PortSecurityState;
@@ -17,18 +17,18 @@
 #define LOG_TAG "android.hardware.usb.aidl-service.UsbDataSessionMonitor"
 
 #include "UsbDataSessionMonitor.h"
+#include "UeventFilter.h"
 
 #include <aidl/android/frameworks/stats/IStats.h>
 #include <android-base/file.h>
 #include <android-base/logging.h>
 #include <android_hardware_usb_flags.h>
-#include <cutils/uevent.h>
 #include <pixelstats/StatsHelper.h>
 #include <pixelusb/CommonUtils.h>
 #include <sys/epoll.h>
 #include <utils/Log.h>
 
-#include <regex>
+#include <algorithm>
 
 namespace usb_flags = android::hardware::usb::flags;
 
@@ -37,7 +37,6 @@ using android::base::ReadFileToString;
 using android::hardware::google::pixel::getStatsService;
 using android::hardware::google::pixel::reportUsbDataSessionEvent;
 using android::hardware::google::pixel::PixelAtoms::VendorUsbDataSessionEvent;
-using android::hardware::google::pixel::usb::addEpollFd;
 using android::hardware::google::pixel::usb::BuildVendorUsbDataSessionEvent;
 
 namespace aidl {
@@ -45,11 +44,11 @@ namespace android {
 namespace hardware {
 namespace usb {
 
-#define UEVENT_MSG_LEN 2048
 #define USB_STATE_MAX_LEN 20
 #define DATA_ROLE_MAX_LEN 10
 
 constexpr char kUdcConfigfsPath[] = "/config/usb_gadget/g1/UDC";
+constexpr int kUdcChangeDelayMs = 50;
 constexpr char kNotAttachedState[] = "not attached\n";
 constexpr char kAttachedState[] = "attached\n";
 constexpr char kPoweredState[] = "powered\n";
@@ -61,21 +60,19 @@ const std::set<std::string> kValidStates = {kNotAttachedState, kAttachedState,
                                             kDefaultState,     kAddressedState, kConfiguredState,
                                             kSuspendedState};
 
-static int addEpollFile(const int &epollFd, const std::string &filePath, unique_fd &fileFd) {
-    struct epoll_event ev;
+int UsbDataSessionMonitor::addEventFile(const std::string &filePath, unique_fd &fileFd,
+                                        std::function<void()> handler) {
+    // A repeated bind uevent replaces the previous registration
+    removeEventFile(filePath, fileFd);
 
-    unique_fd fd(open(filePath.c_str(), O_RDONLY));
+    unique_fd fd(open(filePath.c_str(), O_RDONLY | O_CLOEXEC));
 
     if (fd.get() == -1) {
         ALOGI("Cannot open %s", filePath.c_str());
         return -1;
     }
 
-    ev.data.fd = fd.get();
-    ev.events = EPOLLPRI;
-
-    if (epoll_ctl(epollFd, EPOLL_CTL_ADD, fd.get(), &ev) != 0) {
-        ALOGE("epoll_ctl failed; errno=%d", errno);
+    if (!mEventLoop->addFd(fd.get(), EPOLLPRI, [handler](uint32_t) { handler(); })) {
         return -1;
     }
 
@@ -84,75 +81,80 @@ static int addEpollFile(const int &epollFd, const std::string &filePath, unique_
     return 0;
 }
 
-static void removeEpollFile(const int &epollFd, const std::string &filePath, unique_fd &fileFd) {
-    epoll_ctl(epollFd, EPOLL_CTL_DEL, fileFd.get(), NULL);
-    fileFd.release();
+void UsbDataSessionMonitor::removeEventFile(const std::string &filePath, unique_fd &fileFd) {
+    if (fileFd.get() == -1)
+        return;
+
+    mEventLoop->removeFd(fileFd.get());
+    fileFd.reset();
 
     ALOGI("epoll unregistered %s", filePath.c_str());
 }
 
 UsbDataSessionMonitor::UsbDataSessionMonitor(
+    EventLoop *eventLoop,
     const std::string &deviceUeventRegex, const std::string &deviceStatePath,
     const std::string &host1UeventRegex, const std::string &host1StatePath,
     const std::string &host2UeventRegex, const std::string &host2StatePath,
-    const std::string &dataRolePath, std::function<void()> updatePortStatusCb) {
-    struct epoll_event ev;
+    const std::string &dataRolePath, std::function<void()> updatePortStatusCb)
+    : mEventLoop(eventLoop), mUeventSubscription(-1) {
     std::string udc;
 
-    unique_fd epollFd(epoll_create(8));
-    if (epollFd.get() == -1) {
-        ALOGE("epoll_create failed; errno=%d", errno);
-        abort();
-    }
+    mUpdatePortStatusCb = updatePortStatusCb;
 
-    unique_fd ueventFd(uevent_open_socket(64 * 1024, true));
-    if (ueventFd.get() == -1) {
-        ALOGE("uevent_open_socket failed");
-        abort();
-    }
-    fcntl(ueventFd, F_SETFL, O_NONBLOCK);
+    if (ReadFileToString(kUdcConfigfsPath, &udc) && !udc.empty())
+        mUdcBind = true;
+    else
+        mUdcBind = false;
 
-    if (addEpollFd(epollFd, ueventFd))
+    mDeviceState.filePath = deviceStatePath;
+    mDeviceState.ueventRegex = std::regex(deviceUeventRegex);
+    mHost1State.filePath = host1StatePath;
+    mHost1State.ueventRegex = std::regex(host1UeventRegex);
+    mHost2State.filePath = host2StatePath;
+    mHost2State.ueventRegex = std::regex(host2UeventRegex);
+
+    mUdcChangeTimer =
+        mEventLoop->createTimer([this]() { updateUdcBindStatus(mUdcChangeDevname); });
+    if (mUdcChangeTimer == -1) {
+        ALOGE("udc change timer setup failed");
         abort();
+    }
 
-    if (addEpollFile(epollFd.get(), dataRolePath, mDataRoleFd) != 0) {
+    if (addEventFile(dataRolePath, mDataRoleFd, [this]() { handleDataRoleEvent(); }) != 0) {
         ALOGE("monitor data role failed");
         abort();
     }
 
     /*
      * The device state file could be absent depending on the current data role
-     * and driver architecture. It's ok for addEpollFile to fail here, the file
+     * and driver architecture. It's ok for addEventFile to fail here, the file
      * will be monitored later when its presence is detected by uevent.
      */
-    mDeviceState.filePath = deviceStatePath;
-    mDeviceState.ueventRegex = deviceUeventRegex;
-    addEpollFile(epollFd.get(), mDeviceState.filePath, mDeviceState.fd);
-
-    mHost1State.filePath = host1StatePath;
-    mHost1State.ueventRegex = host1UeventRegex;
-    addEpollFile(epollFd.get(), mHost1State.filePath, mHost1State.fd);
-
-    mHost2State.filePath = host2StatePath;
-    mHost2State.ueventRegex = host2UeventRegex;
-    addEpollFile(epollFd.get(), mHost2State.filePath, mHost2State.fd);
-
-    mEpollFd = std::move(epollFd);
-    mUeventFd = std::move(ueventFd);
-    mUpdatePortStatusCb = updatePortStatusCb;
-
-    if (ReadFileToString(kUdcConfigfsPath, &udc) && !udc.empty())
-        mUdcBind = true;
-    else
-        mUdcBind = false;
+    for (auto e : {&mDeviceState, &mHost1State, &mHost2State}) {
+        addEventFile(e->filePath, e->fd, [this, e]() { handleDeviceStateEvent(e); });
+    }
 
-    if (pthread_create(&mMonitor, NULL, this->monitorThread, this)) {
-        ALOGE("pthread creation failed %d", errno);
-        abort();
+    // Only uevents of the monitored usb devices are of interest
+    std::vector<std::string> prefixes;
+    for (const std::string *regex : {&deviceUeventRegex, &host1UeventRegex, &host2UeventRegex}) {
+        std::string prefix = ueventRegexDevpathPrefix(*regex);
+        if (std::find(prefixes.begin(), prefixes.end(), prefix) == prefixes.end()) {
+            prefixes.push_back(prefix);
+        }
     }
+    mUeventSubscription = mEventLoop->subscribeUevents(
+        prefixes, [this](const char *msg) { handleUevent(msg); });
 }
 
-UsbDataSessionMonitor::~UsbDataSessionMonitor() {}
+UsbDataSessionMonitor::~UsbDataSessionMonitor() {
+    mEventLoop->unsubscribeUevents(mUeventSubscription);
+    removeEventFile("data role", mDataRoleFd);
+    for (auto e : {&mDeviceState, &mHost1State, &mHost2State}) {
+        removeEventFile(e->filePath, e->fd);
+    }
+    mEventLoop->destroyTimer(mUdcChangeTimer);
+}
 
 void UsbDataSessionMonitor::reportUsbDataSessionMetrics() {
     std::vector<VendorUsbDataSessionEvent> events;
@@ -337,44 +339,31 @@ void UsbDataSessionMonitor::updateUdcBindStatus(const std::string &devname) {
     mUdcBind = newUdcBind;
 }
 
-void UsbDataSessionMonitor::handleUevent() {
-    char msg[UEVENT_MSG_LEN + 2];
-    char *cp;
-    int n;
-
-    n = uevent_kernel_multicast_recv(mUeventFd.get(), msg, UEVENT_MSG_LEN);
-    if (n <= 0)
-        return;
-    if (n >= UEVENT_MSG_LEN)
-        return;
-
-    msg[n] = '\0';
-    msg[n + 1] = '\0';
-    cp = msg;
+void UsbDataSessionMonitor::handleUevent(const char *msg) {
+    const char *cp = msg;
 
     while (*cp) {
         for (auto e : {&mHost1State, &mHost2State}) {
-            if (std::regex_search(cp, std::regex(e->ueventRegex))) {
+            if (std::regex_search(cp, e->ueventRegex)) {
                 if (!strncmp(cp, "bind@", strlen("bind@"))) {
-                    addEpollFile(mEpollFd.get(), e->filePath, e->fd);
+                    addEventFile(e->filePath, e->fd, [this, e]() { handleDeviceStateEvent(e); });
                 } else if (!strncmp(cp, "unbind@", strlen("unbind@"))) {
-                    removeEpollFile(mEpollFd.get(), e->filePath, e->fd);
+                    removeEventFile(e->filePath, e->fd);
                 }
             }
         }
 
         // TODO: support bind@ unbind@ to detect dynamically allocated udc device
-        if (std::regex_search(cp, std::regex(mDeviceState.ueventRegex))) {
+        if (std::regex_search(cp, mDeviceState.ueventRegex)) {
             if (!strncmp(cp, "change@", strlen("change@"))) {
-                char *devname = cp + strlen("change@");
                 /*
                  * Udc device emits a KOBJ_CHANGE event on configfs driver bind and unbind.
                  * TODO: upstream udc driver emits KOBJ_CHANGE event BEFORE unbind is actually
                  * executed. Add a short delay to get the correct state while working on a fix
-                 * upstream.
+                 * upstream. The delay is a timer so that the shared event loop keeps running.
                  */
-                usleep(50000);
-                updateUdcBindStatus(devname);
+                mUdcChangeDevname = cp + strlen("change@");
+                mEventLoop->armTimer(mUdcChangeTimer, kUdcChangeDelayMs);
             }
         }
         /* advance to after the next \0 */
@@ -383,37 +372,6 @@ void UsbDataSessionMonitor::handleUevent() {
     }
 }
 
-void *UsbDataSessionMonitor::monitorThread(void *param) {
-    UsbDataSessionMonitor *monitor = (UsbDataSessionMonitor *)param;
-    struct epoll_event events[64];
-    int nevents = 0;
-
-    while (true) {
-        nevents = epoll_wait(monitor->mEpollFd.get(), events, 64, -1);
-        if (nevents == -1) {
-            if (errno == EINTR)
-                continue;
-            ALOGE("usb epoll_wait failed; errno=%d", errno);
-            break;
-        }
-
-        for (int n = 0; n < nevents; ++n) {
-            if (events[n].data.fd == monitor->mUeventFd.get()) {
-                monitor->handleUevent();
-            } else if (events[n].data.fd == monitor->mDataRoleFd.get()) {
-                monitor->handleDataRoleEvent();
-            } else if (events[n].data.fd == monitor->mDeviceState.fd.get()) {
-                monitor->handleDeviceStateEvent(&monitor->mDeviceState);
-            } else if (events[n].data.fd == monitor->mHost1State.fd.get()) {
-                monitor->handleDeviceStateEvent(&monitor->mHost1State);
-            } else if (events[n].data.fd == monitor->mHost2State.fd.get()) {
-                monitor->handleDeviceStateEvent(&monitor->mHost2State);
-            }
-        }
-    }
-    return NULL;
-}
-
 }  // namespace usb
 }  // namespace hardware
 }  // namespace android
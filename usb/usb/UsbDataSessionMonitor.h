@@ -21,6 +21,9 @@
 #include <android-base/chrono_utils.h>
 #include <android-base/unique_fd.h>
 
+#include "EventLoop.h"
+
+#include <regex>
 #include <set>
 #include <string>
 #include <vector>
@@ -47,13 +50,16 @@ class UsbDataSessionMonitor {
      * The host mode high-speed port and super-speed port can be assigned to either host1 or
      * host2 without affecting functionality.
      *
+     * eventLoop: runs all of the monitor's uevent, sysfs and timer handlers. Must outlive the
+     *            monitor.
      * UeventRegex: name regex of the device that's being monitored. The regex is matched against
      *              uevent to detect dynamic creation/deletion/change of the device.
      * StatePath: usb device state sysfs path of the device, monitored by epoll.
      * dataRolePath: path to the usb data role sysfs, monitored by epoll.
      * updatePortStatusCb: the callback is invoked when the compliance warings changes.
      */
-    UsbDataSessionMonitor(const std::string &deviceUeventRegex, const std::string &deviceStatePath,
+    UsbDataSessionMonitor(EventLoop *eventLoop,
+                          const std::string &deviceUeventRegex, const std::string &deviceStatePath,
                           const std::string &host1UeventRegex, const std::string &host1StatePath,
                           const std::string &host2UeventRegex, const std::string &host2StatePath,
                           const std::string &dataRolePath,
@@ -66,15 +72,18 @@ class UsbDataSessionMonitor {
     struct usbDeviceState {
         unique_fd fd;
         std::string filePath;
-        std::string ueventRegex;
+        // Compiled once, since it is matched against every line of every uevent
+        std::regex ueventRegex;
         // Usb device states reported by state sysfs
         std::vector<std::string> states;
         // Timestamps of when the usb device states were captured
         std::vector<boot_clock::time_point> timestamps;
     };
 
-    static void *monitorThread(void *param);
-    void handleUevent();
+    int addEventFile(const std::string &filePath, unique_fd &fileFd,
+                     std::function<void()> handler);
+    void removeEventFile(const std::string &filePath, unique_fd &fileFd);
+    void handleUevent(const char *msg);
     void handleDataRoleEvent();
     void handleDeviceStateEvent(struct usbDeviceState *deviceState);
     void clearDeviceStateEvents(struct usbDeviceState *deviceState);
@@ -83,10 +92,12 @@ class UsbDataSessionMonitor {
     void notifyComplianceWarning();
     void updateUdcBindStatus(const std::string &devname);
 
-    pthread_t mMonitor;
-    unique_fd mEpollFd;
-    unique_fd mUeventFd;
+    EventLoop *mEventLoop;
+    int mUeventSubscription;
     unique_fd mDataRoleFd;
+    // Delays reading the udc bind status after a udc change uevent
+    int mUdcChangeTimer;
+    std::string mUdcChangeDevname;
     struct usbDeviceState mDeviceState;
     struct usbDeviceState mHost1State;
     struct usbDeviceState mHost2State;
@@ -0,0 +1,222 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Cost of classifying the uevents that reach uevent_event(). The messages are hand-written after
+ * the uevents the TCPC, typec and power supply drivers send when a USB-C dock with DisplayPort is
+ * attached; they are not a capture. Only the parse is measured; what uevent_event() does for each
+ * line is the same whatever the parse costs.
+ *
+ * The BM_Legacy* entries run the strncmp and regex scan that uevent_event() used before the rule
+ * table over the same messages.
+ */
+
+#include <benchmark/benchmark.h>
+
+#include <string.h>
+
+#include <initializer_list>
+#include <regex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "../UeventClassifier.h"
+
+using aidl::android::hardware::usb::forEachUeventLine;
+using aidl::android::hardware::usb::matchUeventType;
+using aidl::android::hardware::usb::UeventLine;
+using aidl::android::hardware::usb::UeventType;
+
+namespace {
+
+#define TCPC_DEVPATH "/devices/platform/10cb0000.hsi2c/i2c-11/11-0025"
+#define PORT_DEVPATH TCPC_DEVPATH "/typec/port0"
+
+// Joins lines the way the kernel sends them: NUL separated, ending with an empty line
+std::string makeUevent(std::initializer_list<const char *> lines) {
+    std::string msg;
+    for (const char *line : lines) {
+        msg += line;
+        msg += '\0';
+    }
+    // c_str() adds the final NUL of the empty line
+    return msg;
+}
+
+const std::vector<std::pair<const char *, std::string>> &uevents() {
+    static const std::vector<std::pair<const char *, std::string>> kUevents = {
+        {"tcpc_change", makeUevent({
+            "change@" TCPC_DEVPATH,
+            "ACTION=change",
+            "DEVPATH=" TCPC_DEVPATH,
+            "SUBSYSTEM=i2c",
+            "DRIVER=max77759tcpc",
+            "OF_NAME=max77759tcpc",
+            "MODALIAS=of:Nmax77759tcpcT(null)Cmaxim,max77759tcpc",
+            "SEQNUM=7398",
+        })},
+        {"partner_add", makeUevent({
+            "add@" PORT_DEVPATH "/port0-partner",
+            "ACTION=add",
+            "DEVPATH=" PORT_DEVPATH "/port0-partner",
+            "SUBSYSTEM=typec",
+            "DEVTYPE=typec_partner",
+            "SEQNUM=7399",
+        })},
+        {"port_change", makeUevent({
+            "change@" PORT_DEVPATH,
+            "ACTION=change",
+            "DEVPATH=" PORT_DEVPATH,
+            "SUBSYSTEM=typec",
+            "DEVTYPE=typec_port",
+            "TYPEC_PORT=port0",
+            "SEQNUM=7400",
+        })},
+        {"usb_power_supply", makeUevent({
+            "change@" TCPC_DEVPATH "/power_supply/usb",
+            "ACTION=change",
+            "DEVPATH=" TCPC_DEVPATH "/power_supply/usb",
+            "SUBSYSTEM=power_supply",
+            "POWER_SUPPLY_NAME=usb",
+            "POWER_SUPPLY_TYPE=USB",
+            "POWER_SUPPLY_ONLINE=1",
+            "POWER_SUPPLY_PRESENT=1",
+            "POWER_SUPPLY_VOLTAGE_MAX=5000000",
+            "POWER_SUPPLY_CURRENT_MAX=3000000",
+            "POWER_SUPPLY_USB_TYPE=SDP DCP CDP C [PD] PD_PPS",
+            "SEQNUM=7401",
+        })},
+        {"displayport_bind", makeUevent({
+            "bind@" PORT_DEVPATH "/port0-partner/port0-partner.0",
+            "ACTION=bind",
+            "DEVPATH=" PORT_DEVPATH "/port0-partner/port0-partner.0",
+            "SUBSYSTEM=typec",
+            "DEVTYPE=typec_alternate_mode",
+            "DRIVER=typec_displayport",
+            "SVID=ff01",
+            "MODE=1",
+            "SEQNUM=7402",
+        })},
+        // Shares the TCPC devpath prefix, so the uevent filter lets it through
+        {"battery_power_supply", makeUevent({
+            "change@" TCPC_DEVPATH "/power_supply/tcpm-source-psy-11-0025",
+            "ACTION=change",
+            "DEVPATH=" TCPC_DEVPATH "/power_supply/tcpm-source-psy-11-0025",
+            "SUBSYSTEM=power_supply",
+            "POWER_SUPPLY_NAME=tcpm-source-psy-11-0025",
+            "POWER_SUPPLY_TYPE=USB",
+            "POWER_SUPPLY_USB_TYPE=[C] PD PD_PPS",
+            "POWER_SUPPLY_ONLINE=1",
+            "POWER_SUPPLY_VOLTAGE_MIN=5000000",
+            "POWER_SUPPLY_VOLTAGE_MAX=9000000",
+            "POWER_SUPPLY_VOLTAGE_NOW=9000000",
+            "POWER_SUPPLY_CURRENT_MAX=2000000",
+            "POWER_SUPPLY_CURRENT_NOW=2000000",
+            "SEQNUM=7403",
+        })},
+    };
+    return kUevents;
+}
+
+// Same scan as uevent_event(), with the side effects replaced by a count of handled lines
+int classify(const char *msg) {
+    UeventType type = UeventType::UNKNOWN;
+    int handled = 0;
+    forEachUeventLine(msg, [&type, &handled](UeventLine line, std::string_view value) {
+        if (line == UeventLine::ACTION) {
+            type = matchUeventType(value);
+        } else if (line != UeventLine::IGNORED) {
+            handled++;
+        }
+        return line != UeventLine::DISPLAYPORT_DRIVER;
+    });
+    return handled + type;
+}
+
+UeventType legacyMatchUeventType(const char *str) {
+    if (!strncmp(str, "ACTION=bind", strlen("ACTION=bind"))) {
+        return UeventType::BIND;
+    } else if (!strncmp(str, "ACTION=change", strlen("ACTION=change"))) {
+        return UeventType::CHANGE;
+    }
+    return UeventType::UNKNOWN;
+}
+
+// The scan uevent_event() did before the rule table, counted the same way as classify()
+int legacyClassify(const char *msg) {
+    UeventType type = UeventType::UNKNOWN;
+    int handled = 0;
+    for (const char *cp = msg; *cp; cp += strlen(cp) + 1) {
+        if (std::regex_match(cp, std::regex("(add)(.*)(-partner)"))) {
+            handled++;
+        } else if (!strncmp(cp, "DEVTYPE=typec_", strlen("DEVTYPE=typec_")) ||
+                   !strncmp(cp, "DRIVER=max77759tcpc", strlen("DRIVER=max77759tcpc")) ||
+                   !strncmp(cp, "DRIVER=pogo-transport", strlen("DRIVER=pogo-transport")) ||
+                   !strncmp(cp, "POWER_SUPPLY_NAME=usb", strlen("POWER_SUPPLY_NAME=usb"))) {
+            handled++;
+        } else if (!strncmp(cp, "DRIVER=google,usbc_port_cooling_dev",
+                            strlen("DRIVER=google,usbc_port_cooling_dev"))) {
+            handled++;
+        } else if (!strncmp(cp, "ACTION=", strlen("ACTION="))) {
+            type = legacyMatchUeventType(cp);
+        } else if (!strncmp(cp, "DRIVER=typec_displayport", strlen("DRIVER=typec_displayport"))) {
+            handled++;
+            break;
+        }
+    }
+    return handled + type;
+}
+
+template <int (*Classify)(const char *)>
+void BM_Uevent(benchmark::State &state, const std::string *msg) {
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(Classify(msg->c_str()));
+    }
+    state.SetBytesProcessed(state.iterations() * msg->size());
+}
+
+// The whole attach sequence, as one wakeup per uevent
+template <int (*Classify)(const char *)>
+void BM_AttachBurst(benchmark::State &state) {
+    size_t bytes = 0;
+    for (const auto &[name, msg] : uevents()) {
+        bytes += msg.size();
+    }
+    for (auto _ : state) {
+        for (const auto &[name, msg] : uevents()) {
+            benchmark::DoNotOptimize(Classify(msg.c_str()));
+        }
+    }
+    state.SetBytesProcessed(state.iterations() * bytes);
+}
+BENCHMARK(BM_AttachBurst<classify>)->Name("BM_ClassifyAttachBurst");
+BENCHMARK(BM_AttachBurst<legacyClassify>)->Name("BM_LegacyClassifyAttachBurst");
+
+// Registered from a static initializer so that each uevent gets its own entry
+[[maybe_unused]] const bool kRegistered = []() {
+    for (const auto &[name, msg] : uevents()) {
+        benchmark::RegisterBenchmark((std::string("BM_ClassifyUevent/") + name).c_str(),
+                                     BM_Uevent<classify>, &msg);
+        benchmark::RegisterBenchmark((std::string("BM_LegacyClassifyUevent/") + name).c_str(),
+                                     BM_Uevent<legacyClassify>, &msg);
+    }
+    return true;
+}();
+
+}  // namespace
+
+BENCHMARK_MAIN();
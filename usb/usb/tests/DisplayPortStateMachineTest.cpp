@@ -0,0 +1,228 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <gtest/gtest.h>
+
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "../DisplayPortStateMachine.h"
+
+namespace aidl {
+namespace android {
+namespace hardware {
+namespace usb {
+namespace {
+
+using std::string;
+
+// Replays bind/hpd/unbind sequences against fake partner nodes and records what reaches drm
+class DisplayPortStateMachineTest : public ::testing::Test {
+  protected:
+    DisplayPortStateMachineTest()
+        : mDisplayPort(
+                  [this](DisplayPortAttribute attribute, string *value) {
+                      auto it = mNodes.find(attribute);
+                      if (it == mNodes.end()) {
+                          return false;
+                      }
+                      *value = it->second;
+                      return true;
+                  },
+                  [this](const string &attribute, const string &value) {
+                      mDrmWrites.emplace_back(attribute, value);
+                      return mDrmWritable;
+                  }) {}
+
+    // Sets a partner node and delivers its sysfs_notify()
+    bool change(DisplayPortAttribute attribute, const string &value) {
+        mNodes[attribute] = value;
+        return mDisplayPort.attributeChanged(attribute);
+    }
+
+    void bindAndTrain() {
+        mDisplayPort.bind(std::chrono::steady_clock::now());
+        ASSERT_TRUE(change(DisplayPortAttribute::PIN_ASSIGNMENT, "C [D] E\n"));
+        ASSERT_TRUE(change(DisplayPortAttribute::ORIENTATION, "normal\n"));
+        ASSERT_TRUE(change(DisplayPortAttribute::HPD, "1\n"));
+        ASSERT_EQ(mDisplayPort.state(), DisplayPortState::HPD_HIGH);
+        mDrmWrites.clear();
+    }
+
+    std::map<DisplayPortAttribute, string> mNodes;
+    std::vector<std::pair<string, string>> mDrmWrites;
+    bool mDrmWritable = true;
+    DisplayPortStateMachine mDisplayPort;
+};
+
+using Writes = std::vector<std::pair<string, string>>;
+
+TEST_F(DisplayPortStateMachineTest, BindsAndTrainsLink) {
+    mDisplayPort.bind(std::chrono::steady_clock::now());
+    EXPECT_EQ(mDisplayPort.state(), DisplayPortState::BOUND);
+
+    EXPECT_TRUE(change(DisplayPortAttribute::PIN_ASSIGNMENT, "C [D] E\n"));
+    EXPECT_EQ(mDisplayPort.state(), DisplayPortState::PIN_SET);
+    EXPECT_TRUE(change(DisplayPortAttribute::ORIENTATION, "reverse\n"));
+    EXPECT_TRUE(change(DisplayPortAttribute::HPD, "1\n"));
+    EXPECT_EQ(mDisplayPort.state(), DisplayPortState::HPD_HIGH);
+    EXPECT_TRUE(change(DisplayPortAttribute::LINK_STATUS, "1\n"));
+    EXPECT_EQ(mDisplayPort.state(), DisplayPortState::LINK_OK);
+
+    EXPECT_EQ(mDrmWrites, (Writes{{"pin_assignment", "D"},
+                                  {"orientation", "reverse\n"},
+                                  {"hpd", "1\n"}}));
+}
+
+TEST_F(DisplayPortStateMachineTest, LinkTrainingFails) {
+    bindAndTrain();
+
+    EXPECT_TRUE(change(DisplayPortAttribute::LINK_STATUS, "2\n"));
+    EXPECT_EQ(mDisplayPort.state(), DisplayPortState::LINK_FAIL);
+    // A retrained link recovers
+    EXPECT_TRUE(change(DisplayPortAttribute::LINK_STATUS, "1\n"));
+    EXPECT_EQ(mDisplayPort.state(), DisplayPortState::LINK_OK);
+    EXPECT_TRUE(mDrmWrites.empty());
+}
+
+TEST_F(DisplayPortStateMachineTest, IgnoresLinkStatusBeforeHpd) {
+    mDisplayPort.bind(std::chrono::steady_clock::now());
+    EXPECT_TRUE(change(DisplayPortAttribute::LINK_STATUS, "1\n"));
+    EXPECT_EQ(mDisplayPort.state(), DisplayPortState::BOUND);
+}
+
+TEST_F(DisplayPortStateMachineTest, HpdBeforePinAndOrientation) {
+    mNodes[DisplayPortAttribute::PIN_ASSIGNMENT] = "[C] D\n";
+    mNodes[DisplayPortAttribute::ORIENTATION] = "normal\n";
+    mDisplayPort.bind(std::chrono::steady_clock::now());
+
+    EXPECT_TRUE(change(DisplayPortAttribute::HPD, "1\n"));
+    EXPECT_EQ(mDisplayPort.state(), DisplayPortState::HPD_HIGH);
+    EXPECT_EQ(mDrmWrites, (Writes{{"pin_assignment", "C"},
+                                  {"orientation", "normal\n"},
+                                  {"hpd", "1\n"}}));
+}
+
+TEST_F(DisplayPortStateMachineTest, HpdWithoutPinAssignmentStaysBound) {
+    mNodes[DisplayPortAttribute::PIN_ASSIGNMENT] = "C D E\n";
+    mDisplayPort.bind(std::chrono::steady_clock::now());
+
+    EXPECT_FALSE(change(DisplayPortAttribute::PIN_ASSIGNMENT, "C D E\n"));
+    EXPECT_TRUE(change(DisplayPortAttribute::HPD, "1\n"));
+    EXPECT_EQ(mDisplayPort.state(), DisplayPortState::BOUND);
+}
+
+TEST_F(DisplayPortStateMachineTest, HpdToggles) {
+    bindAndTrain();
+
+    EXPECT_TRUE(change(DisplayPortAttribute::HPD, "0\n"));
+    EXPECT_EQ(mDisplayPort.state(), DisplayPortState::PIN_SET);
+    EXPECT_TRUE(change(DisplayPortAttribute::HPD, "1\n"));
+    EXPECT_EQ(mDisplayPort.state(), DisplayPortState::HPD_HIGH);
+    EXPECT_EQ(mDrmWrites, (Writes{{"hpd", "0\n"}, {"hpd", "1\n"}}));
+}
+
+TEST_F(DisplayPortStateMachineTest, SkipsUnchangedDrmValues) {
+    bindAndTrain();
+
+    EXPECT_TRUE(change(DisplayPortAttribute::PIN_ASSIGNMENT, "C [D] E\n"));
+    EXPECT_TRUE(change(DisplayPortAttribute::HPD, "1"));
+    EXPECT_TRUE(mDrmWrites.empty());
+}
+
+TEST_F(DisplayPortStateMachineTest, RetriesFailedDrmWrite) {
+    mDisplayPort.bind(std::chrono::steady_clock::now());
+    mDrmWritable = false;
+    EXPECT_FALSE(change(DisplayPortAttribute::PIN_ASSIGNMENT, "C [D] E\n"));
+    EXPECT_EQ(mDisplayPort.state(), DisplayPortState::BOUND);
+
+    mDrmWritable = true;
+    EXPECT_TRUE(change(DisplayPortAttribute::PIN_ASSIGNMENT, "C [D] E\n"));
+    EXPECT_EQ(mDisplayPort.state(), DisplayPortState::PIN_SET);
+    EXPECT_EQ(mDrmWrites, (Writes{{"pin_assignment", "D"}, {"pin_assignment", "D"}}));
+}
+
+TEST_F(DisplayPortStateMachineTest, UnbindDropsHpd) {
+    bindAndTrain();
+
+    mDisplayPort.unbind();
+    EXPECT_EQ(mDisplayPort.state(), DisplayPortState::IDLE);
+    EXPECT_EQ(mDrmWrites, (Writes{{"hpd", "0"}}));
+
+    // Fired just before the partner went away
+    EXPECT_FALSE(change(DisplayPortAttribute::HPD, "1\n"));
+    mDisplayPort.unbind();
+    EXPECT_EQ(mDrmWrites.size(), 1u);
+}
+
+TEST_F(DisplayPortStateMachineTest, RebindWritesEverythingAgain) {
+    bindAndTrain();
+
+    // Back to back binds, the drm driver may have been reset in between
+    mDisplayPort.bind(std::chrono::steady_clock::now());
+    EXPECT_EQ(mDisplayPort.state(), DisplayPortState::BOUND);
+    EXPECT_TRUE(change(DisplayPortAttribute::PIN_ASSIGNMENT, "C [D] E\n"));
+    EXPECT_TRUE(change(DisplayPortAttribute::HPD, "1\n"));
+    EXPECT_EQ(mDisplayPort.state(), DisplayPortState::HPD_HIGH);
+    EXPECT_EQ(mDrmWrites, (Writes{{"pin_assignment", "D"},
+                                  {"orientation", "normal\n"},
+                                  {"hpd", "1\n"}}));
+}
+
+TEST_F(DisplayPortStateMachineTest, ForwardsNewIrqHpdCounts) {
+    bindAndTrain();
+    const auto now = std::chrono::steady_clock::now();
+
+    mDisplayPort.irqHpd("1\n", now);
+    mDisplayPort.irqHpd("1\n", now);
+    mDisplayPort.irqHpd("2\n", now);
+    mDisplayPort.irqHpd("bogus", now);
+    EXPECT_EQ(mDrmWrites, (Writes{{"irq_hpd", "1\n"}, {"irq_hpd", "2\n"}}));
+}
+
+TEST_F(DisplayPortStateMachineTest, DockCyclesStartFromScratch) {
+    // Unplugging and replugging the same dock presents the same values every time
+    for (int cycle = 0; cycle < 4; cycle++) {
+        SCOPED_TRACE(cycle);
+        const auto now = std::chrono::steady_clock::now();
+        mDrmWrites.clear();
+
+        mDisplayPort.bind(now);
+        EXPECT_TRUE(change(DisplayPortAttribute::PIN_ASSIGNMENT, "C [D] E\n"));
+        EXPECT_TRUE(change(DisplayPortAttribute::ORIENTATION, "normal\n"));
+        EXPECT_TRUE(change(DisplayPortAttribute::HPD, "1\n"));
+        EXPECT_TRUE(change(DisplayPortAttribute::LINK_STATUS, "1\n"));
+        EXPECT_EQ(mDisplayPort.state(), DisplayPortState::LINK_OK);
+        mDisplayPort.irqHpd("1\n", now);
+
+        mDisplayPort.unbind();
+        EXPECT_EQ(mDisplayPort.state(), DisplayPortState::IDLE);
+        EXPECT_EQ(mDrmWrites, (Writes{{"pin_assignment", "D"},
+                                      {"orientation", "normal\n"},
+                                      {"hpd", "1\n"},
+                                      {"irq_hpd", "1\n"},
+                                      {"hpd", "0"}}));
+        mNodes.clear();
+    }
+}
+
+}  // namespace
+}  // namespace usb
+}  // namespace hardware
+}  // namespace android
+}  // namespace aidl